@@ -1,12 +1,16 @@
 #!/bin/bash
 echo "Build ctelnet minimal telnet client"
 gcc ctelnet.c -o ctelnet
-sudo cp ctelnet /usr/local/bin
+gcc ctdecode.c -o ctdecode
+gcc ctreplay.c -o ctreplay
+sudo cp ctelnet ctdecode ctreplay /usr/local/bin
 #
 # Fix some Apple insanity, at least until Apple further "improves
 # security" ... which is likely to happen.
 #
 if [[ "$OSTYPE" == "darwin"* ]]; then
     sudo codesign --force --deep --sign - /usr/local/bin/ctelnet
+    sudo codesign --force --deep --sign - /usr/local/bin/ctdecode
+    sudo codesign --force --deep --sign - /usr/local/bin/ctreplay
 fi
 echo "Done."
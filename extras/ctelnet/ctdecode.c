@@ -0,0 +1,123 @@
+// Decode a ctelnet --trace file into the same text that ctelnet --log writes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "ctelnet_trace.h"
+
+// Defines
+
+#define MAXSESSIONS 1000
+
+// Globals
+
+static int bytes_in[MAXSESSIONS];     ///< Bytes received from host, per session.
+static int bytes_out[MAXSESSIONS];    ///< Bytes sent to host, per session.
+
+int main(int argc , char *argv[])
+//-------------------------------
+/// @brief Print a trace file in ctelnet --log format.
+///
+/// Options: -t prefixes each line with the time since the trace started, -s N
+/// shows only session N and -S prefixes each line with its session number.
+///
+/// @param argc Command line argument count.
+/// @param argv Command line word string argument pointers.
+/// @return 0 if OK, else 1.
+{
+  FILE* ftrace = NULL;
+  struct trace_file_header hdr;
+  struct trace_record rec;
+  unsigned char* data = NULL;
+  size_t data_size = 0;
+  int show_time = 0;
+  int show_session = 0;
+  int only_session = -1;
+  int ia;
+  uint32_t i;
+  char prefix[64] = {0};
+
+  for( ia=1; ia<argc-1; ia++ ){
+    if( !strcmp( argv[ia], "-t" ) ){
+      show_time = 1;
+    }
+    else if( !strcmp( argv[ia], "-S" ) ){
+      show_session = 1;
+    }
+    else if( !strcmp( argv[ia], "-s" ) && (ia < (argc-2)) ){
+      only_session = atoi(argv[++ia]);
+    }
+    else{
+      fprintf(stderr, "WARNING: Unknown option: %s (ignored)\n", argv[ia]);
+    }
+  }
+  if( argc < 2 ){
+    fprintf(stderr, "ERROR: Usage: %s [-t -S -s session] trace_file\n", argv[0]);
+    return 1;
+  }
+
+  ftrace = fopen(argv[argc-1], "rb");
+  if( ftrace == NULL ){
+    perror("ERROR: Could not open trace file.");
+    return 1;
+  }
+  if( fread(&hdr, sizeof(hdr), 1, ftrace) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0 ){
+    fprintf(stderr, "ERROR: %s is not a ctelnet trace file.\n", argv[argc-1]);
+    return 1;
+  }
+  if( hdr.order != TRACE_ORDER || hdr.version != TRACE_VERSION ){
+    fprintf(stderr, "ERROR: %s was written by a different ctelnet version or machine type.\n", argv[argc-1]);
+    return 1;
+  }
+
+  // Each record is a header followed by its bytes.
+  while( fread(&rec, sizeof(rec), 1, ftrace) == 1 ){
+    if( rec.len > data_size ){
+      unsigned char* bigger = realloc(data, rec.len);
+      if( bigger == NULL ){
+        fprintf(stderr, "ERROR: Out of memory.\n");
+        free(data);
+        fclose(ftrace);
+        return 1;
+      }
+      data = bigger;
+      data_size = rec.len;
+    }
+    if( fread(data, 1, rec.len, ftrace) != rec.len ){
+      fprintf(stderr, "WARNING: Trace file ends part way through a record.\n");
+      break;
+    }
+    if( rec.session >= MAXSESSIONS || (only_session >= 0 && rec.session != only_session) ){
+      continue;
+    }
+
+    prefix[0] = 0;
+    if( show_time ){
+      snprintf(prefix, sizeof(prefix), "%10.6f ", (double)rec.ns / 1.0e9);
+    }
+    if( show_session ){
+      snprintf(prefix + strlen(prefix), sizeof(prefix) - strlen(prefix), "S%03d ", rec.session);
+    }
+
+    if( rec.dir == TRACE_IN ){
+      for( i=0; i<rec.len; i++ ){
+        printf( "%sI %08d %02x %s\n", prefix, bytes_in[rec.session], data[i], asciimap[data[i]] );
+        ++bytes_in[rec.session];
+      }
+    }
+    else if( rec.dir == TRACE_OUT ){
+      for( i=0; i<rec.len; i++ ){
+        printf( "%sO                   %08d %02x %s\n", prefix, bytes_out[rec.session], data[i], asciimap[data[i]] );
+        ++bytes_out[rec.session];
+      }
+    }
+    else if( rec.dir == TRACE_MSG ){
+      printf( "%s%.*s", prefix, (int)rec.len, (const char*)data );
+    }
+  }
+
+  free(data);
+  fclose(ftrace);
+  return 0;
+}
@@ -1,6 +1,10 @@
 /* http://l3net.wordpress.com/2012/12/09/a-simple-telnet-client/ */
 // Considerably modified by Nick Glazzard, 2019,2021,2025.
 
+#if defined(__linux__)
+#define _GNU_SOURCE                   // For splice().
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -9,6 +13,7 @@
 #include <sys/errno.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <termios.h>
 #include <fcntl.h>
@@ -19,6 +24,19 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include "ctelnet_trace.h"
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define EV_HAVE_EPOLL
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) || defined(__DragonFly__)
+#include <sys/event.h>
+#define EV_HAVE_KQUEUE
+#endif
 
 // Defines
  
@@ -27,56 +45,206 @@
 #define WILL 0xfb
 #define DONT 0xfe
 #define CMD 0xff
+#define SE 0xf0
+#define SB 0xfa
 #define CMD_ECHO 1
 #define CMD_WINDOW_SIZE 3
 #define BUFLEN 20
+#define RECVBUFLEN 16384
+#define TRACEBUFLEN (1024*1024)
+#define TRACEFLUSHSECS 1
+#define PROMPTLEN 32
+#define MAXPROMPTS 16
+#define AC_MAXSTATES 256
+#define OUTBUFLEN 65536
+#define ECHOLEN 16
+#define ECHOUS 250000
+#define SBLEN 64
+#define EV_READ 1
+#define EV_WRITE 2
+#define EV_MAXFDS 4096
+#define MAXSESSIONS 1000
+#define EV_MAXEVENTS 16
+#define EV_HAIKUPOLLMS 50
+#define STATBUCKETS 32
+#define SENDQHIGH (4*RECVBUFLEN)
+#define TERMQHIGH (4*OUTBUFLEN)
+#define TERMQMAX (16*OUTBUFLEN)
+#define MAXADDRS 16
+#define CONNECTDELAYMS 250
+#define RECONNECTMINMS 250
+#define RECONNECTMAXMS 4000
+
+// Types
+
+enum telnet_state                     ///< Where the host input parser is within the telnet protocol.
+  {
+    TS_DATA,                          ///< Plain data.
+    TS_CMD,                           ///< Seen CMD (IAC).
+    TS_OPT,                           ///< Seen CMD DO/DONT/WILL/WONT, option byte next.
+    TS_SB,                            ///< Inside CMD SB ... CMD SE.
+    TS_SB_CMD                         ///< Seen CMD inside a subnegotiation.
+  };
+
+struct telnet_parser                  ///< Host input parser state carried between buffers.
+{
+  enum telnet_state state;            ///< Current parser state.
+  unsigned char verb;                 ///< DO, DONT, WILL or WONT awaiting its option byte.
+  unsigned char sb[SBLEN];            ///< Subnegotiation bytes, option code first.
+  int sblen;                          ///< Number of bytes in sb (beyond SBLEN is discarded).
+  uint64_t ncmds;                     ///< Telnet commands handled.
+};
+
+struct latency_hist                   ///< Counts of times taken, for the SIGUSR1 statistics.
+{
+  uint64_t count;                     ///< Number of times added.
+  uint64_t max_us;                    ///< Longest time added.
+  uint32_t bucket[STATBUCKETS];       ///< bucket[b] counts times of 2^(b-1) to 2^b - 1 us (bucket[0] is 0 us).
+};
+
+enum pace_mode                        ///< How scripted input is paced.
+  {
+    PACE_NONE,                        ///< Send everything as fast as the host takes it.
+    PACE_LINE,                        ///< Wait pace_ms after each line.
+    PACE_QUIET,                       ///< Wait until the host has sent nothing for pace_ms.
+    PACE_PROMPT                       ///< Wait for the host's prompt, but no more than pace_ms.
+  };
+
+struct session                        ///< One host connection and the terminal it serves.
+{
+  int index;                          ///< Position in the session table.
+  int sock;                           ///< Socket for connection to host, -1 once closed.
+  int term_in;                        ///< Terminal input (stdin or attached client), -1 if none.
+  int term_out;                       ///< Terminal output (stdout or attached client), -1 if none.
+  int listen_fd;                      ///< Unix socket terminals attach to (daemon mode), else -1.
+  int fin_fifo;                       ///< Input FIFO for scripting, -1 if none.
+  int fout_fifo;                      ///< Our write end of the FIFO (stops hang up being reported).
+  int bytes_in;                       ///< Bytes received from host.
+  int bytes_out;                      ///< Bytes sent to host.
+  int pace_ms;                        ///< Scripted input pacing time (see pace).
+  unsigned char pace;                 ///< Scripted input pacing (enum pace_mode).
+  unsigned char await_prompt;         ///< A scripted line was sent and the prompt is still awaited.
+  unsigned char* sq;                  ///< Scripted input waiting to be sent.
+  size_t sq_len;                      ///< Bytes in sq.
+  size_t sq_pos;                      ///< Next byte of sq to send.
+  size_t sq_cap;                      ///< Size of sq.
+  unsigned char* tq;                  ///< Bytes for the host not yet taken by the socket (a ring).
+  size_t tq_head;                     ///< Position in tq of the oldest byte.
+  size_t tq_len;                      ///< Bytes in tq.
+  size_t tq_cap;                      ///< Size of tq.
+  unsigned char tq_watch;             ///< The host socket is being watched for writability.
+  unsigned char key_waiting;          ///< Keyboard input is in tq (for key_hist).
+  unsigned char* wq;                  ///< Output the terminal has not taken yet.
+  size_t wq_head;                     ///< Position in wq of the oldest byte.
+  size_t wq_len;                      ///< Bytes in wq, from wq_head.
+  size_t wq_cap;                      ///< Size of wq.
+  unsigned char rx_paused;            ///< Host input is not read until the terminal catches up.
+  uint64_t last_tx_ms;                ///< When the last scripted line was sent.
+  uint64_t reconnect_at_ms;           ///< When to try to reconnect to the host (--reconnect), 0 if not waiting to.
+  int reconnect_ms;                   ///< Wait before the next reconnect attempt after this one fails.
+  int conn_fd[MAXADDRS];              ///< Sockets of the connect() calls in progress while reconnecting.
+  unsigned char conn_addr[MAXADDRS];  ///< Index in host_addrs of each of those.
+  int nconn;                          ///< Number of connect() calls in progress.
+  int conn_next;                      ///< Index in host_addrs of the next address to try.
+  uint64_t conn_next_ms;              ///< When to start connecting to that address.
+  uint64_t conn_deadline_ms;          ///< When this reconnect attempt gives up, 0 if none is under way.
+  unsigned char was_connected;        ///< Has been connected to its host, so connecting again is reconnecting.
+  uint64_t last_rx_ms;                ///< When host output was last received.
+  unsigned char ac_state;             ///< Prompt matcher state, carried from one host buffer to the next.
+  unsigned char* ob;                  ///< Host output not yet written to the terminal.
+  size_t ob_len;                      ///< Bytes in ob.
+  uint64_t ob_first_us;               ///< When the oldest byte in ob arrived.
+  uint64_t ob_last_us;                ///< When the newest byte in ob arrived.
+  uint64_t last_key_us;               ///< When keyboard input was last sent to the host.
+  uint64_t rx_us;                     ///< When the host data being handled was received.
+  uint64_t recv_calls;                ///< recv() calls that got data from the host.
+  uint64_t send_calls;                ///< writev() calls to the host.
+  uint64_t term_bytes;                ///< Host output bytes written to the terminal.
+  uint64_t term_writes;               ///< write() calls for host output to the terminal.
+  struct latency_hist rx_hist;        ///< Host data received to written to the terminal.
+  struct latency_hist key_hist;       ///< Keyboard input read to sent to the host.
+  unsigned char send_crlf_at_newline; ///< Send LF to host after sending CR.
+  unsigned char send_cr_after_lf;     ///< Send CR to host after sending LF. Useless, probably.
+  unsigned char show_lf_after_newline;///< Send LF to terminal after CR from terminal.
+  unsigned char raw;                  ///< Peer is a ctelnet daemon, not a telnet server: no telnet commands.
+  struct telnet_parser tparse;        ///< Host input telnet parser.
+};
+
+struct ev_event                       ///< A readiness event returned by an event backend.
+{
+  int fd;                             ///< File descriptor that is ready.
+  int events;                         ///< EV_READ and/or EV_WRITE.
+  void* tag;                          ///< Tag given when fd was registered.
+};
+
+struct ev_slot                        ///< A file descriptor registered with an event backend.
+{
+  int fd;                             ///< File descriptor.
+  int events;                         ///< EV_READ and/or EV_WRITE wanted.
+  void* tag;                          ///< Tag to return with events.
+};
+
+struct ev_backend                     ///< An event notification mechanism (epoll, kqueue or poll).
+{
+  const char* name;                   ///< Name for messages.
+  int (*init)( void );                ///< Set up. Returns 0 if OK.
+  int (*set)( int fd, int events, void* tag ); ///< Add, change or remove (events 0) an fd.
+  int (*wait)( struct ev_event* out, int maxout, int timeout_ms ); ///< Wait. -1 timeout waits forever.
+};
 
 // Globals
 
 static struct termios tin;            ///< Saved terminal characteristics on entry.
 static FILE* flog = NULL;             ///< Log file.
-static int send_crlf_at_newline = 0;  ///< Send LF to host after sending CR.
-static int send_cr_after_lf = 0;      ///< Send CR to host after sending LF. Useless, probably.
-static int show_lf_after_newline = 0; ///< Send LF to terminal after CR from terminal.
-static int bytes_in=0;                ///< Bytes received from host.
-static int bytes_out=0;               ///< Bytes sent to host.
-static int slow_pause=0;              ///< Wait this many seconds after sending a newline.
-static char* asciimap[] =             ///< ASCII byte values to string for log file.
-  {
-    "NUL", "SOH", "STX", "ETX", "EOT", "ENQ", "ACK", "BEL",
-    "BS",  "TAB", "LF",  "VT",  "FF",  "CR",  "SO",  "SI",
-    "DLE", "DC1", "DC2", "DC3", "DC4", "NAK", "SYN", "ETB",
-    "CAN", "EM",  "SUB", "ESC", "FS",  "GS",  "RS",  "US",
-    " SP", "!",   "\"",  "#",   "$",   "%",   "&",   "'",
-    "(",   ")",   "*",   "+",   ",",   "-",   ".",   "/",
-    "0",   "1",   "2",   "3",   "4",   "5",   "6",   "7",
-    "8",   "9",   ":",   ";",   "<",   "=",   ">",   "?",
-    "@",   "A",   "B",   "C",   "D",   "E",   "F",   "G",
-    "H",   "I",   "J",   "K",   "L",   "M",   "N",   "O",
-    "P",   "Q",   "R",   "S",   "T",   "U",   "V",   "W",
-    "X",   "Y",   "Z",   "[",   "\\",  "]",   "^",   "_",
-    "`",   "a",   "b",   "c",   "d",   "e",   "f",   "g",
-    "h",   "i",   "j",   "k",   "l",   "m",   "n",   "o",
-    "p",   "q",   "r",   "s",   "t",   "u",   "v",   "w",
-    "x",   "y",   "z",   "{",   "|",   "}",   "~",   "DEL",
-
-    "8/NUL", "8/SOH", "8/STX", "8/ETX", "8/EOT", "8/ENQ", "8/ACK", "8/BEL",
-    "8/BS",  "8/TAB", "8/LF",  "8/VT",  "8/FF",  "8/CR",  "8/SO",  "8/SI",
-    "8/DLE", "8/DC1", "8/DC2", "8/DC3", "8/DC4", "8/NAK", "8/SYN", "8/ETB",
-    "8/CAN", "8/EM",  "8/SUB", "8/ESC", "8/FS",  "8/GS",  "8/RS",  "8/US",
-    " 8/SP", "8/!",   "8/\"",  "8/#",   "8/$",   "8/%",   "8/&",   "8/'",
-    "8/(",   "8/)",   "8/*",   "8/+",   "8/,",   "8/-",   "8/.",   "8//",
-    "8/0",   "8/1",   "8/2",   "8/3",   "8/4",   "8/5",   "8/6",   "8/7",
-    "8/8",   "8/9",   "8/:",   "8/;",   "8/<",   "8/=",   "8/>",   "8/?",
-    "8/@",   "8/A",   "8/B",   "8/C",   "8/D",   "8/E",   "8/F",   "8/G",
-    "8/H",   "8/I",   "8/J",   "8/K",   "8/L",   "8/M",   "8/N",   "8/O",
-    "8/P",   "8/Q",   "8/R",   "8/S",   "8/T",   "8/U",   "8/V",   "8/W",
-    "8/X",   "8/Y",   "8/Z",   "8/[",   "8/\\",  "8/]",   "8/^",   "8/_",
-    "8/`",   "8/a",   "8/b",   "8/c",   "8/d",   "8/e",   "8/f",   "8/g",
-    "8/h",   "8/i",   "8/j",   "8/k",   "8/l",   "8/m",   "8/n",   "8/o",
-    "8/p",   "8/q",   "8/r",   "8/s",   "8/t",   "8/u",   "8/v",   "8/w",
-    "8/x",   "8/y",   "8/z",   "8/{",   "8/|",   "8/}",   "8/~",   "8/DEL"
-  };
+static struct session* sessions = NULL; ///< Session table.
+static int nsessions = 0;             ///< Number of entries in the session table.
+static int nlive = 0;                 ///< Number of sessions still connected to their host, or reconnecting.
+static int nreconnecting = 0;         ///< Number of sessions waiting to reconnect to their host.
+static int reconnect = 0;             ///< --reconnect: reconnect to the host when it closes the connection.
+static int connect_timeout_ms = 5000; ///< Time allowed for connecting to the host.
+static const char* host_name = NULL;  ///< Host name or address, as given.
+static const char* host_port = NULL;  ///< Port number or service name, as given.
+static struct addrinfo* host_info = NULL; ///< Host addresses from getaddrinfo().
+static struct addrinfo* host_addrs[MAXADDRS]; ///< The host addresses, address families interleaved.
+static int nhost_addrs = 0;           ///< Number of entries in host_addrs.
+static char sess_prefix[80] = {0};    ///< Unix socket name prefix for daemon mode sessions.
+static int use_splice = 0;            ///< Relay host output to stdout with splice() (Linux).
+static int splice_pipe[2] = {-1, -1}; ///< Pipe between socket and stdout for splice().
+static int trace_fd = -1;             ///< Binary trace file.
+static unsigned char* trace_buf = NULL; ///< Trace records not yet written to trace_fd.
+static size_t trace_len = 0;          ///< Bytes in trace_buf.
+static struct timespec trace_start;   ///< When the trace started (CLOCK_MONOTONIC).
+static time_t trace_flushed = 0;      ///< When trace_buf was last written out (CLOCK_MONOTONIC seconds).
+static int trace_session = 0;         ///< Session number for trace records made by logit().
+static char prompts[MAXPROMPTS][PROMPTLEN]; ///< Host prompts for --pace prompt:MS.
+static int nprompts = 0;              ///< Number of entries in prompts.
+static unsigned char ac_next[AC_MAXSTATES][256]; ///< Prompt matcher (Aho-Corasick) state transitions.
+static unsigned char ac_match[AC_MAXSTATES]; ///< Non-zero for states where a prompt has just been matched.
+static int nscripted = 0;             ///< Number of sessions with scripted input waiting.
+static int coalesce_us = 2000;        ///< Host idle time before buffered output is written, 0 to write at once.
+static int nbuffered = 0;             ///< Number of sessions with host output buffered.
+static int nqueued = 0;               ///< Number of sessions with bytes for the host queued.
+static int tcp_nodelay = 0;           ///< Set TCP_NODELAY on host connections.
+static int tcp_rcvbuf = 0;            ///< SO_RCVBUF for host connections, 0 for the system default.
+static int tcp_sndbuf = 0;            ///< SO_SNDBUF for host connections, 0 for the system default.
+static int tcp_keepidle = 0;          ///< Enable TCP keepalive after this many idle seconds, 0 for off.
+static volatile sig_atomic_t stats_wanted = 0; ///< Set by SIGUSR1: print the statistics.
+static int bench = 0;                 ///< --bench: report receive throughput and timing on exit.
+static struct timespec bench_first;   ///< When host_receive() first got data (CLOCK_MONOTONIC).
+static struct timespec bench_last;    ///< When host_receive() last finished with data.
+static uint64_t bench_bytes = 0;      ///< Bytes received from hosts.
+static uint32_t* bench_ns = NULL;     ///< Time taken by each host_receive() call that got data (ns).
+static size_t bench_reads = 0;        ///< Entries used in bench_ns.
+static size_t bench_size = 0;         ///< Entries allocated in bench_ns.
+
+void trace_record( int session, int dir, const void* data, size_t n );
+static int host_resolve( void );
+static int host_connect( void );
+static int connect_start( const struct addrinfo* ai );
+static int connect_result( int fd );
+static void addr_text( const struct addrinfo* ai, char* text, size_t len );
+static void host_abandon( struct session* s );
+static void sock_report( int sock, char* text, size_t len );
 
 void logit( const char* fmt, ... )
 //--------------------------------
@@ -91,16 +259,289 @@ void logit( const char* fmt, ... )
     va_end(args);
     fflush(flog);
   }
+  if( trace_fd >= 0 ){
+    char msg[512];
+    int n;
+    va_start(args, fmt);
+    n = vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    if( n > 0 ){
+      trace_record(trace_session, TRACE_MSG, msg, (n < (int)sizeof(msg)) ? (size_t)n : sizeof(msg) - 1);
+    }
+  }
 }
 
-void negotiate(int sock, unsigned char *buf, int len)
-//---------------------------------------------------
+static void logbyte( const char* fmt, int count, unsigned char c )
+//----------------------------------------------------------------
+/// @brief Write one byte sent or received to the log file. Not traced: the trace has the bytes already.
+/// @param fmt Format string, with the byte count, hex value and name.
+/// @param count Bytes sent or received so far.
+/// @param c The byte.
+{
+  fprintf(flog, fmt, count, c, asciimap[c]);
+  fflush(flog);
+}
+
+void trace_flush( void )
+//----------------------
+/// @brief Write out all buffered trace records with one write().
+{
+  unsigned char* p = trace_buf;
+  struct timespec now;
+
+  while( trace_len > 0 ){
+    ssize_t nw = write(trace_fd, p, trace_len);
+    if( nw < 0 ){
+      if( errno == EINTR ){
+        continue;
+      }
+      perror("ERROR: Could not write() trace file. Tracing stopped.");
+      close(trace_fd);
+      trace_fd = -1;
+      break;
+    }
+    p += nw;
+    trace_len -= (size_t)nw;
+  }
+  trace_len = 0;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  trace_flushed = now.tv_sec;
+}
+
+void trace_record( int session, int dir, const void* data, size_t n )
+//-------------------------------------------------------------------
+/// @brief Add a timestamped record of a run of bytes to the trace.
+///
+/// Records are collected in memory and written out in large blocks, when the
+/// buffer fills, when the event loop has been idle for a while and at exit.
+/// ctdecode turns a trace file into the same text as --log.
+///
+/// @param session Session number.
+/// @param dir TRACE_IN, TRACE_OUT or TRACE_MSG.
+/// @param data Bytes to record.
+/// @param n Number of bytes in data.
+{
+  struct trace_record rec;
+  struct timespec now;
+
+  if( trace_fd < 0 ){
+    return;
+  }
+  if( n > TRACEBUFLEN - sizeof(rec) ){
+    n = TRACEBUFLEN - sizeof(rec);
+  }
+  if( trace_len + sizeof(rec) + n > TRACEBUFLEN ){
+    trace_flush();
+    if( trace_fd < 0 ){
+      return;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  rec.ns = (uint64_t)(now.tv_sec - trace_start.tv_sec) * 1000000000ULL + (uint64_t)now.tv_nsec - (uint64_t)trace_start.tv_nsec;
+  rec.len = (uint32_t)n;
+  rec.session = (uint16_t)session;
+  rec.dir = (uint8_t)dir;
+  rec.pad = 0;
+  memcpy(trace_buf + trace_len, &rec, sizeof(rec));
+  memcpy(trace_buf + trace_len + sizeof(rec), data, n);
+  trace_len += sizeof(rec) + n;
+}
+
+static void trace_idle( void )
+//----------------------------
+/// @brief Write out buffered trace records if they have been waiting a while.
+///
+/// Called before the event loop blocks, so an idle session's trace is on disk.
+{
+  struct timespec now;
+  if( trace_fd >= 0 && trace_len > 0 ){
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if( now.tv_sec - trace_flushed >= TRACEFLUSHSECS ){
+      trace_flush();
+    }
+  }
+}
+
+static void bench_sample( const struct timespec* t0, int nbytes )
+//---------------------------------------------------------------
+/// @brief Record how long one host_receive() call took, for --bench.
+/// @param t0 When the call started (CLOCK_MONOTONIC).
+/// @param nbytes Bytes it received from the host. Calls that received nothing are not counted.
+{
+  struct timespec t1;
+  uint64_t ns;
+
+  if( nbytes <= 0 ){
+    return;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if( bench_reads == 0 ){
+    bench_first = *t0;
+  }
+  bench_last = t1;
+  bench_bytes += (uint64_t)nbytes;
+  if( bench_reads == bench_size ){
+    size_t size = (bench_size == 0) ? 65536 : 2 * bench_size;
+    uint32_t* p = realloc(bench_ns, size * sizeof(uint32_t));
+    if( p == NULL ){
+      return;
+    }
+    bench_ns = p;
+    bench_size = size;
+  }
+  ns = (uint64_t)(t1.tv_sec - t0->tv_sec) * 1000000000ULL + (uint64_t)t1.tv_nsec - (uint64_t)t0->tv_nsec;
+  bench_ns[bench_reads++] = (ns > UINT32_MAX) ? UINT32_MAX : (uint32_t)ns;
+}
+
+static int bench_compare( const void* a, const void* b )
+//------------------------------------------------------
+/// @brief qsort() comparison for bench_ns entries.
+{
+  uint32_t va = *(const uint32_t*)a;
+  uint32_t vb = *(const uint32_t*)b;
+  return (va > vb) - (va < vb);
+}
+
+static void bench_report( void )
+//------------------------------
+/// @brief Print the --bench results to stderr. Called on exit.
+{
+  struct rusage ru;
+  double secs;
+  long peak_kb;
+
+  if( bench_reads == 0 ){
+    fprintf(stderr, "INFO: --bench: nothing was received.\n");
+    return;
+  }
+  secs = (double)(bench_last.tv_sec - bench_first.tv_sec) + 1.0e-9 * (double)(bench_last.tv_nsec - bench_first.tv_nsec);
+  qsort(bench_ns, bench_reads, sizeof(uint32_t), bench_compare);
+  fprintf(stderr, "INFO: --bench: %" PRIu64 " bytes in %zu reads over %.3f s: %.0f bytes/s, %.0f reads/s.\n",
+          bench_bytes, bench_reads, secs, (secs > 0.0) ? (double)bench_bytes / secs : 0.0,
+          (secs > 0.0) ? (double)bench_reads / secs : 0.0);
+  fprintf(stderr, "INFO: --bench: host_receive() us: p50 %.1f p90 %.1f p99 %.1f max %.1f.\n",
+          1.0e-3 * bench_ns[bench_reads / 2], 1.0e-3 * bench_ns[(bench_reads * 9) / 10],
+          1.0e-3 * bench_ns[(bench_reads * 99) / 100], 1.0e-3 * bench_ns[bench_reads - 1]);
+  getrusage(RUSAGE_SELF, &ru);
+#if defined(__APPLE__)
+  peak_kb = (long)(ru.ru_maxrss / 1024);  // Bytes on macOS.
+#else
+  peak_kb = (long)ru.ru_maxrss;
+#endif
+  fprintf(stderr, "INFO: --bench: peak memory %ld KB.\n", peak_kb);
+  free(bench_ns);
+  bench_ns = NULL;
+}
+
+static void trace_close( void )
+//-----------------------------
+/// @brief Write out the rest of the trace and close the file. Called on exit.
+{
+  if( trace_fd >= 0 ){
+    trace_flush();
+    if( trace_fd >= 0 ){
+      close(trace_fd);
+    }
+    trace_fd = -1;
+  }
+}
+
+static int trace_open( const char* filename )
+//-------------------------------------------
+/// @brief Create a trace file and write its header.
+/// @param filename Name of trace file.
+/// @return 0 if OK, 1 on error.
+{
+  struct trace_file_header hdr;
+  struct timespec wall;
+
+  trace_buf = malloc(TRACEBUFLEN);
+  trace_fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if( trace_buf == NULL || trace_fd < 0 ){
+    return 1;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+  hdr.order = TRACE_ORDER;
+  hdr.version = TRACE_VERSION;
+  clock_gettime(CLOCK_REALTIME, &wall);
+  hdr.start_sec = (int64_t)wall.tv_sec;
+  hdr.start_nsec = (int64_t)wall.tv_nsec;
+  clock_gettime(CLOCK_MONOTONIC, &trace_start);
+  trace_flushed = trace_start.tv_sec;
+  memcpy(trace_buf, &hdr, sizeof(hdr));
+  trace_len = sizeof(hdr);
+  atexit(trace_close);
+  return 0;
+}
+
+static int host_queue( struct session* s, const unsigned char* buf, size_t n )
+//----------------------------------------------------------------------------
+/// @brief Queue bytes to be sent to the host.
+///
+/// Nothing is sent here. host_flush() sends everything queued, once per pass of
+/// the event loop, so keystrokes, scripted input and negotiation replies queued
+/// together go in one writev().
+///
+/// @param s Session.
+/// @param buf Bytes to send.
+/// @param n Number of bytes in buf.
+/// @return 0 if OK, 1 if out of memory.
+{
+  size_t tail, first;
+
+  if( n == 0 ){
+    return 0;
+  }
+  if( s->tq_len + n > s->tq_cap ){
+    size_t cap = (s->tq_cap == 0) ? RECVBUFLEN : s->tq_cap;
+    unsigned char* tq;
+    while( cap < s->tq_len + n ){
+      cap *= 2;
+    }
+    tq = malloc(cap);
+    if( tq == NULL ){
+      return 1;
+    }
+    // Unwrap the ring into the new buffer.
+    if( s->tq_len > 0 ){
+      first = s->tq_cap - s->tq_head;
+      if( first > s->tq_len ){
+        first = s->tq_len;
+      }
+      memcpy(tq, s->tq + s->tq_head, first);
+      memcpy(tq + first, s->tq, s->tq_len - first);
+    }
+    free(s->tq);
+    s->tq = tq;
+    s->tq_cap = cap;
+    s->tq_head = 0;
+  }
+  if( s->tq_len == 0 ){
+    ++nqueued;
+  }
+  tail = (s->tq_head + s->tq_len) % s->tq_cap;
+  first = s->tq_cap - tail;
+  if( first > n ){
+    first = n;
+  }
+  memcpy(s->tq + tail, buf, first);
+  memcpy(s->tq, buf + first, n - first);
+  s->tq_len += n;
+  return 0;
+}
+
+void negotiate(struct session* s, unsigned char *buf, int len)
+//------------------------------------------------------------
 /// @brief Handle telnet property negotiation with the host.
 ///
 /// More or different things might be needed here for some host OSes.
 /// DtCyber NPU simulation does no negotiation, so this isn't used there.
+/// Replies are queued with the session's other output for the host.
 ///
-/// @param sock Socket file descriptor.
+/// @param s Session.
 /// @param buf Buffer containing bytes of telnet CMD message from host.
 /// @param len Number of bytes in buf.
 {
@@ -111,20 +552,20 @@ void negotiate(int sock, unsigned char *buf, int len)
   if (buf[1] == DO && buf[2] == CMD_WINDOW_SIZE) {
     logit( "... DO CMD_WINDOW_SIZE received.\n" );
     unsigned char tmp1[10] = {255, 251, 31};
-    if (send(sock, tmp1, 3 , 0) < 0){
-      perror("ERROR: Could not send() (negotiate case 1).");
-      logit("ERROR: send() failed (negotiate case 1).\n");
+    if( host_queue(s, tmp1, 3) != 0 ){
+      fprintf(stderr, "ERROR: Out of memory for telnet reply (negotiate case 1).\n");
+      logit("ERROR: Could not queue telnet reply (negotiate case 1).\n");
       exit(1);
     }
-    logit( "... sent: 255, 251, 31\n" );
+    logit( "... queued: 255, 251, 31\n" );
 
     unsigned char tmp2[10] = {255, 250, 31, 0, 80, 0, 24, 255, 240};
-    if (send(sock, tmp2, 9, 0) < 0){
-      perror("ERROR: Could not send() (negotiate case 2).");
-      logit("ERROR: send() failed (negotiate case 2).\n");
+    if( host_queue(s, tmp2, 9) != 0 ){
+      fprintf(stderr, "ERROR: Out of memory for telnet reply (negotiate case 2).\n");
+      logit("ERROR: Could not queue telnet reply (negotiate case 2).\n");
       exit(1);
     }
-    logit( "... sent: 255, 250, 31, 0, 80, 0, 24, 255, 240\n" );
+    logit( "... queued: 255, 250, 31, 0, 80, 0, 24, 255, 240\n" );
     logit( "... returning from negotiate()\n" );
     return;
   }
@@ -146,12 +587,129 @@ void negotiate(int sock, unsigned char *buf, int len)
     }
   }
  
-  if( send(sock, buf, len, 0) < 0 ){
-    perror("ERROR: Could not send() (negotiate case 3).");
-    logit("ERROR: send() failed (negotiate case 3).\n");
+  if( host_queue(s, buf, (size_t)len) != 0 ){
+    fprintf(stderr, "ERROR: Out of memory for telnet reply (negotiate case 3).\n");
+    logit("ERROR: Could not queue telnet reply (negotiate case 3).\n");
     exit(1);
   }
-  logit( "... returning from negotiate() after sending %d chars to host.\n", len );
+  logit( "... returning from negotiate() after queueing %d chars for host.\n", len );
+}
+  
+void subnegotiate(struct session* s, const unsigned char *buf, int len)
+//---------------------------------------------------------------------
+/// @brief Handle a telnet subnegotiation (CMD SB ... CMD SE) from the host.
+///
+/// No option that has subnegotiations is ever agreed to, so these are just logged.
+///
+/// @param s Session.
+/// @param buf Buffer containing the subnegotiation bytes, starting with the option code.
+/// @param len Number of bytes in buf.
+{
+  (void)s;
+  logit( "INFO: subnegotiate() ignoring option %d, %d bytes.\n", (len > 0) ? buf[0] : -1, len );
+}
+
+size_t telnet_scan(struct telnet_parser *tp, struct session* s, const unsigned char *in, size_t n, unsigned char *out)
+//-------------------------------------------------------------------------------------------------------------------
+/// @brief Separate telnet commands from data in a buffer of bytes received from the host.
+///
+/// The whole buffer is scanned in one pass. Runs of plain data are copied to out
+/// and each complete command is acted on as soon as its last byte is seen. A command
+/// that is split across buffers is carried over in tp, so this never has to wait
+/// for more bytes. CMD CMD is an escaped 0xff data byte.
+///
+/// @param tp Parser state. Carried from one call to the next.
+/// @param s Session (for replies to the host).
+/// @param in Buffer containing bytes received from the host.
+/// @param n Number of bytes in in.
+/// @param out Buffer for data bytes. At least n bytes. May be the same as in.
+/// @return Number of data bytes placed in out.
+{
+  size_t i = 0;
+  size_t nout = 0;
+  unsigned char c;
+  unsigned char cmd[3];
+
+  while( i < n ){
+    switch( tp->state ){
+
+    case TS_DATA: {
+      // Copy everything up to the next CMD in one go.
+      const unsigned char *pcmd = memchr(in + i, CMD, n - i);
+      size_t end = (pcmd == NULL) ? n : (size_t)(pcmd - in);
+      if( end > i ){
+        memmove(out + nout, in + i, end - i);
+        nout += end - i;
+      }
+      i = end;
+      if( pcmd != NULL ){
+        tp->state = TS_CMD;
+        ++i;
+      }
+      break;
+    }
+
+    case TS_CMD:
+      c = in[i++];
+      if( c == CMD ){
+        // Escaped 0xff data byte.
+        out[nout++] = CMD;
+        tp->state = TS_DATA;
+        break;
+      }
+      ++tp->ncmds;
+      if( c == DO || c == DONT || c == WILL || c == WONT ){
+        tp->verb = c;
+        tp->state = TS_OPT;
+      }
+      else if( c == SB ){
+        tp->sblen = 0;
+        tp->state = TS_SB;
+      }
+      else{
+        // Two byte commands (NOP, GA, AYT etc.) need no action here.
+        logit( "INFO: ignoring telnet command %d.\n", c );
+        tp->state = TS_DATA;
+      }
+      break;
+
+    case TS_OPT:
+      // Handle telnet property negotiation with host.
+      cmd[0] = CMD;
+      cmd[1] = tp->verb;
+      cmd[2] = in[i++];
+      negotiate(s, cmd, 3);
+      tp->state = TS_DATA;
+      break;
+
+    case TS_SB:
+      c = in[i++];
+      if( c == CMD ){
+        tp->state = TS_SB_CMD;
+      }
+      else if( tp->sblen < SBLEN ){
+        tp->sb[tp->sblen++] = c;
+      }
+      break;
+
+    case TS_SB_CMD:
+      c = in[i++];
+      if( c == SE ){
+        subnegotiate(s, tp->sb, tp->sblen);
+        tp->state = TS_DATA;
+      }
+      else{
+        // CMD CMD is a 0xff subnegotiation byte. Anything else is a protocol error: keep the byte.
+        if( tp->sblen < SBLEN ){
+          tp->sb[tp->sblen++] = c;
+        }
+        tp->state = TS_SB;
+      }
+      break;
+    }
+  }
+
+  return nout;
 }
   
 static void terminal_set( void )
@@ -177,13 +735,18 @@ static void terminal_reset( void )
   logit("Terminal reset.\n");
 }
 
-static int send_buf( int sock, unsigned char* buf, int n_send )
-//-------------------------------------------------------------
-/// @brief Send a buffer of bytes to the host.
-/// @param sock Socket file descriptor.
+static int term_send( struct session* s, const unsigned char* buf, size_t n );
+static int term_flush( struct session* s );
+static void session_detach( struct session* s );
+static int ev_watch( int fd, int events, void* tag );
+
+static int send_buf( struct session* s, unsigned char* buf, int n_send )
+//----------------------------------------------------------------------
+/// @brief Send a buffer of bytes to the host (queued for host_flush()).
+/// @param s Session.
 /// @param buf Buffer containing bytes to send.
 /// @param n_send Number of bytes to send.
-/// @return 0 if OK, 1 if send() failed.
+/// @return 0 if OK, 1 if out of memory.
 {
   int oc;
 
@@ -192,426 +755,2380 @@ static int send_buf( int sock, unsigned char* buf, int n_send )
 
   // Apply any character transformations here.
   // \r -> CR LF.
-  if( send_crlf_at_newline && (buf[n_send-1] == '\r') ){
+  if( s->send_crlf_at_newline && (buf[n_send-1] == '\r') ){
     buf[n_send++] = '\n';
   }
 
   // \r -> LF CR.
-  if( send_cr_after_lf && (buf[n_send-1] == '\r') ){
+  if( s->send_cr_after_lf && (buf[n_send-1] == '\r') ){
     buf[n_send++] = '\n';
   }
             
-  // Send characters to host.
-  if( send(sock, buf, n_send, 0 ) < 0){
-    perror("ERROR Failed to send().");
-    logit("ERROR: Failed to send(), %d characters.\n",n_send);
+  // Queue characters for host.
+  if( host_queue(s, buf, (size_t)n_send) != 0 ){
+    fprintf(stderr, "ERROR: Out of memory for data to send.\n");
+    logit("ERROR: Could not queue %d characters to send.\n",n_send);
     return 1;
   }
-  for( oc=0; oc<n_send; oc++ ){
-    logit( "O                   %08d %02x %s\n", bytes_out, buf[oc], asciimap[buf[oc]] );
-    ++bytes_out;
+  trace_session = s->index;
+  if( trace_fd >= 0 ){
+    trace_record(s->index, TRACE_OUT, buf, (size_t)n_send);
+  }
+  if( flog != NULL ){
+    for( oc=0; oc<n_send; oc++ ){
+      logbyte( "O                   %08d %02x %s\n", s->bytes_out, buf[oc] );
+      ++s->bytes_out;
+    }
+  }
+  else{
+    s->bytes_out += n_send;
   }
       
   // If newline received from terminal emulator, send LF to terminal emulator.
-  if( show_lf_after_newline && is_newline ){
-    putchar('\r');
+  if( s->show_lf_after_newline && is_newline && s->term_out >= 0 ){
+    term_flush(s);
+    term_send(s, (const unsigned char*)"\r", 1);
   }
-
-  // Wait after sending a newline if desired.
-  if( slow_pause > 0 && is_newline )
-    sleep(slow_pause);
   
   return 0;
 }
 
-int hostname_to_ip( char* hostname, char* ip )
-//--------------------------------------------
-/// @brief Convert a host name string to an IP V4 address as a string containing dotted decimal format address.
-///
-/// @param hostname Name of host.
-/// @param ip IP V4 address of host as a string containing dotted decimal format address.
-/// @return 0 if OK or 1 on error.
+static uint64_t now_us( void )
+//----------------------------
+/// @brief Get a microsecond clock for output coalescing.
+/// @return Microseconds since some arbitrary start point.
 {
-  struct hostent *he;
-  struct in_addr **addr_list;
-  int i;
-		
-  if ( (he = gethostbyname( hostname ) ) == NULL)
-    return 1;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000ULL;
+}
 
-  addr_list = (struct in_addr **) he->h_addr_list;
-	
-  for( i=0; addr_list[i] != NULL; i++ ){
-    strncpy(ip, inet_ntoa(*addr_list[i]), 20);
-    return 0;
+static uint64_t now_ms( void )
+//----------------------------
+/// @brief Get a millisecond clock for pacing.
+/// @return Milliseconds since some arbitrary start point.
+{
+  return now_us() / 1000ULL;
+}
+
+static void hist_add( struct latency_hist* h, uint64_t us )
+//---------------------------------------------------------
+/// @brief Count one time taken in a latency histogram.
+/// @param h Histogram.
+/// @param us Time taken, microseconds.
+{
+  int b = 0;
+  while( b < STATBUCKETS - 1 && (us >> b) != 0 ){
+    ++b;
+  }
+  ++h->bucket[b];
+  ++h->count;
+  if( us > h->max_us ){
+    h->max_us = us;
   }
-  
-  return 1;
 }
 
-int fifo_exists(const char *path)
-//-------------------------------
-/// @brief See if a FIFO (named pipe "file") exists.
-///
-/// @param path Name of the FIFO (named pipe "file").
-/// @return 1 if exists, 0 otherwise.
+static int host_events( const struct session* s )
+//-----------------------------------------------
+/// @brief Find what to wait for on a session's host socket.
+/// @param s Session.
+/// @return EV_READ unless host input is paused, plus EV_WRITE while output for the host is queued.
 {
-  struct stat path_stat;
+  return (s->rx_paused ? 0 : EV_READ) | ((s->tq_len > 0) ? EV_WRITE : 0);
+}
 
-  // Check if file exists
-  if (stat(path, &path_stat) == -1) {
-    return 0;
+static int term_watch( struct session* s )
+//----------------------------------------
+/// @brief Wait for the terminal to be writable only while output is queued for it.
+/// @param s Session.
+/// @return 0 if OK, 1 on error.
+{
+  int events = (s->wq_len > 0) ? EV_WRITE : 0;
+  if( s->term_out == s->term_in ){
+    events |= EV_READ;
   }
+  return ev_watch(s->term_out, events, s);
+}
 
-  // Check if file is a FIFO
-  if (S_ISFIFO(path_stat.st_mode)) {
-    return 1;
+static void host_pause( struct session* s, int paused )
+//-----------------------------------------------------
+/// @brief Stop or restart reading host input while the terminal is behind.
+/// @param s Session.
+/// @param paused Non-zero to stop.
+{
+  if( s->rx_paused != (paused != 0) ){
+    s->rx_paused = (paused != 0);
+    if( s->sock >= 0 ){
+      ev_watch(s->sock, host_events(s), s);
+    }
   }
-
-  return 0;
 }
 
-int standard_loop(int sock, int fin_fifo)
-//---------------------------------------
-/// @brief Main character processing loop (where select() works on fd-s other than sockets).
+static int term_send( struct session* s, const unsigned char* buf, size_t n )
+//---------------------------------------------------------------------------
+/// @brief Write bytes to a session's terminal without waiting for it.
 ///
-/// @param sock Socket for connection to host.
-/// @param fin_fifo Input FIFO fd for scripting.  
-/// @return 0 if normal exit, 1 otherwise.
+/// Whatever the terminal does not take at once is queued in wq and written by
+/// term_drain() when it is writable. A daemon mode terminal that lets TERMQMAX bytes
+/// pile up (e.g. a suspended emulator) is detached, so that it cannot hold up the
+/// other sessions. ctelnet's own terminal instead stops host input being read while
+/// TERMQHIGH bytes or more are queued, so nothing is lost.
+///
+/// @param s Session.
+/// @param buf Bytes to write.
+/// @param n Number of bytes in buf.
+/// @return 0 if OK, 1 if write() failed or out of memory.
 {
-  unsigned char buf[BUFLEN + 1];
-  ssize_t n_send = 0;
-  int len;
-  int ilist;
-  struct timeval ts;
+  if( s->term_out < 0 ){
+    return 0;
+  }
 
-  // Initial select wait.
-  ts.tv_sec = 1; // 1 second
-  ts.tv_usec = 0;
+  // Anything printf()-ed earlier must appear before these bytes.
+  fflush(stdout);
 
-  // Loop forever ...
-  while (1) {
-      
-    // Setup select()
-    fd_set fds;
-    FD_ZERO(&fds);
-    if (sock != 0)
-      FD_SET(sock, &fds);
-    FD_SET(0, &fds);
-    FD_SET(fin_fifo, &fds);
- 
-    // Wait for data from either host or terminal emulator.
-    int nready = select(sock + 1, &fds, (fd_set *) 0, (fd_set *) 0, &ts);
-    if (nready < 0) {
-      perror("ERROR: Could not select().");
-      logit("Failed to select().\n");
+  while( s->wq_len == 0 && n > 0 ){
+    ssize_t nw = write(s->term_out, buf, n);
+    if( nw < 0 ){
+      if( errno == EINTR ){
+        continue;
+      }
+      else if( errno == EAGAIN || errno == EWOULDBLOCK ){
+        break;
+      }
       return 1;
     }
+    buf += nw;
+    n -= (size_t)nw;
+  }
+  if( n == 0 ){
+    return 0;
+  }
 
-    // Nothing yet, wait 1 second.
-    else if (nready == 0) {
-      ts.tv_sec = 1;
-      ts.tv_usec = 0;
-    }
-
-    // From host (for screen output):
-    else if (sock != 0 && FD_ISSET(sock, &fds)) {
-          
-      // Read a single byte.
-      int rv;
-      if ((rv = recv(sock , buf , 1 , 0)) < 0){
-        perror("ERROR: Could not recv().");
-        logit("ERROR: recv() failed (case 1).\n");
-        return 1;
-      }
-      else if (rv == 0) {
-        printf("\nINFO: Connection closed by the remote end\n\r");
-        logit("INFO: Connection closed by the remote end (case 1)\n");
-        return 0;
+  if( s->listen_fd >= 0 && s->wq_len + n > TERMQMAX ){
+    printf("INFO: Session %d: terminal is not taking its output. Detaching it.\n", s->index);
+    logit("INFO: Session %d: terminal is not taking its output. Detaching it.\n", s->index);
+    session_detach(s);
+    return 0;
+  }
+  if( s->wq_head + s->wq_len + n > s->wq_cap ){
+    memmove(s->wq, s->wq + s->wq_head, s->wq_len);
+    s->wq_head = 0;
+    if( s->wq_len + n > s->wq_cap ){
+      size_t cap = (s->wq_cap == 0) ? OUTBUFLEN : s->wq_cap;
+      unsigned char* wq;
+      while( cap < s->wq_len + n ){
+        cap *= 2;
       }
-
-      for( ilist=0; ilist<rv; ilist++ ){
-        logit( "I %08d %02x %s\n", bytes_in, buf[ilist], asciimap[buf[ilist]] );
-        ++bytes_in;
+      wq = realloc(s->wq, cap);
+      if( wq == NULL ){
+        return 1;
       }
+      s->wq = wq;
+      s->wq_cap = cap;
+    }
+  }
+  memcpy(s->wq + s->wq_head + s->wq_len, buf, n);
+  s->wq_len += n;
+  if( s->wq_len == n && term_watch(s) != 0 ){
+    return 1;
+  }
+  if( s->listen_fd < 0 && s->wq_len >= TERMQHIGH ){
+    host_pause(s, 1);
+  }
+  return 0;
+}
 
-      // If this is a telnet CMD, process it. 
-      if (buf[0] == CMD) {
-        
-        // Read 2 more bytes
-        len = recv(sock , buf + 1 , 2 , 0);
-        if (len < 0){
-          perror("ERROR: Could not recv() from socket.");
-          logit("ERROR: recv() from socket failed (case 2)\n");
-          return 1;
-        }
-        else if (len == 0) {
-          printf("\nINFO: Connection closed by the remote end\n\r");
-          logit("INFO: Connection closed by the remote end (case 2)\n");
-          return 0;
-        }
-
-        // Handle telnet property negotiation with host.
-        negotiate(sock, buf, 3);
+static int term_drain( struct session* s )
+//----------------------------------------
+/// @brief Write as much of the output queued for the terminal as it will take now.
+/// @param s Session.
+/// @return 0 if OK, 1 if write() failed.
+{
+  while( s->wq_len > 0 ){
+    ssize_t nw = write(s->term_out, s->wq + s->wq_head, s->wq_len);
+    if( nw < 0 ){
+      if( errno == EINTR ){
+        continue;
       }
-
-      // Send received data to the terminal emulator.
-      else{
-        len = 1;
-        buf[len] = '\0';
-        printf("%s", buf);
-        fflush(stdout);
+      else if( errno == EAGAIN || errno == EWOULDBLOCK ){
+        break;
       }
+      return 1;
+    }
+    s->wq_head += (size_t)nw;
+    s->wq_len -= (size_t)nw;
+  }
+  if( s->wq_len == 0 ){
+    s->wq_head = 0;
+    if( term_watch(s) != 0 ){
+      return 1;
     }
+  }
+  if( s->rx_paused && s->wq_len < TERMQHIGH / 2 ){
+    host_pause(s, 0);
+  }
+  return 0;
+}
 
-    // From terminal emulator (keyboard input):
-    else if (FD_ISSET(0, &fds)) {
+static int term_write( struct session* s, const unsigned char* buf, size_t n, uint64_t since_us )
+//-----------------------------------------------------------------------------------------------
+/// @brief Write host output to the terminal and count it in the statistics.
+/// @param s Session.
+/// @param buf Host output, telnet commands removed.
+/// @param n Number of bytes in buf.
+/// @param since_us When the oldest of the bytes was received (now_us() time).
+/// @return 0 if OK, 1 if write() failed.
+{
+  int rv = term_send(s, buf, n);
+  ++s->term_writes;
+  s->term_bytes += n;
+  hist_add(&s->rx_hist, now_us() - since_us);
+  return rv;
+}
 
-      // Read all available bytes from the terminal emulator.
-      n_send = read(fileno(stdin), buf, BUFLEN);
-      if( n_send < 0 ){
-        perror("ERROR: Could not read() from stdin (keyboard).");
-        logit( "ERROR: Failed to read() from stdin (keyboard).\n");
-        return 1;
-      }
+static int term_flush( struct session* s )
+//----------------------------------------
+/// @brief Write buffered host output to the terminal.
+/// @param s Session.
+/// @return 0 if OK, 1 if write() failed.
+{
+  size_t n = s->ob_len;
+  if( n == 0 ){
+    return 0;
+  }
+  s->ob_len = 0;
+  --nbuffered;
+  if( s->term_out < 0 ){
+    return 0;
+  }
+  return term_write(s, s->ob, n, s->ob_first_us);
+}
 
-      // EOF on keyboard?
-      else if( n_send == 0 ){
-        logit( "INFO: EOF on stdin (keyboard).\n");
-        return 0;
-      }
+static int term_output( struct session* s, const unsigned char* buf, size_t n, int urgent )
+//-----------------------------------------------------------------------------------------
+/// @brief Send host output to the terminal, collecting it into larger writes.
+///
+/// Terminal emulators redraw after each write. So output is held until the host
+/// has been idle for coalesce_us (or eight times that at most since the first
+/// byte was held), or the buffer fills. It is written at once if it ends with a
+/// line end or prompt, or looks like the echo of a keystroke.
+///
+/// @param s Session.
+/// @param buf Host output, telnet commands removed.
+/// @param n Number of bytes in buf.
+/// @param urgent Non-zero if buf ends with a prompt.
+/// @return 0 if OK, 1 if write() failed.
+{
+  uint64_t now;
+  int immediate;
 
-      // Send everything that has been read.
-      else{
-        if( send_buf( sock, buf, (int)n_send ) != 0 ){
-          return 1;
-        }
-      }
+  if( n == 0 ){
+    return 0;
+  }
+  if( coalesce_us <= 0 ){
+    return term_write(s, buf, n, s->rx_us);
+  }
+  if( s->ob == NULL ){
+    s->ob = malloc(OUTBUFLEN);
+    if( s->ob == NULL ){
+      return term_write(s, buf, n, s->rx_us);
     }
+  }
 
-    // From named pipe (scripted input):
-    else if (FD_ISSET(fin_fifo, &fds)) {
-      //fprintf(stderr, "\nHERE\n");
+  now = now_us();
+  immediate = urgent || buf[n-1] == '\n' || buf[n-1] == '\r' ||
+    (s->ob_len == 0 && n <= ECHOLEN && now - s->last_key_us < ECHOUS);
 
-      // Read all available bytes from the terminal emulator.
-      n_send = read(fin_fifo, buf, BUFLEN);
-      //fprintf(stderr,"\nn_send = %zd\n", n_send);
-      if( n_send < 0 ){
-        if( errno != EAGAIN ){
-          perror("ERROR: Could not read() from input FIFO.");
-          logit( "ERROR: Failed to read() from input FIFO.\n");
-          return 0;
-        }
-      }
+  // Make room. Anything too big to buffer goes straight out.
+  if( s->ob_len + n > OUTBUFLEN && term_flush(s) != 0 ){
+    return 1;
+  }
+  if( n >= OUTBUFLEN ){
+    return term_write(s, buf, n, s->rx_us);
+  }
 
-      // Send everything that has been read.
+  if( s->ob_len == 0 ){
+    s->ob_first_us = s->rx_us;
+    ++nbuffered;
+  }
+  memcpy(s->ob + s->ob_len, buf, n);
+  s->ob_len += n;
+  s->ob_last_us = now;
+
+  if( immediate || s->ob_len == OUTBUFLEN ){
+    return term_flush(s);
+  }
+  return 0;
+}
+
+static int term_due( struct session* s, uint64_t now )
+//----------------------------------------------------
+/// @brief Find when buffered host output is due to be written to the terminal.
+/// @param s Session.
+/// @param now Time now (now_us()).
+/// @return Milliseconds until it is due (rounded up), 0 if it is due now.
+{
+  uint64_t due = s->ob_last_us + (uint64_t)coalesce_us;
+  uint64_t latest = s->ob_first_us + 8 * (uint64_t)coalesce_us;
+  if( latest < due ){
+    due = latest;
+  }
+  if( due <= now ){
+    return 0;
+  }
+  return (int)((due - now + 999) / 1000);
+}
+
+static int script_add( struct session* s, const unsigned char* buf, size_t n )
+//----------------------------------------------------------------------------
+/// @brief Queue scripted input (from the FIFO or --script) for sending to the host.
+/// @param s Session.
+/// @param buf Bytes to send.
+/// @param n Number of bytes in buf.
+/// @return 0 if OK, 1 if out of memory.
+{
+  if( s->sq_pos == s->sq_len ){
+    s->sq_pos = 0;
+    s->sq_len = 0;
+  }
+  if( s->sq_len + n > s->sq_cap ){
+    size_t cap = (s->sq_cap == 0) ? RECVBUFLEN : s->sq_cap;
+    unsigned char* sq;
+    while( cap < s->sq_len + n ){
+      cap *= 2;
+    }
+    sq = realloc(s->sq, cap);
+    if( sq == NULL ){
+      return 1;
+    }
+    s->sq = sq;
+    s->sq_cap = cap;
+  }
+  if( s->sq_pos == s->sq_len && n > 0 ){
+    ++nscripted;
+  }
+  memcpy(s->sq + s->sq_len, buf, n);
+  s->sq_len += n;
+  return 0;
+}
+
+static int script_wait( struct session* s, uint64_t now )
+//-------------------------------------------------------
+/// @brief Find how long the pacing profile says to wait before sending the next scripted line.
+/// @param s Session.
+/// @param now Time now (now_ms()).
+/// @return Milliseconds to wait, 0 if the line can be sent now.
+{
+  uint64_t until = 0;
+
+  switch( s->pace ){
+  case PACE_LINE:
+    until = s->last_tx_ms + (uint64_t)s->pace_ms;
+    break;
+  case PACE_QUIET:
+    until = ((s->last_rx_ms > s->last_tx_ms) ? s->last_rx_ms : s->last_tx_ms) + (uint64_t)s->pace_ms;
+    break;
+  case PACE_PROMPT:
+    if( s->await_prompt ){
+      until = s->last_tx_ms + (uint64_t)s->pace_ms;
+    }
+    break;
+  default:
+    break;
+  }
+  if( until <= now ){
+    s->await_prompt = 0;
+    return 0;
+  }
+  return (int)(until - now);
+}
+
+static int script_pump( struct session* s, uint64_t now )
+//-------------------------------------------------------
+/// @brief Send as much queued scripted input as the pacing profile allows.
+///
+/// Input is sent a line at a time, so the --crlf etc. translations apply to each
+/// line end. Nothing here waits: the event loop calls again when it is time.
+///
+/// @param s Session.
+/// @param now Time now (now_ms()).
+/// @return Milliseconds until there is more to do, -1 if nothing is queued or the host
+/// must take what has already been sent first, -2 on error.
+{
+  unsigned char line[RECVBUFLEN + 2];
+  
+  while( s->sq_pos < s->sq_len ){
+    unsigned char* p = s->sq + s->sq_pos;
+    size_t n = s->sq_len - s->sq_pos;
+    size_t i;
+    int ended = 0;
+    int wait = script_wait(s, now);
+    if( wait > 0 ){
+      return wait;
+    }
+
+    // A host still taking earlier output gets no more until it catches up (see host_flush()).
+    if( s->tq_len >= SENDQHIGH ){
+      return -1;
+    }
+
+    // Find the end of the next line. CR LF counts as one line end.
+    if( n > RECVBUFLEN ){
+      n = RECVBUFLEN;
+    }
+    for( i=0; i<n; i++ ){
+      if( p[i] == '\r' || p[i] == '\n' ){
+        ended = 1;
+        if( p[i] == '\r' && i + 1 < n && p[i+1] == '\n' ){
+          ++i;
+        }
+        n = i + 1;
+        break;
+      }
+    }
+
+    memcpy(line, p, n);
+    s->sq_pos += n;
+    if( send_buf( s, line, (int)n ) != 0 ){
+      return -2;
+    }
+
+    // A part line (still being written to the FIFO) doesn't start the pacing timer.
+    if( ended && s->pace != PACE_NONE ){
+      s->last_tx_ms = now;
+      s->await_prompt = (s->pace == PACE_PROMPT);
+    }
+  }
+
+  // All sent.
+  s->sq_pos = 0;
+  s->sq_len = 0;
+  --nscripted;
+  return -1;
+}
+
+int fifo_exists(const char *path)
+//-------------------------------
+/// @brief See if a FIFO (named pipe "file") exists.
+///
+/// @param path Name of the FIFO (named pipe "file").
+/// @return 1 if exists, 0 otherwise.
+{
+  struct stat path_stat;
+
+  // Check if file exists
+  if (stat(path, &path_stat) == -1) {
+    return 0;
+  }
+
+  // Check if file is a FIFO
+  if (S_ISFIFO(path_stat.st_mode)) {
+    return 1;
+  }
+
+  return 0;
+}
+
+static int prompt_build( void )
+//----------------------------
+/// @brief Build the prompt matcher from the prompts list.
+///
+/// This is an Aho-Corasick automaton, expanded into a full state transition table.
+/// Matching then costs one table look up per byte of host output, however many
+/// prompts there are, and a prompt split between two host buffers is still found.
+///
+/// @return 0 if OK, 1 if the prompts are too long in total.
+{
+  static unsigned char parent[AC_MAXSTATES]; 
+  static unsigned char pchar[AC_MAXSTATES];
+  unsigned char fail[AC_MAXSTATES];
+  unsigned char queue[AC_MAXSTATES];
+  int nstates = 1;
+  int head = 0, tail = 0;
+  int ip, c;
+
+  // The trie of prompts. State 0 is the root.
+  memset(ac_next, 0, sizeof(ac_next));
+  memset(ac_match, 0, sizeof(ac_match));
+  for( ip=0; ip<nprompts; ip++ ){
+    const unsigned char* pp = (const unsigned char*)prompts[ip];
+    int st = 0;
+    for( ; *pp != 0; pp++ ){
+      if( ac_next[st][*pp] == 0 ){
+        if( nstates >= AC_MAXSTATES ){
+          return 1;
+        }
+        parent[nstates] = (unsigned char)st;
+        pchar[nstates] = *pp;
+        ac_next[st][*pp] = (unsigned char)nstates++;
+      }
+      st = ac_next[st][*pp];
+    }
+    ac_match[st] = 1;
+  }
+
+  // Breadth first: fill in failure links and turn missing transitions into the failure path's.
+  fail[0] = 0;
+  queue[tail++] = 0;
+  while( head < tail ){
+    int st = queue[head++];
+    for( c=0; c<256; c++ ){
+      int nx = ac_next[st][c];
+      if( nx != 0 && parent[nx] == st && pchar[nx] == c ){
+        fail[nx] = (st == 0) ? 0 : ac_next[fail[st]][c];
+        ac_match[nx] |= ac_match[fail[nx]];
+        queue[tail++] = (unsigned char)nx;
+      }
       else{
-        if( 0 ){
-          int i;
-          for( i=0; i<n_send; i++ ){
-            fprintf(stderr,"%2.2x\n",buf[i]);
+        ac_next[st][c] = (st == 0) ? 0 : ac_next[fail[st]][c];
+      }
+    }
+  }
+  return 0;
+}
+
+static int host_seen( struct session* s, const unsigned char* buf, size_t n )
+//---------------------------------------------------------------------------
+/// @brief Note host output for pacing scripted input and output coalescing.
+///
+/// Records when the host last sent something and runs the prompt matcher over it.
+/// A prompt counts only if nothing but spaces and line ends follows it, i.e. the
+/// host has stopped to wait for input. That releases the next scripted line.
+///
+/// @param s Session.
+/// @param buf Host output, telnet commands removed.
+/// @param n Number of bytes in buf.
+/// @return 1 if buf ends with a prompt, else 0.
+{
+  size_t i;
+  size_t matched = 0;
+  unsigned char st;
+
+  if( n == 0 ){
+    return 0;
+  }
+  if( s->pace != PACE_NONE ){
+    s->last_rx_ms = now_ms();
+  }
+  if( s->pace != PACE_PROMPT && coalesce_us <= 0 ){
+    return 0;
+  }
+
+  st = s->ac_state;
+  for( i=0; i<n; i++ ){
+    st = ac_next[st][buf[i]];
+    if( ac_match[st] ){
+      matched = i + 1;
+    }
+  }
+  s->ac_state = st;
+
+  if( matched == 0 ){
+    return 0;
+  }
+  for( i=matched; i<n; i++ ){
+    if( buf[i] != ' ' && buf[i] != '\r' && buf[i] != '\n' ){
+      return 0;
+    }
+  }
+  s->await_prompt = 0;
+  return 1;
+}
+
+static void unescape( char* str )
+//-------------------------------
+/// @brief Replace \r, \n, \t, \\ and \xHH in a command line string with the characters they stand for.
+/// @param str String to change in place.
+{
+  char* in = str;
+  char* out = str;
+  while( *in != 0 ){
+    if( in[0] == '\\' && in[1] != 0 ){
+      ++in;
+      if( *in == 'r' ) *out++ = '\r';
+      else if( *in == 'n' ) *out++ = '\n';
+      else if( *in == 't' ) *out++ = '\t';
+      else if( *in == 'x' && isxdigit((unsigned char)in[1]) && isxdigit((unsigned char)in[2]) ){
+        char hex[3] = { in[1], in[2], 0 };
+        *out++ = (char)strtol(hex, NULL, 16);
+        in += 2;
+      }
+      else *out++ = *in;
+      ++in;
+    }
+    else{
+      *out++ = *in++;
+    }
+  }
+  *out = 0;
+}
+
+#if defined(__linux__)
+int host_splice( struct session* s, unsigned char* buf )
+//------------------------------------------------------
+/// @brief Relay host output to stdout with splice(), without copying it to user space.
+///
+/// The pending input is looked at with MSG_PEEK to find the first telnet command.
+/// Everything before it is moved socket -> pipe -> stdout in the kernel. Commands are
+/// left for the normal path in host_receive(). If stdout does not support splice(),
+/// the data already in the pipe is copied out and --splice is turned off. The data
+/// moved is counted in the statistics as host_receive() and term_write() count it.
+///
+/// @param s Session.
+/// @param buf Buffer of RECVBUFLEN bytes for peeking at the input.
+/// @return 0 if OK, 1 on error, 2 if host_receive() must handle the input.
+{
+  ssize_t rv, nmove, nout;
+  unsigned char* iac;
+
+  // Look for a telnet command in what is waiting. Leave errors and EOF to the normal path.
+  rv = recv(s->sock, buf, RECVBUFLEN, MSG_PEEK);
+  if( rv <= 0 ){
+    return 2;
+  }
+  iac = memchr(buf, CMD, (size_t)rv);
+  nmove = (iac == NULL) ? rv : (iac - buf);
+  if( nmove == 0 ){
+    return 2;
+  }
+
+  // Move the data before any command into the pipe.
+  fflush(stdout);
+  nmove = splice(s->sock, NULL, splice_pipe[1], NULL, (size_t)nmove, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+  if( nmove < 0 ){
+    if( errno == EINTR || errno == EAGAIN ){
+      return 0;
+    }
+    printf("INFO: splice() from socket failed (%s). Turning off --splice.\n", strerror(errno));
+    use_splice = 0;
+    return 2;
+  }
+  s->rx_us = now_us();
+  ++s->recv_calls;
+  s->bytes_in += (int)nmove;
+  host_seen(s, buf, (size_t)nmove);
+
+  // And from the pipe to stdout.
+  while( nmove > 0 ){
+    nout = splice(splice_pipe[0], NULL, s->term_out, NULL, (size_t)nmove, SPLICE_F_MOVE);
+    if( nout < 0 ){
+      if( errno == EINTR ){
+        continue;
+      }
+
+      // The terminal can't be spliced to (e.g. some tty drivers), or is full for now.
+      // Copy what is in the pipe instead: term_send() queues what the terminal can't take.
+      if( errno != EAGAIN ){
+        printf("INFO: splice() to stdout failed (%s). Turning off --splice.\n", strerror(errno));
+        use_splice = 0;
+      }
+      while( nmove > 0 ){
+        nout = read(splice_pipe[0], buf, (size_t)nmove);
+        if( nout <= 0 || term_write(s, buf, (size_t)nout, s->rx_us) != 0 ){
+          perror("ERROR: Could not write() to stdout.");
+          logit("ERROR: write() to stdout failed.\n");
+          return 1;
+        }
+        nmove -= nout;
+      }
+      return 0;
+    }
+    ++s->term_writes;
+    s->term_bytes += (uint64_t)nout;
+    hist_add(&s->rx_hist, now_us() - s->rx_us);
+    nmove -= nout;
+  }
+
+  return 0;
+}
+#endif
+
+int host_receive( struct session* s )
+//-----------------------------------
+/// @brief Read all the bytes the host has sent so far and pass them on to the terminal emulator.
+///
+/// Everything available on the socket is drained with one recv() into a large buffer.
+/// telnet_scan() then removes any telnet commands and the remaining data is written
+/// to the terminal, coalesced by term_output(). This replaces one recv(), printf() and
+/// fflush() per character. With no terminal attached (daemon mode), the data is discarded.
+///
+/// @param s Session.
+/// @return 0 if OK, -1 if the host closed the connection, 1 on error.
+{
+  static unsigned char buf[RECVBUFLEN];
+  ssize_t rv, i;
+  size_t nout;
+  int at_prompt;
+
+#if defined(__linux__)
+  // Fast path: let the kernel move plain data straight to the terminal.
+  if( use_splice && s->term_out >= 0 && s->wq_len == 0 && !s->raw && s->tparse.state == TS_DATA ){
+    int rs;
+    if( term_flush(s) != 0 ){
+      return 1;
+    }
+    rs = host_splice(s, buf);
+    if( rs != 2 ){
+      return rs;
+    }
+  }
+#endif
+
+  // Read as many bytes as are available, up to RECVBUFLEN.
+  rv = recv(s->sock, buf, RECVBUFLEN, 0);
+  if( rv < 0 ){
+    if( errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK ){
+      return 0;
+    }
+    perror("ERROR: Could not recv().");
+    logit("ERROR: recv() failed.\n");
+    return 1;
+  }
+  else if( rv == 0 ){
+    static const char closed_msg[] = "\nINFO: Connection closed by the remote end\n\r";
+    term_flush(s);
+    if( s->term_out >= 0 ){
+      term_send(s, (const unsigned char*)closed_msg, sizeof(closed_msg) - 1);
+    }
+    logit("INFO: Connection closed by the remote end\n");
+    return -1;
+  }
+
+  s->rx_us = now_us();
+  ++s->recv_calls;
+  trace_session = s->index;
+  if( trace_fd >= 0 ){
+    trace_record(s->index, TRACE_IN, buf, (size_t)rv);
+  }
+  if( flog != NULL ){
+    for( i=0; i<rv; i++ ){
+      logbyte( "I %08d %02x %s\n", s->bytes_in, buf[i] );
+      ++s->bytes_in;
+    }
+  }
+  else{
+    s->bytes_in += (int)rv;
+  }
+
+  // Remove telnet commands (in place) and send the data to the terminal emulator.
+  nout = s->raw ? (size_t)rv : telnet_scan(&s->tparse, s, buf, (size_t)rv, buf);
+  at_prompt = host_seen(s, buf, nout);
+  if( nout > 0 && s->term_out >= 0 ){
+    if( term_output(s, buf, nout, at_prompt) != 0 ){
+      if( s->listen_fd >= 0 ){
+        // Daemon mode: the attached terminal has gone. The session carries on.
+        return 0;
+      }
+      perror("ERROR: Could not write() to stdout.");
+      logit("ERROR: write() to stdout failed.\n");
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+//=====================================================================================
+// Event backends. Each one waits for readiness on a set of file descriptors with no
+// timeout-driven polling. epoll is used on Linux, kqueue on macOS and the BSDs and
+// poll() everywhere else (and as a fallback if the native backend cannot be used).
+//=====================================================================================
+
+static struct ev_slot ev_slots[EV_MAXFDS]; ///< Registered fds, the events wanted and their tags.
+static int ev_slot_of[EV_MAXFDS];          ///< For each fd, its index in ev_slots plus 1 (0 if none).
+static int ev_nslots = 0;                  ///< Number of slots in use.
+
+static struct ev_slot* ev_find( int fd )
+//--------------------------------------
+/// @brief Find the registration slot for a file descriptor.
+/// @param fd File descriptor.
+/// @return Pointer to the slot, or NULL if fd is not registered.
+{
+  if( fd < 0 || fd >= EV_MAXFDS || ev_slot_of[fd] == 0 ){
+    return NULL;
+  }
+  return &ev_slots[ev_slot_of[fd] - 1];
+}
+
+static int ev_record( int fd, int events, void* tag, int* old_events )
+//--------------------------------------------------------------------
+/// @brief Record the events wanted for a file descriptor. events 0 removes it.
+/// @param fd File descriptor.
+/// @param events EV_READ and/or EV_WRITE, or 0.
+/// @param tag Caller's tag, returned with each event for fd.
+/// @param old_events Returns the events previously wanted (0 if fd was not registered).
+/// @return 0 if OK, 1 if fd is too large.
+{
+  struct ev_slot* slot = ev_find(fd);
+  *old_events = (slot == NULL) ? 0 : slot->events;
+  if( events == 0 ){
+    if( slot != NULL ){
+      ev_slot_of[fd] = 0;
+      if( --ev_nslots > (int)(slot - ev_slots) ){
+        *slot = ev_slots[ev_nslots];
+        ev_slot_of[slot->fd] = (int)(slot - ev_slots) + 1;
+      }
+    }
+    return 0;
+  }
+  if( slot == NULL ){
+    if( fd < 0 || fd >= EV_MAXFDS ){
+      return 1;
+    }
+    slot = &ev_slots[ev_nslots++];
+    slot->fd = fd;
+    ev_slot_of[fd] = ev_nslots;
+  }
+  slot->events = events;
+  slot->tag = tag;
+  return 0;
+}
+
+// poll() backend.
+
+static struct pollfd ev_pollfds[EV_MAXFDS]; ///< poll() array, rebuilt when registrations change.
+static int ev_poll_dirty = 1;               ///< ev_pollfds needs to be rebuilt.
+static int ev_poll_nonsock = 0;             ///< Registered descriptors poll() cannot wait on (Haiku).
+
+static int ev_poll_init( void )
+//-----------------------------
+/// @brief Initialize the poll() backend.
+/// @return 0 (always OK).
+{
+  ev_poll_dirty = 1;
+  return 0;
+}
+
+static int ev_poll_set( int fd, int events, void* tag )
+//-----------------------------------------------------
+/// @brief Register, change or remove (events 0) interest in a file descriptor with poll().
+/// @return 0 if OK, 1 on error.
+{
+  int old_events;
+  ev_poll_dirty = 1;
+  return ev_record(fd, events, tag, &old_events);
+}
+
+static int ev_poll_wait( struct ev_event* out, int maxout, int timeout_ms )
+//-------------------------------------------------------------------------
+/// @brief Wait for events with poll().
+///
+/// On Haiku, poll() (like select()) only works with sockets. Terminals and FIFOs are
+/// left out of the poll() array there, the wait is limited to EV_HAIKUPOLLMS, and they
+/// are reported ready every time: their handlers read (or write) them non-blocking and
+/// take EAGAIN as nothing to do. That is what the old non_blocking_loop() did.
+///
+/// @return Number of events placed in out, or -1 on error (errno set).
+{
+  int i, nready, nout = 0;
+
+  if( ev_poll_dirty ){
+    ev_poll_nonsock = 0;
+    for( i=0; i<ev_nslots; i++ ){
+      ev_pollfds[i].fd = ev_slots[i].fd;
+      ev_pollfds[i].events = ((ev_slots[i].events & EV_READ) ? POLLIN : 0) |
+                             ((ev_slots[i].events & EV_WRITE) ? POLLOUT : 0);
+#if defined(__HAIKU__)
+      {
+        struct stat st;
+        if( ev_slots[i].events != 0 && fstat(ev_slots[i].fd, &st) == 0 && !S_ISSOCK(st.st_mode) ){
+          ev_pollfds[i].fd = -1;      // poll() ignores it.
+          ++ev_poll_nonsock;
+        }
+      }
+#endif
+    }
+    ev_poll_dirty = 0;
+  }
+
+  if( ev_poll_nonsock > 0 && (timeout_ms < 0 || timeout_ms > EV_HAIKUPOLLMS) ){
+    timeout_ms = EV_HAIKUPOLLMS;
+  }
+  nready = poll(ev_pollfds, (nfds_t)ev_nslots, timeout_ms);
+  if( nready < 0 || (nready == 0 && ev_poll_nonsock == 0) ){
+    return nready;
+  }
+  for( i=0; i<ev_nslots && nout<maxout; i++ ){
+    short re = ev_pollfds[i].revents;
+    if( ev_pollfds[i].fd < 0 && ev_slots[i].events != 0 ){
+      out[nout].fd = ev_slots[i].fd;
+      out[nout].tag = ev_slots[i].tag;
+      out[nout].events = ev_slots[i].events;
+      ++nout;
+      continue;
+    }
+    if( re != 0 ){
+      out[nout].fd = ev_slots[i].fd;
+      out[nout].tag = ev_slots[i].tag;
+      out[nout].events = ((re & (POLLIN|POLLHUP|POLLERR|POLLNVAL)) ? EV_READ : 0) |
+                         ((re & POLLOUT) ? EV_WRITE : 0);
+      ++nout;
+    }
+  }
+  return nout;
+}
+
+static const struct ev_backend ev_poll_backend = { "poll", ev_poll_init, ev_poll_set, ev_poll_wait };
+
+#if defined(EV_HAVE_EPOLL)
+
+// epoll backend.
+
+static int ev_epfd = -1; ///< epoll instance.
+
+static int ev_epoll_init( void )
+//------------------------------
+/// @brief Initialize the epoll backend.
+/// @return 0 if OK, 1 on error.
+{
+  ev_epfd = epoll_create1(EPOLL_CLOEXEC);
+  return (ev_epfd < 0) ? 1 : 0;
+}
+
+static int ev_epoll_set( int fd, int events, void* tag )
+//------------------------------------------------------
+/// @brief Register, change or remove (events 0) interest in a file descriptor with epoll.
+/// @return 0 if OK, 1 on error.
+{
+  int old_events;
+  struct epoll_event ee;
+
+  if( ev_record(fd, events, tag, &old_events) != 0 ){
+    return 1;
+  }
+  memset(&ee, 0, sizeof(ee));
+  ee.events = ((events & EV_READ) ? EPOLLIN : 0) | ((events & EV_WRITE) ? EPOLLOUT : 0);
+  ee.data.fd = fd;
+  if( events == 0 ){
+    return (epoll_ctl(ev_epfd, EPOLL_CTL_DEL, fd, &ee) < 0) ? 1 : 0;
+  }
+  return (epoll_ctl(ev_epfd, (old_events == 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ee) < 0) ? 1 : 0;
+}
+
+static int ev_epoll_wait( struct ev_event* out, int maxout, int timeout_ms )
+//--------------------------------------------------------------------------
+/// @brief Wait for events with epoll_wait().
+/// @return Number of events placed in out, or -1 on error (errno set).
+{
+  struct epoll_event ee[EV_MAXEVENTS];
+  int i, nready;
+
+  if( maxout > EV_MAXEVENTS ){
+    maxout = EV_MAXEVENTS;
+  }
+  nready = epoll_wait(ev_epfd, ee, maxout, timeout_ms);
+  for( i=0; i<nready; i++ ){
+    struct ev_slot* slot = ev_find(ee[i].data.fd);
+    out[i].fd = ee[i].data.fd;
+    out[i].tag = (slot == NULL) ? NULL : slot->tag;
+    out[i].events = ((ee[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR)) ? EV_READ : 0) |
+                    ((ee[i].events & EPOLLOUT) ? EV_WRITE : 0);
+  }
+  return nready;
+}
+
+static const struct ev_backend ev_native_backend = { "epoll", ev_epoll_init, ev_epoll_set, ev_epoll_wait };
+
+#elif defined(EV_HAVE_KQUEUE)
+
+// kqueue backend.
+
+static int ev_kqfd = -1; ///< kqueue instance.
+
+static int ev_kqueue_init( void )
+//-------------------------------
+/// @brief Initialize the kqueue backend.
+/// @return 0 if OK, 1 on error.
+{
+  ev_kqfd = kqueue();
+  return (ev_kqfd < 0) ? 1 : 0;
+}
+
+static int ev_kqueue_set( int fd, int events, void* tag )
+//-------------------------------------------------------
+/// @brief Register, change or remove (events 0) interest in a file descriptor with kqueue.
+/// @return 0 if OK, 1 on error.
+{
+  int old_events;
+  int nch = 0;
+  struct kevent kch[2];
+
+  if( ev_record(fd, events, tag, &old_events) != 0 ){
+    return 1;
+  }
+  if( (events & EV_READ) && !(old_events & EV_READ) ){
+    EV_SET(&kch[nch++], fd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+  }
+  else if( !(events & EV_READ) && (old_events & EV_READ) ){
+    EV_SET(&kch[nch++], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+  }
+  if( (events & EV_WRITE) && !(old_events & EV_WRITE) ){
+    EV_SET(&kch[nch++], fd, EVFILT_WRITE, EV_ADD, 0, 0, NULL);
+  }
+  else if( !(events & EV_WRITE) && (old_events & EV_WRITE) ){
+    EV_SET(&kch[nch++], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+  }
+  if( nch == 0 ){
+    return 0;
+  }
+  return (kevent(ev_kqfd, kch, nch, NULL, 0, NULL) < 0) ? 1 : 0;
+}
+
+static int ev_kqueue_wait( struct ev_event* out, int maxout, int timeout_ms )
+//---------------------------------------------------------------------------
+/// @brief Wait for events with kevent().
+/// @return Number of events placed in out, or -1 on error (errno set).
+{
+  struct kevent kev[EV_MAXEVENTS];
+  struct timespec ts;
+  int i, nready;
+
+  if( maxout > EV_MAXEVENTS ){
+    maxout = EV_MAXEVENTS;
+  }
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+  nready = kevent(ev_kqfd, NULL, 0, kev, maxout, (timeout_ms < 0) ? NULL : &ts);
+  for( i=0; i<nready; i++ ){
+    struct ev_slot* slot = ev_find((int)kev[i].ident);
+    out[i].fd = (int)kev[i].ident;
+    out[i].tag = (slot == NULL) ? NULL : slot->tag;
+    out[i].events = (kev[i].filter == EVFILT_WRITE) ? EV_WRITE : EV_READ;
+  }
+  return nready;
+}
+
+static const struct ev_backend ev_native_backend = { "kqueue", ev_kqueue_init, ev_kqueue_set, ev_kqueue_wait };
+
+#else
+
+static const struct ev_backend ev_native_backend = { "poll", ev_poll_init, ev_poll_set, ev_poll_wait };
+
+#endif
+
+static const struct ev_backend* evb = &ev_native_backend; ///< Event backend in use.
+
+static int ev_start( int force_poll )
+//-----------------------------------
+/// @brief Choose and initialize an event backend.
+/// @param force_poll Use the poll() backend regardless.
+/// @return 0 if OK, 1 on error.
+{
+  if( !force_poll && evb->init() == 0 ){
+    printf("INFO: Using %s event backend.\n", evb->name);
+    return 0;
+  }
+  evb = &ev_poll_backend;
+  printf("INFO: Using %s event backend.\n", evb->name);
+  return evb->init();
+}
+
+static int ev_watch( int fd, int events, void* tag )
+//--------------------------------------------------
+/// @brief Register, change or remove (events 0) interest in a file descriptor.
+///
+/// Some descriptors (e.g. terminals with kqueue on some macOS versions) cannot be
+/// registered with the native backend. poll() is used from then on if that happens.
+/// Descriptors must be removed before they are closed.
+///
+/// @param fd File descriptor.
+/// @param events EV_READ and/or EV_WRITE, or 0.
+/// @param tag Returned with each event for fd.
+/// @return 0 if OK, 1 on error.
+{
+  if( fd < 0 || fd >= EV_MAXFDS ){
+    return 1;
+  }
+  if( evb->set(fd, events, tag) == 0 || events == 0 ){
+    return 0;
+  }
+  if( evb == &ev_poll_backend ){
+    return 1;
+  }
+
+  // The registration is already in ev_slots, which is all poll() needs.
+  printf("INFO: %s event backend cannot wait on fd %d. Using poll.\n", evb->name, fd);
+  evb = &ev_poll_backend;
+  return evb->init();
+}
+
+//=====================================================================================
+// Sessions. Normally there is one, connected to the terminal ctelnet runs in. In
+// daemon mode (--sessions N) there are N, each with a Unix socket a terminal can
+// attach to (e.g. with ctelnet --attach).
+//=====================================================================================
+
+static void session_path( const struct session* s, char* path, size_t len )
+//-------------------------------------------------------------------------
+/// @brief Make the name of a daemon mode session's Unix socket.
+/// @param s Session.
+/// @param path Returns the name.
+/// @param len Size of path.
+{
+  snprintf(path, len, "%s_%d", sess_prefix, s->index);
+}
+
+static void session_detach( struct session* s )
+//---------------------------------------------
+/// @brief Disconnect a daemon mode session's attached terminal. The host connection stays up.
+/// @param s Session.
+{
+  if( s->ob_len > 0 ){
+    s->ob_len = 0;
+    --nbuffered;
+  }
+  s->wq_head = s->wq_len = 0;
+  host_pause(s, 0);
+  if( s->term_in >= 0 ){
+    ev_watch(s->term_in, 0, NULL);
+    close(s->term_in);
+    printf("INFO: Session %d: terminal detached.\n", s->index);
+    logit("INFO: Session %d: terminal detached.\n", s->index);
+  }
+  s->term_in = -1;
+  s->term_out = -1;
+}
+
+static void session_end( struct session* s )
+//------------------------------------------
+/// @brief Close a session: its host connection, terminal, Unix socket and FIFO.
+///
+/// ctelnet's own terminal gets a second at most to take any output still queued for it.
+///
+/// @param s Session.
+{
+  term_flush(s);
+  free(s->ob);
+  s->ob = NULL;
+  if( s->listen_fd < 0 && s->term_out >= 0 ){
+    struct pollfd pfd;
+    pfd.fd = s->term_out;
+    pfd.events = POLLOUT;
+    while( s->wq_len > 0 ){
+      pfd.revents = 0;
+      if( poll(&pfd, 1, 1000) <= 0 || term_drain(s) != 0 ){
+        break;
+      }
+    }
+    ev_watch(s->term_out, 0, NULL);
+  }
+  free(s->wq);
+  s->wq = NULL;
+  s->wq_head = s->wq_len = s->wq_cap = 0;
+  if( s->sock >= 0 ){
+    ev_watch(s->sock, 0, NULL);
+    close(s->sock);
+    s->sock = -1;
+    --nlive;
+    logit("INFO: Session %d: closed.\n", s->index);
+  }
+  else if( s->reconnect_at_ms != 0 ){
+    host_abandon(s);
+    s->reconnect_at_ms = 0;
+    --nreconnecting;
+    --nlive;
+  }
+  if( s->listen_fd >= 0 ){
+    char path[sizeof(sess_prefix) + 16];
+    session_detach(s);
+    ev_watch(s->listen_fd, 0, NULL);
+    close(s->listen_fd);
+    s->listen_fd = -1;
+    session_path(s, path, sizeof(path));
+    unlink(path);
+    printf("INFO: Session %d: closed.\n", s->index);
+  }
+  if( s->fin_fifo >= 0 ){
+    ev_watch(s->fin_fifo, 0, NULL);
+    close(s->fin_fifo);
+    close(s->fout_fifo);
+    s->fin_fifo = -1;
+    s->fout_fifo = -1;
+  }
+  if( s->sq_pos < s->sq_len ){
+    --nscripted;
+  }
+  free(s->sq);
+  s->sq = NULL;
+  s->sq_len = s->sq_pos = s->sq_cap = 0;
+  if( s->tq_len > 0 ){
+    logit("INFO: Session %d: %zu bytes for the host not sent.\n", s->index, s->tq_len);
+    --nqueued;
+  }
+  free(s->tq);
+  s->tq = NULL;
+  s->tq_head = s->tq_len = s->tq_cap = 0;
+  s->tq_watch = 0;
+}
+
+static void session_accept( struct session* s )
+//---------------------------------------------
+/// @brief Attach a terminal connecting to a daemon mode session's Unix socket.
+///
+/// Only one terminal can be attached at a time. Later ones are told so and closed.
+///
+/// @param s Session.
+{
+  static const char busy_msg[] = "\r\nERROR: Session already has a terminal attached.\r\n";
+  int fd = accept(s->listen_fd, NULL, NULL);
+  if( fd < 0 ){
+    if( errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK ){
+      perror("ERROR: Could not accept() terminal connection.");
+      logit("ERROR: accept() failed.\n");
+    }
+    return;
+  }
+  if( s->term_in >= 0 ){
+    if( write(fd, busy_msg, sizeof(busy_msg) - 1) < 0 ){
+      logit("INFO: Session %d: could not tell extra terminal it was refused.\n", s->index);
+    }
+    close(fd);
+    return;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  if( ev_watch(fd, EV_READ, s) != 0 ){
+    fprintf(stderr, "ERROR: Too many file descriptors to attach terminal.\n");
+    close(fd);
+    return;
+  }
+  s->term_in = fd;
+  s->term_out = fd;
+  printf("INFO: Session %d: terminal attached.\n", s->index);
+  logit("INFO: Session %d: terminal attached.\n", s->index);
+}
+
+static int session_watch( struct session* s )
+//-------------------------------------------
+/// @brief Register all of a session's file descriptors with the event backend.
+///
+/// The host socket is made non-blocking too, for host_flush(). A session still
+/// waiting to connect (--reconnect) has no host socket yet. On Haiku the terminal
+/// is made non-blocking as well, as it is read without waiting (see ev_poll_wait()).
+///
+/// @param s Session.
+/// @return 0 if OK, 1 on error.
+{
+  if( s->sock >= 0 ){
+    fcntl(s->sock, F_SETFL, fcntl(s->sock, F_GETFL) | O_NONBLOCK);
+  }
+#if defined(__HAIKU__)
+  if( s->term_in >= 0 ){
+    fcntl(s->term_in, F_SETFL, fcntl(s->term_in, F_GETFL) | O_NONBLOCK);
+  }
+#endif
+  if( (s->sock >= 0 && ev_watch(s->sock, EV_READ, s) != 0) ||
+      (s->term_in >= 0 && ev_watch(s->term_in, EV_READ, s) != 0) ||
+      (s->listen_fd >= 0 && ev_watch(s->listen_fd, EV_READ, s) != 0) ||
+      (s->fin_fifo >= 0 && ev_watch(s->fin_fifo, EV_READ, s) != 0) ){
+    return 1;
+  }
+  return 0;
+}
+
+static int host_flush( struct session* s )
+//----------------------------------------
+/// @brief Send as much of the output queued for the host as its socket will take now.
+///
+/// The host socket is non-blocking. Whatever it does not take (EAGAIN or a partial
+/// write) stays queued and the socket is watched for writability until all of it has
+/// gone. So a host that is slow to read a big paste or deck never stops the event
+/// loop, and its own output carries on being read meanwhile.
+///
+/// @param s Session.
+/// @return 0 if OK, 1 if writev() failed.
+{
+  struct iovec iov[2];
+  ssize_t nw;
+  int was_queued = (s->tq_len > 0);
+  unsigned char watch;
+
+  while( s->tq_len > 0 ){
+    // The ring's contents are in at most two pieces.
+    size_t first = s->tq_cap - s->tq_head;
+    if( first > s->tq_len ){
+      first = s->tq_len;
+    }
+    iov[0].iov_base = s->tq + s->tq_head;
+    iov[0].iov_len = first;
+    iov[1].iov_base = s->tq;
+    iov[1].iov_len = s->tq_len - first;
+    ++s->send_calls;
+    nw = writev(s->sock, iov, (iov[1].iov_len > 0) ? 2 : 1);
+    if( nw < 0 ){
+      if( errno == EINTR ){
+        continue;
+      }
+      else if( errno == EAGAIN || errno == EWOULDBLOCK ){
+        break;
+      }
+      perror("ERROR: Could not writev() to host.");
+      logit("ERROR: writev() to host failed, %zu characters queued.\n", s->tq_len);
+      return 1;
+    }
+    s->tq_head = (s->tq_head + (size_t)nw) % s->tq_cap;
+    s->tq_len -= (size_t)nw;
+  }
+
+  if( was_queued && s->tq_len == 0 ){
+    s->tq_head = 0;
+    --nqueued;
+    if( s->key_waiting ){
+      hist_add(&s->key_hist, now_us() - s->last_key_us);
+      s->key_waiting = 0;
+    }
+  }
+
+  // Wait for the socket to be writable only while there is something left.
+  watch = (s->tq_len > 0);
+  if( watch != s->tq_watch ){
+    s->tq_watch = watch;
+    if( ev_watch(s->sock, host_events(s), s) != 0 ){
+      fprintf(stderr, "ERROR: Could not wait for session %d host to be writable.\n", s->index);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int host_backoff( const struct session* s )
+//------------------------------------------------
+/// @brief Find how long to wait before the next connect attempt after one fails.
+/// @param s Session.
+/// @return Twice the wait before the one that failed, from RECONNECTMINMS up to RECONNECTMAXMS.
+{
+  if( 2 * s->reconnect_ms < RECONNECTMINMS ){
+    return RECONNECTMINMS;
+  }
+  return (2 * s->reconnect_ms < RECONNECTMAXMS) ? 2 * s->reconnect_ms : RECONNECTMAXMS;
+}
+
+static void host_wait( struct session* s, int delay_ms )
+//------------------------------------------------------
+/// @brief Arrange for the event loop to try to connect a session to its host later (--reconnect).
+/// @param s Session, with no host socket.
+/// @param delay_ms How long to wait first.
+{
+  if( s->reconnect_at_ms == 0 ){
+    ++nreconnecting;
+  }
+  s->reconnect_ms = delay_ms;
+  s->reconnect_at_ms = now_ms() + (uint64_t)delay_ms;
+}
+
+static void host_drop( struct session* s )
+//----------------------------------------
+/// @brief Close a session's lost host connection and arrange to reconnect (--reconnect).
+///
+/// The terminal, FIFO and scripted input stay. Whatever was queued for the old
+/// connection is discarded, as is the telnet and prompt matching state.
+///
+/// @param s Session.
+{
+  static const char lost_msg[] = "INFO: Reconnecting ...\n\r";
+
+  term_flush(s);
+  ev_watch(s->sock, 0, NULL);
+  close(s->sock);
+  s->sock = -1;
+  if( s->tq_len > 0 ){
+    logit("INFO: Session %d: %zu bytes for the host not sent.\n", s->index, s->tq_len);
+    --nqueued;
+  }
+  s->tq_head = s->tq_len = 0;
+  s->tq_watch = 0;
+  s->key_waiting = 0;
+  s->tparse.state = TS_DATA;
+  s->tparse.sblen = 0;
+  s->ac_state = 0;
+  s->await_prompt = 0;
+  host_wait(s, RECONNECTMINMS);
+
+  if( s->term_out >= 0 ){
+    term_send(s, (const unsigned char*)lost_msg, sizeof(lost_msg) - 1);
+  }
+  if( s->listen_fd >= 0 ){
+    printf("INFO: Session %d: host connection lost. Reconnecting ...\n", s->index);
+  }
+  logit("INFO: Session %d: host connection lost. Reconnecting ...\n", s->index);
+}
+
+static void host_abandon( struct session* s )
+//------------------------------------------
+/// @brief Close the connect() calls of a session's reconnect attempt that are still in progress.
+/// @param s Session.
+{
+  int i;
+
+  for( i=0; i<s->nconn; i++ ){
+    ev_watch(s->conn_fd[i], 0, NULL);
+    close(s->conn_fd[i]);
+  }
+  s->nconn = 0;
+  s->conn_deadline_ms = 0;
+}
+
+static int host_reconnect( struct session* s )
+//--------------------------------------------
+/// @brief Carry on connecting a session to its host when its reconnect_at_ms is due.
+///
+/// This is host_connect() for the event loop, and never blocks. The first call starts
+/// an attempt: a non-blocking connect() to the first address. The loop watches its
+/// socket and host_connected() takes it if it connects. Later calls, CONNECTDELAYMS
+/// apart or at once after a connect() fails, start one to the next address. When
+/// every address has failed, or none has connected within connect_timeout_ms, the
+/// next attempt is made after twice the wait before this one, up to RECONNECTMAXMS.
+/// The addresses are the ones looked up at start-up, so there is no getaddrinfo()
+/// call to hold up the other sessions. Daemon mode sessions make their first
+/// connection this way too, so that they all connect at once.
+///
+/// @param s Session.
+/// @return 0 if OK, 1 if the attempt failed and the session should end (no --reconnect).
+{
+  uint64_t now = now_ms();
+
+  if( s->conn_deadline_ms == 0 ){
+    s->conn_deadline_ms = now + (uint64_t)connect_timeout_ms;
+    s->conn_next = 0;
+    s->conn_next_ms = now;
+  }
+
+  // Start the next connect() when it is due, or now if nothing else is in progress.
+  while( now < s->conn_deadline_ms && s->conn_next < nhost_addrs && s->nconn < MAXADDRS &&
+         (s->nconn == 0 || now >= s->conn_next_ms) ){
+    int ia = s->conn_next++;
+    int fd = connect_start(host_addrs[ia]);
+    if( fd < 0 ){
+      continue;
+    }
+    // Connected at once or still in progress: the socket becomes writable either way.
+    if( ev_watch(fd, EV_WRITE, s) != 0 ){
+      close(fd);
+      continue;
+    }
+    s->conn_fd[s->nconn] = fd;
+    s->conn_addr[s->nconn] = (unsigned char)ia;
+    ++s->nconn;
+    s->conn_next_ms = now + CONNECTDELAYMS;
+  }
+
+  // Out of time, or every address has failed?
+  if( now >= s->conn_deadline_ms || s->nconn == 0 ){
+    host_abandon(s);
+    if( !reconnect ){
+      fprintf(stderr, "ERROR: Session %d: could not connect to %s port %s.\n", s->index, host_name, host_port);
+      logit("ERROR: Session %d: failed to connect().\n", s->index);
+      return 1;
+    }
+    host_wait(s, host_backoff(s));
+    return 0;
+  }
+
+  // Come back when the next connect() is due or the time allowed runs out.
+  s->reconnect_at_ms = s->conn_deadline_ms;
+  if( s->conn_next < nhost_addrs && s->conn_next_ms < s->conn_deadline_ms ){
+    s->reconnect_at_ms = s->conn_next_ms;
+  }
+  return 0;
+}
+
+static int host_connecting( struct session* s, int fd )
+//-----------------------------------------------------
+/// @brief Find one of the connect() calls of a session's reconnect attempt.
+/// @param s Session.
+/// @param fd File descriptor an event is for.
+/// @return Index in s->conn_fd, or -1 if fd is not one of them.
+{
+  int i;
+
+  for( i=0; i<s->nconn; i++ ){
+    if( s->conn_fd[i] == fd ){
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void host_connected( struct session* s, int ic, int events )
+//-----------------------------------------------------------------
+/// @brief Handle an event for one of the connect() calls of a session's reconnect attempt.
+///
+/// The first to connect becomes the session's host socket and the others are closed.
+/// One that failed is closed, and the loop is asked to start the next at once.
+///
+/// @param s Session.
+/// @param ic Index in s->conn_fd.
+/// @param events EV_READ and/or EV_WRITE.
+{
+  static const char back_msg[] = "INFO: Reconnected.\n\r";
+  char text[NI_MAXHOST + NI_MAXSERV + 4];
+  int sock = s->conn_fd[ic];
+  int err = connect_result(sock);
+
+  // Still in progress?
+  if( err == 0 && !(events & EV_WRITE) ){
+    return;
+  }
+  addr_text(host_addrs[s->conn_addr[ic]], text, sizeof(text));
+  s->conn_fd[ic] = s->conn_fd[s->nconn - 1];
+  s->conn_addr[ic] = s->conn_addr[s->nconn - 1];
+  --s->nconn;
+  if( err != 0 ){
+    logit("INFO: connect() to %s failed: %s\n", text, strerror(err));
+    ev_watch(sock, 0, NULL);
+    close(sock);
+    s->conn_next_ms = s->reconnect_at_ms = now_ms();
+    return;
+  }
+  logit("INFO: Connected to %s\n", text);
+  host_abandon(s);
+  s->sock = sock;
+  if( ev_watch(sock, host_events(s), s) != 0 ){
+    ev_watch(sock, 0, NULL);
+    close(sock);
+    s->sock = -1;
+    host_wait(s, host_backoff(s));
+    return;
+  }
+
+  s->reconnect_at_ms = 0;
+  --nreconnecting;
+  if( !s->was_connected && s->listen_fd >= 0 ){
+    printf("INFO: Session %d connected.\n", s->index);
+    logit("INFO: Session %d connected.\n", s->index);
+  }
+  else{
+    if( s->term_out >= 0 ){
+      term_send(s, (const unsigned char*)back_msg, sizeof(back_msg) - 1);
+    }
+    if( s->listen_fd >= 0 ){
+      printf("INFO: Session %d: reconnected.\n", s->index);
+    }
+    logit("INFO: Session %d: reconnected.\n", s->index);
+  }
+  s->was_connected = 1;
+  {
+    char tcp_text[128];
+    sock_report(sock, tcp_text, sizeof(tcp_text));
+    if( s->listen_fd >= 0 ){
+      printf("INFO: Session %d: TCP %s\n", s->index, tcp_text);
+    }
+    logit("INFO: Session %d: TCP %s\n", s->index, tcp_text);
+  }
+}
+
+static void hist_print( FILE* f, int index, const char* name, const struct latency_hist* h )
+//--------------------------------------------------------------------------------------------
+/// @brief Print a latency histogram's percentiles and non-empty buckets.
+/// @param f Where to print.
+/// @param index Session number.
+/// @param name What the times are.
+/// @param h Histogram.
+{
+  static const int pcts[3] = {50, 90, 99};
+  uint64_t seen = 0;
+  int b, ip = 0;
+
+  fprintf(f, "STATS: session %d %s: %" PRIu64 " times, max %" PRIu64 " us", index, name, h->count, h->max_us);
+  for( b=0; b<STATBUCKETS && ip<3 && h->count>0; b++ ){
+    seen += h->bucket[b];
+    while( ip < 3 && seen * 100 >= h->count * (uint64_t)pcts[ip] ){
+      fprintf(f, ", p%d < %llu us", pcts[ip], 1ULL << b);
+      ++ip;
+    }
+  }
+  fprintf(f, "\nSTATS: session %d %s buckets (< us:count):", index, name);
+  for( b=0; b<STATBUCKETS; b++ ){
+    if( h->bucket[b] > 0 ){
+      fprintf(f, " %llu:%u", 1ULL << b, h->bucket[b]);
+    }
+  }
+  fprintf(f, "\n");
+}
+
+static void stats_print( FILE* f )
+//--------------------------------
+/// @brief Print every session's counters, TCP settings and latency histograms. Done on SIGUSR1.
+/// @param f Where to print.
+{
+  int is;
+  char tcp_text[128];
+
+  for( is=0; is<nsessions; is++ ){
+    struct session* s = &sessions[is];
+    fprintf(f, "STATS: session %d: %s, in %d bytes in %" PRIu64 " recv(), out %d bytes in %" PRIu64
+            " writev() (%zu queued), %" PRIu64 " telnet commands, to terminal %" PRIu64 " bytes in %" PRIu64
+            " write()\n", s->index, (s->sock >= 0) ? "connected" : (s->reconnect_at_ms == 0) ? "closed" : s->was_connected ? "reconnecting" : "connecting", s->bytes_in, s->recv_calls,
+            s->bytes_out, s->send_calls, s->tq_len, s->tparse.ncmds, s->term_bytes, s->term_writes);
+    if( s->sock >= 0 && !s->raw ){
+      sock_report(s->sock, tcp_text, sizeof(tcp_text));
+      fprintf(f, "STATS: session %d TCP %s\n", s->index, tcp_text);
+    }
+    hist_print(f, s->index, "received to terminal", &s->rx_hist);
+    hist_print(f, s->index, "key to sent", &s->key_hist);
+  }
+  fflush(f);
+}
+
+static void stats_signal( int sig )
+//---------------------------------
+/// @brief SIGUSR1 handler. The statistics are printed from the event loop.
+/// @param sig Signal number.
+{
+  (void)sig;
+  stats_wanted = 1;
+}
+
+int event_loop( int force_poll )
+//------------------------------
+/// @brief Main character processing loop, for all sessions.
+///
+/// Sleeps until a host, terminal or input FIFO has something to read. There is no
+/// timeout, so idle sessions use no CPU and keystrokes are sent as soon as they are
+/// read. Everything queued for a host in one pass is sent just before the next wait,
+/// and the wait also covers hosts that could not take everything yet. With
+/// --reconnect, a session whose host connection is lost waits and reconnects rather
+/// than ending. Returns when no session is connected to its host any more.
+///
+/// @param force_poll Use the poll() event backend even if a better one is available.
+/// @return 0 if normal exit, 1 otherwise.
+{
+  unsigned char buf[BUFLEN + 1];
+  static unsigned char sbuf[RECVBUFLEN];
+  ssize_t n_send = 0;
+  struct ev_event events[EV_MAXEVENTS];
+  int nready, iev, is;
+  int istatus = 0;
+  int timeout_ms;
+
+  if( ev_start(force_poll) != 0 ){
+    perror("ERROR: Could not set up event backend.");
+    logit("ERROR: Could not set up event backend.\n");
+    return 1;
+  }
+  for( is=0; is<nsessions; is++ ){
+    if( session_watch(&sessions[is]) != 0 ){
+      fprintf(stderr, "ERROR: Could not wait for input on session %d.\n", is);
+      logit("ERROR: Could not wait for input on session %d.\n", is);
+      return 1;
+    }
+  }
+
+  // Loop until all hosts have gone ...
+  while( nlive > 0 ){
+
+    // SIGUSR1 asks for the statistics.
+    if( stats_wanted ){
+      stats_wanted = 0;
+      stats_print(stderr);
+    }
+
+    // Move on sessions connecting or reconnecting to their host, when due.
+    timeout_ms = -1;
+    if( nreconnecting > 0 ){
+      uint64_t now = now_ms();
+      for( is=0; is<nsessions; is++ ){
+        struct session* s = &sessions[is];
+        if( s->reconnect_at_ms != 0 && now >= s->reconnect_at_ms ){
+          if( host_reconnect(s) != 0 ){
+            istatus = 1;
+            session_end(s);
+          }
+          now = now_ms();
+        }
+        if( s->reconnect_at_ms != 0 ){
+          int wait = (s->reconnect_at_ms > now) ? (int)(s->reconnect_at_ms - now) : 0;
+          if( timeout_ms < 0 || wait < timeout_ms ){
+            timeout_ms = wait;
+          }
+        }
+      }
+      if( nlive == 0 ){
+        break;
+      }
+    }
+
+    // Send any scripted input that is due, and find when more will be.
+    if( nscripted > 0 ){
+      uint64_t now = now_ms();
+      for( is=0; is<nsessions; is++ ){
+        struct session* s = &sessions[is];
+        if( s->sock >= 0 && s->sq_pos < s->sq_len ){
+          int wait = script_pump(s, now);
+          if( wait == -2 ){
+            istatus = 1;
+            session_end(s);
+          }
+          else if( wait >= 0 && (timeout_ms < 0 || wait < timeout_ms) ){
+            timeout_ms = wait;
+          }
+        }
+      }
+      if( nlive == 0 ){
+        break;
+      }
+    }
+
+    // Write out any host output that has been held long enough.
+    if( nbuffered > 0 ){
+      uint64_t now = now_us();
+      for( is=0; is<nsessions; is++ ){
+        struct session* s = &sessions[is];
+        if( s->ob_len > 0 ){
+          int wait = term_due(s, now);
+          if( wait == 0 ){
+            if( term_flush(s) != 0 && s->listen_fd < 0 ){
+              perror("ERROR: Could not write() to stdout.");
+              logit("ERROR: write() to stdout failed.\n");
+              istatus = 1;
+              session_end(s);
+            }
+          }
+          else if( timeout_ms < 0 || wait < timeout_ms ){
+            timeout_ms = wait;
+          }
+        }
+      }
+      if( nlive == 0 ){
+        break;
+      }
+    }
+
+    // Send what has been queued for each host.
+    if( nqueued > 0 ){
+      for( is=0; is<nsessions; is++ ){
+        struct session* s = &sessions[is];
+        if( s->sock >= 0 && s->tq_len > 0 ){
+          if( host_flush(s) != 0 ){
+            if( reconnect ){
+              host_drop(s);
+            }
+            else{
+              istatus = 1;
+              session_end(s);
+            }
+          }
+          else if( s->tq_len == 0 && s->sq_pos < s->sq_len ){
+            // All taken: go straight back for any scripted input held back meanwhile.
+            timeout_ms = 0;
+          }
+        }
+      }
+      if( nlive == 0 ){
+        break;
+      }
+    }
+
+    // Wait for data from a host, a terminal or an input FIFO, for a host to take more
+    // output, or for scripted input to be due.
+    trace_idle();
+    nready = evb->wait(events, EV_MAXEVENTS, timeout_ms);
+    if( nready < 0 ){
+      if( errno == EINTR ){
+        continue;
+      }
+      perror("ERROR: Could not wait for events.");
+      logit("ERROR: Failed to wait for events.\n");
+      return 1;
+    }
+
+    for( iev=0; iev<nready; iev++ ){
+      struct session* s = events[iev].tag;
+      int fd = events[iev].fd;
+
+      // Anything for a file descriptor closed while handling an earlier event is stale.
+      if( s == NULL || ev_find(fd) == NULL || ev_find(fd)->tag != s ){
+        continue;
+      }
+
+      // One of the connect() calls of a session reconnecting to its host:
+      if( s->nconn > 0 ){
+        int ic = host_connecting(s, fd);
+        if( ic >= 0 ){
+          host_connected(s, ic, events[iev].events);
+          continue;
+        }
+      }
+
+      // Terminal ready for more of the output queued for it:
+      if( fd == s->term_out && (events[iev].events & EV_WRITE) ){
+        if( term_drain(s) != 0 ){
+          if( s->listen_fd >= 0 ){
+            session_detach(s);
+          }
+          else{
+            perror("ERROR: Could not write() to stdout.");
+            logit("ERROR: write() to stdout failed.\n");
+            istatus = 1;
+            session_end(s);
+          }
+          continue;
+        }
+        if( fd != s->term_in || !(events[iev].events & EV_READ) ){
+          continue;
+        }
+      }
+
+      // From host (for screen output), or host ready for more of what is queued for it:
+      if( fd == s->sock ){
+        struct timespec t0;
+        int bytes_in = s->bytes_in;
+        int rv;
+
+        // Send more of what is queued.
+        if( (events[iev].events & EV_WRITE) && host_flush(s) != 0 ){
+          if( reconnect ){
+            host_drop(s);
+          }
+          else{
+            istatus = 1;
+            session_end(s);
+          }
+          continue;
+        }
+
+        // Read everything available and send it to the terminal emulator.
+        if( !(events[iev].events & EV_READ) ){
+          continue;
+        }
+        if( bench ){
+          clock_gettime(CLOCK_MONOTONIC, &t0);
+        }
+        rv = host_receive(s);
+        if( bench ){
+          bench_sample(&t0, s->bytes_in - bytes_in);
+        }
+        if( rv != 0 ){
+          if( reconnect ){
+            host_drop(s);
+          }
+          else{
+            if( rv > 0 ){
+              istatus = 1;
+            }
+            session_end(s);
+          }
+        }
+      }
+
+      // A terminal attaching to a daemon mode session:
+      else if( fd == s->listen_fd ){
+        session_accept(s);
+      }
+
+      // From terminal emulator (keyboard input):
+      else if( fd == s->term_in ){
+
+        // Read all available bytes from the terminal emulator.
+        n_send = read(s->term_in, buf, BUFLEN);
+        if( n_send < 0 && (errno == EINTR || errno == EAGAIN) ){
+          continue;
+        }
+
+        // EOF (or error) on keyboard?
+        else if( n_send <= 0 ){
+          if( s->listen_fd >= 0 ){
+            session_detach(s);
+          }
+          else{
+            if( n_send < 0 ){
+              perror("ERROR: Could not read() from stdin (keyboard).");
+              logit( "ERROR: Failed to read() from stdin (keyboard).\n");
+              istatus = 1;
+            }
+            else{
+              logit( "INFO: EOF on stdin (keyboard).\n");
+            }
+            session_end(s);
+          }
+        }
+
+        // Nothing to send it to while reconnecting.
+        else if( s->sock < 0 ){
+          continue;
+        }
+
+        // Send everything that has been read.
+        else{
+          s->last_key_us = now_us();
+          s->key_waiting = 1;
+          if( send_buf( s, buf, (int)n_send ) != 0 ){
+            istatus = 1;
+            session_end(s);
+          }
+        }
+      }
+
+      // From named pipe (scripted input):
+      else if( fd == s->fin_fifo ){
+
+        // Read all available bytes from the input FIFO, as much as a pipe holds at a time.
+        n_send = read(s->fin_fifo, sbuf, RECVBUFLEN);
+        if( n_send < 0 ){
+          if( errno != EAGAIN && errno != EINTR ){
+            perror("ERROR: Could not read() from input FIFO.");
+            logit( "ERROR: Failed to read() from input FIFO.\n");
+            session_end(s);
           }
         }
 
-        if( n_send > 0 ){
-          if( send_buf( sock, buf, (int)n_send ) != 0 ){
-            return 1;
+        // Queue it. It is sent, paced as required, at the top of the loop.
+        else if( n_send > 0 ){
+          if( script_add( s, sbuf, (size_t)n_send ) != 0 ){
+            fprintf(stderr, "ERROR: Out of memory for scripted input.\n");
+            istatus = 1;
+            session_end(s);
           }
         }
-      }      
-    } // Data to send.
+      }
+    }
     
-  } // Loop forever.
+  } // Loop until all hosts have gone.
+
+  return istatus;
 }
 
-int non_blocking_loop(int sock, int fin_fifo)
-//-------------------------------------------
-/// @brief Main character processing loop (where select() only works with sockets).
+static void sock_tune( int sock )
+//-------------------------------
+/// @brief Apply the --nodelay, --rcvbuf, --sndbuf and --keepalive options to a host socket.
+///
+/// Called before connect(), so that the buffer sizes are used for the TCP window scale.
+/// Failures are reported but not fatal.
 ///
 /// @param sock Socket for connection to host.
-/// @param fin_fifo Input FIFO fd for scripting.
-/// @return 0 if normal exit, 1 otherwise.
 {
-  unsigned char buf[BUFLEN + 1];
-  ssize_t n_send = 0;
-  int len;
-  int ilist;
-  struct timeval ts;
+  int on = 1;
+  if( tcp_nodelay && setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0 ){
+    perror("WARNING: Could not set TCP_NODELAY.");
+  }
+  if( tcp_rcvbuf > 0 && setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &tcp_rcvbuf, sizeof(tcp_rcvbuf)) < 0 ){
+    perror("WARNING: Could not set SO_RCVBUF.");
+  }
+  if( tcp_sndbuf > 0 && setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &tcp_sndbuf, sizeof(tcp_sndbuf)) < 0 ){
+    perror("WARNING: Could not set SO_SNDBUF.");
+  }
+  if( tcp_keepidle > 0 ){
+    if( setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) < 0 ){
+      perror("WARNING: Could not set SO_KEEPALIVE.");
+    }
+#if defined(TCP_KEEPIDLE)
+    if( setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &tcp_keepidle, sizeof(tcp_keepidle)) < 0 ){
+      perror("WARNING: Could not set TCP_KEEPIDLE.");
+    }
+#elif defined(TCP_KEEPALIVE)
+    if( setsockopt(sock, IPPROTO_TCP, TCP_KEEPALIVE, &tcp_keepidle, sizeof(tcp_keepidle)) < 0 ){
+      perror("WARNING: Could not set TCP_KEEPALIVE.");
+    }
+#endif
+  }
+}
 
-  // Initial select wait.
-  ts.tv_sec = 0;
-  ts.tv_usec = 50000; // 50ms.
+static void sock_report( int sock, char* text, size_t len )
+//---------------------------------------------------------
+/// @brief Describe the effective TCP settings of a host socket.
+///
+/// The kernel may round or limit the sizes asked for (Linux doubles them), so the
+/// values are read back. Reported at connect, after a reconnect and with the SIGUSR1
+/// statistics.
+///
+/// @param sock Socket for connection to host.
+/// @param text Returns the description.
+/// @param len Size of text.
+{
+  int nodelay = 0, rcvbuf = 0, sndbuf = 0, keepalive = 0, keepidle = 0;
+  socklen_t optlen;
 
-  // Make stdin non-blocking.
-  fcntl(0, F_SETFL, fcntl(0, F_GETFL) | O_NONBLOCK);
+  optlen = sizeof(nodelay);
+  getsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, &optlen);
+  optlen = sizeof(rcvbuf);
+  getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen);
+  optlen = sizeof(sndbuf);
+  getsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen);
+  optlen = sizeof(keepalive);
+  getsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepalive, &optlen);
+#if defined(TCP_KEEPIDLE)
+  optlen = sizeof(keepidle);
+  getsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepidle, &optlen);
+#elif defined(TCP_KEEPALIVE)
+  optlen = sizeof(keepidle);
+  getsockopt(sock, IPPROTO_TCP, TCP_KEEPALIVE, &keepidle, &optlen);
+#endif
+  snprintf(text, len, "nodelay=%d rcvbuf=%d sndbuf=%d keepalive=%d keepidle=%d",
+           nodelay != 0, rcvbuf, sndbuf, keepalive != 0, keepidle);
+}
 
-  // Loop forever ...
-  while (1) {
-      
-    // Setup select()
-    fd_set fds;
-    FD_ZERO(&fds);
-    if (sock != 0)
-      FD_SET(sock, &fds);
- 
-    // Wait for data from host.
-    int nready = select(32, &fds, (fd_set *) 0, (fd_set *) 0, &ts);
-    if (nready < 0) {
-      perror("ERROR: Could not select().");
-      logit("Failed to select().\n");
-      return 1;
-    }
-    
-    // Nothing from host. See if anything from terminal emulator.
-    else if (nready == 0) {
-
-      // Read all available bytes from the input FIFO. This may be 0.
-      n_send = read(fin_fifo, buf, BUFLEN);
-      if( n_send < 0 ){
-        if( errno != EAGAIN ){
-          perror("ERROR: Could not read() from stdin (keyboard).");
-          logit( "ERROR: Failed to read() from stdin (keyboard).\n");
-          return 1;
-        }
-      }
+static int host_resolve( void )
+//-----------------------------
+/// @brief Look up the addresses (IPv6 and IPv4) of host_name and host_port with getaddrinfo().
+///
+/// They are put in host_addrs with the address families taking turns, starting with
+/// the one getaddrinfo() put first (as RFC 8305 suggests). So if the host's addresses
+/// of one family do not work, one of the other family is tried second, not last.
+///
+/// @return 0 if OK, else the getaddrinfo() error code (any earlier addresses are kept).
+{
+  struct addrinfo hints;
+  struct addrinfo* info = NULL;
+  struct addrinfo* ai;
+  struct addrinfo* first[MAXADDRS];
+  struct addrinfo* other[MAXADDRS];
+  int nfirst = 0, nother = 0, i, rv;
 
-      // Send anything that has been read from the FIFO. OK if nothing has.
-      else if( n_send > 0 ){
-        if( send_buf( sock, buf, (int)n_send ) != 0 ){
-          return 1;
-        }
-      }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  rv = getaddrinfo(host_name, host_port, &hints, &info);
+  if( rv != 0 ){
+    logit("ERROR: getaddrinfo() failed for %s port %s: %s\n", host_name, host_port, gai_strerror(rv));
+    return rv;
+  }
 
-      // Read all available bytes from the terminal emulator. Expect EAGAIN if no
-      // bytes are available.
-      n_send = read(fileno(stdin), buf, BUFLEN);
-      if( n_send < 0 ){
-        if( errno != EAGAIN ){
-          perror("ERROR: Could not read() from stdin (keyboard).");
-          logit( "ERROR: Failed to read() from stdin (keyboard).\n");
-          return 1;
-        }
+  for( ai=info; ai!=NULL; ai=ai->ai_next ){
+    if( ai->ai_family == info->ai_family ){
+      if( nfirst < MAXADDRS ){
+        first[nfirst++] = ai;
       }
+    }
+    else if( nother < MAXADDRS ){
+      other[nother++] = ai;
+    }
+  }
+  if( host_info != NULL ){
+    freeaddrinfo(host_info);
+  }
+  host_info = info;
+  nhost_addrs = 0;
+  for( i=0; i<nfirst || i<nother; i++ ){
+    if( i < nfirst && nhost_addrs < MAXADDRS ){
+      host_addrs[nhost_addrs++] = first[i];
+    }
+    if( i < nother && nhost_addrs < MAXADDRS ){
+      host_addrs[nhost_addrs++] = other[i];
+    }
+  }
+  return 0;
+}
 
-      // EOF on keyboard?
-      else if( n_send == 0 ){
-        logit( "INFO: EOF on stdin (keyboard).\n");
-        return 0;
-      }
+static void addr_text( const struct addrinfo* ai, char* text, size_t len )
+//------------------------------------------------------------------------
+/// @brief Describe a host address for messages, e.g. 192.168.1.2:6610 or [fe80::1]:6610.
+/// @param ai Address.
+/// @param text Returns the description.
+/// @param len Size of text.
+{
+  char host[NI_MAXHOST];
+  char serv[NI_MAXSERV];
 
-      // Send everything that has been read from the keyboard.
-      else if( n_send > 0 ){
-        if( send_buf( sock, buf, (int)n_send ) != 0 ){
-          return 1;
-        }
+  if( getnameinfo(ai->ai_addr, ai->ai_addrlen, host, sizeof(host), serv, sizeof(serv),
+                  NI_NUMERICHOST | NI_NUMERICSERV) != 0 ){
+    snprintf(text, len, "?");
+  }
+  else{
+    snprintf(text, len, (ai->ai_family == AF_INET6) ? "[%s]:%s" : "%s:%s", host, serv);
+  }
+}
+
+static int connect_start( const struct addrinfo* ai )
+//---------------------------------------------------
+/// @brief Start a non-blocking connect() to one of the host's addresses.
+/// @param ai Address.
+/// @return Socket, connected or still connecting, or -1 with errno set if connect() failed at once.
+{
+  char text[NI_MAXHOST + NI_MAXSERV + 4];
+  int fd = socket(ai->ai_family, SOCK_STREAM, 0);
+  int err;
+
+  if( fd < 0 ){
+    return -1;
+  }
+  sock_tune(fd);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  if( connect(fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS ){
+    err = errno;
+    addr_text(ai, text, sizeof(text));
+    logit("INFO: connect() to %s failed: %s\n", text, strerror(err));
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+static int connect_result( int fd )
+//---------------------------------
+/// @brief Find whether a non-blocking connect() that has finished worked.
+/// @param fd Socket given by connect_start().
+/// @return 0 if it connected, else the errno value it failed with.
+{
+  int soerr = 0;
+  socklen_t optlen = sizeof(soerr);
+
+  if( getsockopt(fd, SOL_SOCKET, SO_ERROR, &soerr, &optlen) < 0 ){
+    soerr = errno;
+  }
+  return soerr;
+}
+
+static int host_connect( void )
+//-----------------------------
+/// @brief Connect to the telnet server at host_addrs, trying its addresses in parallel.
+///
+/// A non-blocking connect() is started to the first address, then one to the next
+/// address every CONNECTDELAYMS while none has succeeded, or at once when one fails
+/// ("Happy Eyeballs", RFC 8305). The first to connect is used and the rest are closed.
+/// So an address that does not answer costs CONNECTDELAYMS, not a TCP timeout, and a
+/// host that is up but not listening (e.g. DtCyber restarting) fails at once.
+///
+/// This blocks, so it is only used at start-up. The event loop uses host_reconnect().
+///
+/// @return Socket (non-blocking), or -1 with errno set if nothing connected within connect_timeout_ms.
+{
+  struct pollfd pfd[MAXADDRS];
+  int pidx[MAXADDRS];
+  char text[NI_MAXHOST + NI_MAXSERV + 4];
+  uint64_t start = now_ms();
+  uint64_t next_ms = start;
+  uint64_t now;
+  int inext = 0, npend = 0, sock = -1, i, wait;
+  int err = ETIMEDOUT;
+
+  while( sock < 0 && (now = now_ms()) < start + (uint64_t)connect_timeout_ms ){
+
+    // Start the next attempt when it is due, or now if nothing else is in progress.
+    if( inext < nhost_addrs && (npend == 0 || now >= next_ms) ){
+      int fd = connect_start(host_addrs[inext++]);
+      if( fd < 0 ){
+        err = errno;
+        continue;
       }
+      // Connected at once or still in progress: poll() reports it writable either way.
+      pfd[npend].fd = fd;
+      pfd[npend].events = POLLOUT;
+      pfd[npend].revents = 0;
+      pidx[npend] = inext - 1;
+      ++npend;
+      next_ms = now + CONNECTDELAYMS;
+      continue;
+    }
 
-      // Have select wait for 50ms again.
-      ts.tv_sec = 0;
-      ts.tv_usec = 50000;
+    // Every address has failed?
+    if( npend == 0 ){
+      break;
     }
 
-    // Something from the host:
-    else if (sock != 0 && FD_ISSET(sock, &fds)) {
-          
-      // Read a single byte.
-      int rv;
-      if ((rv = recv(sock , buf , 1 , 0)) < 0){
-        perror("ERROR: Could not recv().");
-        logit("ERROR: recv() failed (case 1).\n");
-        return 1;
+    // Wait for an attempt to finish, the next one to be due or the time allowed to run out.
+    wait = (int)(start + (uint64_t)connect_timeout_ms - now);
+    if( inext < nhost_addrs && next_ms < now + (uint64_t)wait ){
+      wait = (int)(next_ms - now);
+    }
+    if( poll(pfd, (nfds_t)npend, wait) < 0 ){
+      if( errno == EINTR ){
+        continue;
       }
-      else if (rv == 0) {
-        printf("\nINFO: Connection closed by the remote end\n\r");
-        logit("INFO: Connection closed by the remote end (case 1)\n");
-        return 0;
+      err = errno;
+      break;
+    }
+    for( i=0; i<npend; i++ ){
+      int soerr;
+      if( pfd[i].revents == 0 ){
+        continue;
       }
-
-      for( ilist=0; ilist<rv; ilist++ ){
-        logit( "I %08d %02x %s\n", bytes_in, buf[ilist], asciimap[buf[ilist]] );
-        ++bytes_in;
+      soerr = connect_result(pfd[i].fd);
+      addr_text(host_addrs[pidx[i]], text, sizeof(text));
+      if( soerr == 0 ){
+        sock = pfd[i].fd;
+        logit("INFO: Connected to %s\n", text);
       }
+      else{
+        err = soerr;
+        logit("INFO: connect() to %s failed: %s\n", text, strerror(err));
+        close(pfd[i].fd);
+        next_ms = now;
+      }
+      pfd[i] = pfd[npend - 1];
+      pidx[i] = pidx[npend - 1];
+      --npend;
+      --i;
+      if( sock >= 0 ){
+        break;
+      }
+    }
+  }
 
-      // If this is a telnet CMD, process it. 
-      if (buf[0] == CMD) {
-        
-        // Read 2 more bytes
-        len = recv(sock , buf + 1 , 2 , 0);
-        if (len < 0){
-          perror("ERROR: Could not recv() from socket.");
-          logit("ERROR: recv() from socket failed (case 2)\n");
-          return 1;
-        }
-        else if (len == 0) {
-          printf("\nINFO: Connection closed by the remote end\n\r");
-          logit("INFO: Connection closed by the remote end (case 2)\n");
-          return 0;
-        }
+  // Abandon the attempts that lost.
+  for( i=0; i<npend; i++ ){
+    close(pfd[i].fd);
+  }
+  if( sock < 0 ){
+    errno = err;
+  }
+  return sock;
+}
 
-        // Handle telnet property negotiation with host.
-        negotiate(sock, buf, 3);
-      }
+static int fifo_open( const char* pipe_filename, int* fout_fifo )
+//---------------------------------------------------------------
+/// @brief Open a FIFO (named pipe) to read from. Create it if necessary.
+///
+/// The FIFO is also held open for writing, so when a script writer closes it
+/// the read end does not report hang up (and wake the event loop) continuously.
+///
+/// @param pipe_filename Name of the FIFO.
+/// @param fout_fifo Returns the write end.
+/// @return Read end, or -1 on error.
+{
+  int in_fifo, fin_fifo;
 
-      // Send received data to the terminal emulator.
-      else{
-        len = 1;
-        buf[len] = '\0';
-        printf("%s", buf);
-        fflush(stdout);
-      }
-    } // Something from host.
-    
-  } // Loop forever.
+  if( ! fifo_exists(pipe_filename) ){
+    in_fifo = mkfifo(pipe_filename, 0666);
+    if( in_fifo < 0 ){
+      perror("ERROR: Could not create input FIFO.");
+      logit("ERROR: Could not create input FIFO.\n");
+      return -1;    
+    }
+  }
+  
+  fin_fifo = open(pipe_filename, O_RDONLY|O_NONBLOCK);
+  if( fin_fifo < 0 ){
+      perror("ERROR: Could not open input FIFO.");
+      logit("ERROR: Could not open input FIFO.\n");
+      return -1;      
+  }  
+
+  *fout_fifo = open(pipe_filename, O_WRONLY|O_NONBLOCK);
+  if( *fout_fifo < 0 ){
+      perror("ERROR: Could not open input FIFO for writing.");
+      logit("ERROR: Could not open input FIFO for writing.\n");
+      close(fin_fifo);
+      return -1;
+  }
+  return fin_fifo;
+}
+
+static int unix_listen( const char* path )
+//----------------------------------------
+/// @brief Create a Unix domain socket for terminals to attach to a session.
+/// @param path Socket name. Any existing file of that name is removed.
+/// @return Listening socket, or -1 on error.
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  unlink(path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if( fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0 ){
+    perror("ERROR: Could not create session socket.");
+    logit("ERROR: Could not create session socket %s.\n", path);
+    if( fd >= 0 ){
+      close(fd);
+    }
+    return -1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+static int unix_connect( const char* path )
+//-----------------------------------------
+/// @brief Connect to a daemon mode session's Unix domain socket.
+/// @param path Socket name.
+/// @return Socket, or -1 on error.
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if( fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ){
+    perror("ERROR: Could not connect() to session socket.");
+    logit("ERROR: Could not connect to session socket %s.\n", path);
+    if( fd >= 0 ){
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
 }
 
 int main(int argc , char *argv[])
 //-------------------------------
 /// @brief Implement a minimal but useful telnet client.
+///
+/// Normally connects the terminal it is run in to one host. With --sessions N it
+/// holds N connections to the host in one process, each served over a Unix socket
+/// (/tmp/ctelnet_sess<pname>_<i>) that "ctelnet --attach socket" connects a terminal to.
+///
 /// @param argc Command line argument count.
 /// @param argv Command line word string argument pointers.
 /// @return 0 if OK, else condition code.
 {
-  struct sockaddr_in server;
-  int sock=0;
-  int port=0;
   int ia=0;
+  int is=0;
   int istatus=0;
-  char* host_dotted = NULL;
-  char ip_from_hostname[20];
   char pipe_filename[80] = {0};
-  int in_fifo, fin_fifo;
+  unsigned char buf[RECVBUFLEN];
+  int force_poll = 0;
+  int nsess = 0;
+  char* script_name = NULL;
+  struct session defaults;
 
   printf( "\nCTELNET: Minimal telnet client V0.4 (10-JUN-2025).\n" );
+
+  memset(&defaults, 0, sizeof(defaults));
+  defaults.sock = -1;
+  defaults.term_in = STDIN_FILENO;
+  defaults.term_out = STDOUT_FILENO;
+  defaults.listen_fd = -1;
+  defaults.fin_fifo = -1;
+  defaults.fout_fifo = -1;
+  defaults.tparse.state = TS_DATA;
+
+  // Attach this terminal to a daemon mode session?
+  if( argc >= 3 && !strcmp( argv[1], "--attach" ) ){
+    sessions = &defaults;
+    nsessions = 1;
+    defaults.raw = 1;
+    defaults.sock = unix_connect(argv[2]);
+    if( defaults.sock < 0 ){
+      return 1;
+    }
+    nlive = 1;
+    printf("INFO: Attached to %s ...\n", argv[2]);
+    terminal_set();
+    atexit(terminal_reset);
+    istatus = event_loop(argc > 3 && !strcmp( argv[3], "--poll" ));
+    if( defaults.sock >= 0 ){
+      close(defaults.sock);
+    }
+    return istatus;
+  }
     
   // Parse command line.
   if( argc < 3 ){
-    fprintf(stderr, "ERROR: Usage: %s address port [--crlf --cr_after_lf --lfafternl --log --slow --pname or --tpname name]\n", argv[0]);
+    fprintf(stderr, "ERROR: Usage: %s address port [--crlf --cr_after_lf --lfafternl --log --trace --tracefile file --bench --slow --pace profile --prompt str --script file --coalesce us --nodelay --rcvbuf n --sndbuf n --keepalive secs --timeout ms --reconnect --poll --splice --sessions N --pname or --tpname name]\n", argv[0]);
+    fprintf(stderr, "       %s --attach session_socket [--poll]\n", argv[0]);
     return 1;
   }
-  host_dotted = argv[1];
-  port = atoi(argv[2]);
-
-  // If host_dotted doesn't look like an IP address, treat it as a host name.
-  if( ! isdigit(host_dotted[0]) ){
-    if( hostname_to_ip( host_dotted, ip_from_hostname ) != 0 ){
-      fprintf(stderr, "ERROR: Failed to convert host name to IP address.\n");
-      return 33;
-    }
-    host_dotted = ip_from_hostname;
-  }
+  host_name = argv[1];
+  host_port = argv[2];
 
   snprintf(pipe_filename, 80, "/tmp/ctelnet_fifo_in");
   for( ia=3; ia<argc; ia++ ){
     if( !strcmp( argv[ia], "--crlf" ) ){
-      send_crlf_at_newline = 1;
+      defaults.send_crlf_at_newline = 1;
       printf("INFO: --crlf is set.\n");
     }
     else if( !strcmp( argv[ia], "--cr_after_lf" ) ){
-      send_cr_after_lf = 0;
+      defaults.send_cr_after_lf = 0;
       printf("INFO: --cr_after_lf is set.\n");
     }
     else if( !strcmp( argv[ia], "--lfafternl" ) ){
-      show_lf_after_newline = 1;
+      defaults.show_lf_after_newline = 1;
       printf("INFO: --lfafternl is set.\n");
     }
     else if( !strcmp( argv[ia], "--log" ) ){
@@ -628,8 +3145,129 @@ int main(int argc , char *argv[])
         return 1;
       }
     }
+    else if( !strcmp( argv[ia], "--trace" ) ){
+      char* homedir = getenv("HOME");
+      char fullname[1024] = {0};
+      time_t now = time(0);
+      snprintf(fullname,sizeof(fullname),"%s/ctelnet_trace_%jd.bin",(homedir != NULL) ? homedir : "/tmp",(intmax_t)now);
+      if( trace_open(fullname) != 0 ){
+        fprintf(stderr, "ERROR: Cannot create trace file.\n");
+        return 1;
+      }
+      printf("INFO: --trace to %s is set. Decode with: ctdecode %s\n",fullname,fullname);
+    }
+    else if( !strcmp( argv[ia], "--tracefile" ) && (ia < (argc-1)) ){
+      ++ia;
+      if( trace_open(argv[ia]) != 0 ){
+        fprintf(stderr, "ERROR: Cannot create trace file.\n");
+        return 1;
+      }
+      printf("INFO: --trace to %s is set. Decode with: ctdecode %s or replay with: ctreplay %s port\n",argv[ia],argv[ia],argv[ia]);
+    }
     else if( !strcmp( argv[ia], "--slow" ) ){
-      slow_pause = 5;
+      defaults.pace = PACE_LINE;
+      defaults.pace_ms = 5000;
+      printf("INFO: --slow is set (same as --pace line:5000).\n");
+    }
+    else if( !strcmp( argv[ia], "--pace" ) && (ia < (argc-1)) ){
+      char* arg = argv[++ia];
+      char* colon = strchr(arg, ':');
+      int ms = (colon != NULL) ? atoi(colon + 1) : 0;
+      if( !strncmp(arg, "none", 4) ){
+        defaults.pace = PACE_NONE;
+      }
+      else if( !strncmp(arg, "line:", 5) && ms > 0 ){
+        defaults.pace = PACE_LINE;
+      }
+      else if( !strncmp(arg, "quiet:", 6) && ms > 0 ){
+        defaults.pace = PACE_QUIET;
+      }
+      else if( !strncmp(arg, "prompt:", 7) && ms > 0 ){
+        defaults.pace = PACE_PROMPT;
+      }
+      else{
+        fprintf(stderr, "ERROR: --pace must be none, line:MS, quiet:MS or prompt:MS.\n");
+        return 1;
+      }
+      defaults.pace_ms = ms;
+      printf("INFO: --pace %s is set.\n", arg);
+    }
+    else if( !strcmp( argv[ia], "--prompt" ) && (ia < (argc-1)) ){
+      ++ia;
+      if( nprompts >= MAXPROMPTS ){
+        fprintf(stderr, "ERROR: No more than %d --prompt options.\n", MAXPROMPTS);
+        return 1;
+      }
+      printf("INFO: --prompt %s is set.\n", argv[ia]);
+      unescape(argv[ia]);
+      if( strlen(argv[ia]) < 1 || strlen(argv[ia]) >= PROMPTLEN ){
+        fprintf(stderr, "ERROR: --prompt must be 1 to %d characters.\n", PROMPTLEN - 1);
+        return 1;
+      }
+      strcpy(prompts[nprompts++], argv[ia]);
+    }
+    else if( !strcmp( argv[ia], "--coalesce" ) && (ia < (argc-1)) ){
+      coalesce_us = atoi(argv[++ia]);
+      printf("INFO: --coalesce %d is set.\n", coalesce_us);
+    }
+    else if( !strcmp( argv[ia], "--bench" ) ){
+      if( !bench ){
+        bench = 1;
+        atexit(bench_report);
+      }
+      printf("INFO: --bench is set. Results are printed on stderr at exit.\n");
+    }
+    else if( !strcmp( argv[ia], "--nodelay" ) ){
+      tcp_nodelay = 1;
+      printf("INFO: --nodelay is set.\n");
+    }
+    else if( !strcmp( argv[ia], "--rcvbuf" ) && (ia < (argc-1)) ){
+      tcp_rcvbuf = atoi(argv[++ia]);
+      printf("INFO: --rcvbuf %d is set.\n", tcp_rcvbuf);
+    }
+    else if( !strcmp( argv[ia], "--sndbuf" ) && (ia < (argc-1)) ){
+      tcp_sndbuf = atoi(argv[++ia]);
+      printf("INFO: --sndbuf %d is set.\n", tcp_sndbuf);
+    }
+    else if( !strcmp( argv[ia], "--keepalive" ) && (ia < (argc-1)) ){
+      tcp_keepidle = atoi(argv[++ia]);
+      printf("INFO: --keepalive %d is set.\n", tcp_keepidle);
+    }
+    else if( !strcmp( argv[ia], "--timeout" ) && (ia < (argc-1)) ){
+      connect_timeout_ms = atoi(argv[++ia]);
+      if( connect_timeout_ms < 1 ){
+        fprintf(stderr, "ERROR: --timeout must be at least 1 millisecond.\n");
+        return 1;
+      }
+      printf("INFO: --timeout %d is set.\n", connect_timeout_ms);
+    }
+    else if( !strcmp( argv[ia], "--reconnect" ) ){
+      reconnect = 1;
+      printf("INFO: --reconnect is set.\n");
+    }
+    else if( !strcmp( argv[ia], "--script" ) && (ia < (argc-1)) ){
+      script_name = argv[++ia];
+      printf("INFO: --script %s is set.\n", script_name);
+    }
+    else if( !strcmp( argv[ia], "--poll" ) ){
+      force_poll = 1;
+      printf("INFO: --poll is set.\n");
+    }
+    else if( !strcmp( argv[ia], "--splice" ) ){
+#if defined(__linux__)
+      use_splice = 1;
+      printf("INFO: --splice is set.\n");
+#else
+      printf("INFO: --splice is only available on Linux. Ignored.\n");
+#endif
+    }
+    else if( !strcmp( argv[ia], "--sessions" ) && (ia < (argc-1)) ){
+      nsess = atoi(argv[++ia]);
+      if( nsess < 1 || nsess > MAXSESSIONS ){
+        fprintf(stderr, "ERROR: --sessions must be between 1 and %d.\n", MAXSESSIONS);
+        return 1;
+      }
+      printf("INFO: --sessions %d is set.\n", nsess);
     }
     else if( ( !strcmp( argv[ia], "--pname" ) || !strcmp( argv[ia], "--tpname" ) ) && (ia < (argc-1)) ){
       int is_tpname = ! strcmp( argv[ia], "--tpname" );
@@ -654,58 +3292,167 @@ int main(int argc , char *argv[])
     }
   }
 
-  // Open a FIFO (named pipe) to read from. Create it if necessary.
-  // This allows terminal input to be scripted in a crude way.
-  if( ! fifo_exists(pipe_filename) ){
-    in_fifo = mkfifo(pipe_filename, 0666);
-    if( in_fifo < 0 ){
-      perror("ERROR: Could not create input FIFO.");
-      logit("ERROR: Could not create input FIFO.\n");
-      return 1;    
-    }
+  // NOS prompts, unless others were given.
+  if( nprompts == 0 ){
+    strcpy(prompts[nprompts++], "/");
+    strcpy(prompts[nprompts++], "READY.");
   }
-  
-  fin_fifo = open(pipe_filename, O_RDONLY|O_NONBLOCK);
-  if( fin_fifo < 0 ){
-      perror("ERROR: Could not open input FIFO.");
-      logit("ERROR: Could not open input FIFO.\n");
-      return 1;      
-  }  
- 
-  // Create socket.
-  sock = socket(AF_INET , SOCK_STREAM , 0);
-  if (sock == -1) {
-    perror("ERROR: Could not create socket.");
-    logit("ERROR: Could not create socket.\n");
+  if( prompt_build() != 0 ){
+    fprintf(stderr, "ERROR: --prompt strings are too long in total.\n");
     return 1;
   }
- 
-  server.sin_addr.s_addr = inet_addr(host_dotted);
-  server.sin_family = AF_INET;
-  server.sin_port = htons(port);
- 
-  // Connect to host.
-  if (connect(sock, (struct sockaddr *)&server , sizeof(server)) < 0) {
-    perror("ERROR: Could not connect().");
-    logit("ERROR: Failed to connect().\n");
+
+#if defined(__linux__)
+  // The splice() relay only works when host output needs no translation or logging.
+  if( use_splice && (defaults.send_crlf_at_newline || defaults.show_lf_after_newline || flog != NULL || trace_fd >= 0) ){
+    printf("INFO: --splice can't be used with --crlf, --lfafternl, --log or --trace. Ignored.\n");
+    use_splice = 0;
+  }
+  if( use_splice && pipe(splice_pipe) < 0 ){
+    perror("ERROR: Could not create pipe for --splice.");
+    logit("ERROR: Could not create pipe for --splice.\n");
     return 1;
   }
-  puts("INFO: Connected ...\n");
-  logit("INFO: Connected ...\n");
- 
-  // Set terminal to raw mode. Return to sanity on exit.
-  terminal_set();
-  atexit(terminal_reset);
-
-  // Loop getting characters from host and sending to stdout or from stdin and sending to host.
-  // NOTE: non_blocking_loop() works on all platforms, but still use standard_loop() if possible.
-#ifdef __HAIKU__  
-  istatus = non_blocking_loop(sock, fin_fifo);
-#else
-  istatus = standard_loop(sock, fin_fifo);
 #endif
-  
-  // Close socket and return condition code.
-  close(sock);
+
+  // Look up the host's addresses. Host names and IPv6 addresses can be used as well as IPv4.
+  {
+    int rv = host_resolve();
+    if( rv != 0 ){
+      fprintf(stderr, "ERROR: Could not look up %s port %s: %s\n", host_name, host_port, gai_strerror(rv));
+      return 33;
+    }
+  }
+
+  // Just the terminal ctelnet is running in.
+  if( nsess == 0 ){
+    sessions = &defaults;
+    nsessions = 1;
+
+    // Open a FIFO (named pipe) to read from. Create it if necessary.
+    // This allows terminal input to be scripted in a crude way.
+    defaults.fin_fifo = fifo_open(pipe_filename, &defaults.fout_fifo);
+    if( defaults.fin_fifo < 0 ){
+      return 1;
+    }
+
+    // Connect to host. With --reconnect, keep trying from the event loop if it is not there yet.
+    defaults.sock = host_connect();
+    if( defaults.sock < 0 ){
+      perror("ERROR: Could not connect().");
+      logit("ERROR: Failed to connect().\n");
+      if( !reconnect ){
+        return 1;
+      }
+      puts("INFO: Reconnecting ...\n");
+      host_wait(&defaults, RECONNECTMINMS);
+    }
+    nlive = 1;
+    if( defaults.sock >= 0 ){
+      char tcp_text[128];
+      defaults.was_connected = 1;
+      puts("INFO: Connected ...\n");
+      logit("INFO: Connected ...\n");
+      sock_report(defaults.sock, tcp_text, sizeof(tcp_text));
+      printf("INFO: TCP %s\n", tcp_text);
+      logit("INFO: TCP %s\n", tcp_text);
+    }
+
+    // Queue the whole of any script file to be sent.
+    if( script_name != NULL ){
+      FILE* fscript = fopen(script_name, "rb");
+      size_t nread;
+      if( fscript == NULL ){
+        perror("ERROR: Could not open script file.");
+        logit("ERROR: Could not open script file %s.\n", script_name);
+        return 1;
+      }
+      while( (nread = fread(buf, 1, sizeof(buf), fscript)) > 0 ){
+        if( script_add(&defaults, buf, nread) != 0 ){
+          fprintf(stderr, "ERROR: Out of memory for script file.\n");
+          return 1;
+        }
+      }
+      fclose(fscript);
+    }
+ 
+    // Set terminal to raw mode. Return to sanity on exit.
+    terminal_set();
+    atexit(terminal_reset);
+  }
+
+  // Daemon mode: a table of sessions, each with its own host connection, FIFO and Unix socket.
+  else{
+    struct rlimit rl;
+
+    if( script_name != NULL ){
+      printf("INFO: --script is not used with --sessions. Write scripts to the session FIFOs.\n");
+    }
+
+    // Each session can use 5 file descriptors. Allow as many as the hard limit does.
+    if( getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max ){
+      rl.rlim_cur = (rl.rlim_max > EV_MAXFDS) ? EV_MAXFDS : rl.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    // A terminal going away must not kill every session.
+    signal(SIGPIPE, SIG_IGN);
+
+    sessions = calloc((size_t)nsess, sizeof(struct session));
+    if( sessions == NULL ){
+      fprintf(stderr, "ERROR: Cannot allocate session table.\n");
+      return 1;
+    }
+    snprintf(sess_prefix, sizeof(sess_prefix), "/tmp/ctelnet_sess%s", pipe_filename + strlen("/tmp/ctelnet_fifo_in"));
+    for( is=0; is<nsess; is++ ){
+      struct session* s = &sessions[is];
+      char name[sizeof(pipe_filename) + 16];
+      *s = defaults;
+      s->index = is;
+      s->term_in = -1;
+      s->term_out = -1;
+      nsessions = is + 1;
+
+      snprintf(name, sizeof(name), "%s_%d", pipe_filename, is);
+      s->fin_fifo = fifo_open(name, &s->fout_fifo);
+      session_path(s, name, sizeof(name));
+      s->listen_fd = unix_listen(name);
+      if( s->fin_fifo < 0 || s->listen_fd < 0 ){
+        fprintf(stderr, "ERROR: Could not set up session %d.\n", is);
+        break;
+      }
+
+      // Connect from the event loop, so that the sessions all connect at once and an
+      // unreachable host costs connect_timeout_ms in all, not for each session.
+      host_wait(s, 0);
+      ++nlive;
+      printf("INFO: Session %d connecting. Attach with: ctelnet --attach %s\n", is, name);
+      logit("INFO: Session %d connecting.\n", is);
+    }
+
+    // Give up if any session could not be set up.
+    if( is < nsess ){
+      for( is=0; is<nsessions; is++ ){
+        session_end(&sessions[is]);
+      }
+      return 1;
+    }
+  }
+
+  // Loop getting characters from hosts and sending to terminals or from terminals and sending to hosts.
+  {
+    // SIGUSR1 prints statistics. Not restarted, so that the event wait returns to do it.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stats_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+  }
+  istatus = event_loop(force_poll);
+  for( is=0; is<nsessions; is++ ){
+    session_end(&sessions[is]);
+  }
+
+  logit("INFO: Exiting with status %d.\n", istatus);
   return istatus;
 }
@@ -0,0 +1,76 @@
+// ctelnet --trace file format. Shared by ctelnet and the ctdecode trace decoder.
+
+#ifndef CTELNET_TRACE_H
+#define CTELNET_TRACE_H
+
+#include <stdint.h>
+
+// Defines
+
+#define TRACE_MAGIC "CTTRACE1"
+#define TRACE_ORDER 0x01020304        // Byte order check. Traces are read on the machine that wrote them.
+#define TRACE_VERSION 1
+#define TRACE_IN 'I'                  // Bytes received from host, before telnet command removal.
+#define TRACE_OUT 'O'                 // Bytes sent to host.
+#define TRACE_MSG 'M'                 // A logit() message.
+
+// Types
+
+struct trace_file_header              ///< Start of a trace file.
+{
+  char magic[8];                      ///< TRACE_MAGIC, not NUL terminated.
+  uint32_t order;                     ///< TRACE_ORDER as written.
+  uint32_t version;                   ///< TRACE_VERSION.
+  int64_t start_sec;                  ///< Wall clock time the trace started, seconds.
+  int64_t start_nsec;                 ///< ... and nanoseconds.
+};
+
+struct trace_record                   ///< Header of each record. The len data bytes follow.
+{
+  uint64_t ns;                        ///< Nanoseconds since the trace started.
+  uint32_t len;                       ///< Number of data bytes.
+  uint16_t session;                   ///< Session number.
+  uint8_t dir;                        ///< TRACE_IN, TRACE_OUT or TRACE_MSG.
+  uint8_t pad;                        ///< Zero.
+};
+
+// Globals
+
+static const char* const asciimap[] = ///< ASCII byte values to string for log files.
+  {
+    "NUL", "SOH", "STX", "ETX", "EOT", "ENQ", "ACK", "BEL",
+    "BS",  "TAB", "LF",  "VT",  "FF",  "CR",  "SO",  "SI",
+    "DLE", "DC1", "DC2", "DC3", "DC4", "NAK", "SYN", "ETB",
+    "CAN", "EM",  "SUB", "ESC", "FS",  "GS",  "RS",  "US",
+    " SP", "!",   "\"",  "#",   "$",   "%",   "&",   "'",
+    "(",   ")",   "*",   "+",   ",",   "-",   ".",   "/",
+    "0",   "1",   "2",   "3",   "4",   "5",   "6",   "7",
+    "8",   "9",   ":",   ";",   "<",   "=",   ">",   "?",
+    "@",   "A",   "B",   "C",   "D",   "E",   "F",   "G",
+    "H",   "I",   "J",   "K",   "L",   "M",   "N",   "O",
+    "P",   "Q",   "R",   "S",   "T",   "U",   "V",   "W",
+    "X",   "Y",   "Z",   "[",   "\\",  "]",   "^",   "_",
+    "`",   "a",   "b",   "c",   "d",   "e",   "f",   "g",
+    "h",   "i",   "j",   "k",   "l",   "m",   "n",   "o",
+    "p",   "q",   "r",   "s",   "t",   "u",   "v",   "w",
+    "x",   "y",   "z",   "{",   "|",   "}",   "~",   "DEL",
+
+    "8/NUL", "8/SOH", "8/STX", "8/ETX", "8/EOT", "8/ENQ", "8/ACK", "8/BEL",
+    "8/BS",  "8/TAB", "8/LF",  "8/VT",  "8/FF",  "8/CR",  "8/SO",  "8/SI",
+    "8/DLE", "8/DC1", "8/DC2", "8/DC3", "8/DC4", "8/NAK", "8/SYN", "8/ETB",
+    "8/CAN", "8/EM",  "8/SUB", "8/ESC", "8/FS",  "8/GS",  "8/RS",  "8/US",
+    " 8/SP", "8/!",   "8/\"",  "8/#",   "8/$",   "8/%",   "8/&",   "8/'",
+    "8/(",   "8/)",   "8/*",   "8/+",   "8/,",   "8/-",   "8/.",   "8//",
+    "8/0",   "8/1",   "8/2",   "8/3",   "8/4",   "8/5",   "8/6",   "8/7",
+    "8/8",   "8/9",   "8/:",   "8/;",   "8/<",   "8/=",   "8/>",   "8/?",
+    "8/@",   "8/A",   "8/B",   "8/C",   "8/D",   "8/E",   "8/F",   "8/G",
+    "8/H",   "8/I",   "8/J",   "8/K",   "8/L",   "8/M",   "8/N",   "8/O",
+    "8/P",   "8/Q",   "8/R",   "8/S",   "8/T",   "8/U",   "8/V",   "8/W",
+    "8/X",   "8/Y",   "8/Z",   "8/[",   "8/\\",  "8/]",   "8/^",   "8/_",
+    "8/`",   "8/a",   "8/b",   "8/c",   "8/d",   "8/e",   "8/f",   "8/g",
+    "8/h",   "8/i",   "8/j",   "8/k",   "8/l",   "8/m",   "8/n",   "8/o",
+    "8/p",   "8/q",   "8/r",   "8/s",   "8/t",   "8/u",   "8/v",   "8/w",
+    "8/x",   "8/y",   "8/z",   "8/{",   "8/|",   "8/}",   "8/~",   "8/DEL"
+  };
+
+#endif
@@ -0,0 +1,348 @@
+// Serve the host side of a ctelnet --trace (or GTerm Record) session file back over TCP,
+// so that ctelnet and GTerm can be run against the same input repeatedly.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/errno.h>
+#include <netinet/in.h>
+#include "ctelnet_trace.h"
+
+// Types
+
+struct replay_chunk                   ///< One run of bytes received from the host in the session file.
+{
+  uint64_t ns;                        ///< Nanoseconds after the first run that it was received.
+  size_t offset;                      ///< Where its bytes start in the replay data.
+  uint32_t len;                       ///< Number of bytes.
+};
+
+// Globals
+
+static unsigned char* data = NULL;    ///< All the bytes to send, in order.
+static size_t data_len = 0;           ///< Number of bytes in data.
+static struct replay_chunk* chunks = NULL; ///< The runs of bytes, in order.
+static size_t nchunks = 0;            ///< Number of runs.
+
+static int load_session( const char* filename, int only_session )
+//---------------------------------------------------------------
+/// @brief Read the bytes received from the host in one session of a trace file.
+/// @param filename Name of trace file.
+/// @param only_session Session to replay, or -1 for the first one that received anything.
+/// @return 0 if OK, else 1.
+{
+  FILE* ftrace = NULL;
+  struct trace_file_header hdr;
+  struct trace_record rec;
+  size_t data_size = 0;
+  size_t chunks_size = 0;
+  uint64_t first_ns = 0;
+
+  ftrace = fopen(filename, "rb");
+  if( ftrace == NULL ){
+    perror("ERROR: Could not open trace file.");
+    return 1;
+  }
+  if( fread(&hdr, sizeof(hdr), 1, ftrace) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0 ){
+    fprintf(stderr, "ERROR: %s is not a ctelnet trace file.\n", filename);
+    fclose(ftrace);
+    return 1;
+  }
+  if( hdr.order != TRACE_ORDER || hdr.version != TRACE_VERSION ){
+    fprintf(stderr, "ERROR: %s was written by a different ctelnet version or machine type.\n", filename);
+    fclose(ftrace);
+    return 1;
+  }
+
+  while( fread(&rec, sizeof(rec), 1, ftrace) == 1 ){
+    int wanted = (rec.dir == TRACE_IN) && (rec.len > 0) &&
+      ((only_session < 0 && nchunks == 0) || rec.session == only_session);
+    if( wanted && only_session < 0 ){
+      only_session = rec.session;
+    }
+    if( !wanted ){
+      if( fseek(ftrace, rec.len, SEEK_CUR) != 0 ){
+        break;
+      }
+      continue;
+    }
+    if( data_len + rec.len > data_size ){
+      unsigned char* bigger = realloc(data, 2 * (data_len + rec.len));
+      if( bigger == NULL ){
+        fprintf(stderr, "ERROR: Out of memory.\n");
+        fclose(ftrace);
+        return 1;
+      }
+      data = bigger;
+      data_size = 2 * (data_len + rec.len);
+    }
+    if( nchunks == chunks_size ){
+      size_t more = (chunks_size == 0) ? 1024 : 2 * chunks_size;
+      struct replay_chunk* bigger = realloc(chunks, more * sizeof(struct replay_chunk));
+      if( bigger == NULL ){
+        fprintf(stderr, "ERROR: Out of memory.\n");
+        fclose(ftrace);
+        return 1;
+      }
+      chunks = bigger;
+      chunks_size = more;
+    }
+    if( fread(data + data_len, 1, rec.len, ftrace) != rec.len ){
+      fprintf(stderr, "WARNING: Trace file ends part way through a record.\n");
+      break;
+    }
+    if( nchunks == 0 ){
+      first_ns = rec.ns;
+    }
+    chunks[nchunks].ns = rec.ns - first_ns;
+    chunks[nchunks].offset = data_len;
+    chunks[nchunks].len = rec.len;
+    ++nchunks;
+    data_len += rec.len;
+  }
+  fclose(ftrace);
+
+  if( nchunks == 0 ){
+    fprintf(stderr, "ERROR: %s has nothing received from a host to replay.\n", filename);
+    return 1;
+  }
+  printf("INFO: Session %d: %zu bytes in %zu records over %.3f seconds.\n",
+         only_session, data_len, nchunks, (double)chunks[nchunks-1].ns / 1.0e9);
+  return 0;
+}
+
+static uint64_t elapsed_ns( const struct timespec* start )
+//--------------------------------------------------------
+/// @brief Time since start.
+/// @param start A CLOCK_MONOTONIC time.
+/// @return Nanoseconds since start.
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)(now.tv_sec - start->tv_sec) * 1000000000ULL + (uint64_t)now.tv_nsec - (uint64_t)start->tv_nsec;
+}
+
+static int send_all( int fd, const unsigned char* p, size_t n )
+//-------------------------------------------------------------
+/// @brief Send n bytes, throwing away anything the client sends meanwhile.
+///
+/// What the client sends (telnet option replies, typing) is not needed, but it
+/// must be read so that the client never blocks writing it.
+///
+/// @param fd Client socket.
+/// @param p Bytes to send.
+/// @param n Number of bytes.
+/// @return 0 if OK, else 1 if the client has gone.
+{
+  unsigned char junk[4096];
+  struct pollfd pfd;
+
+  while( n > 0 ){
+    pfd.fd = fd;
+    pfd.events = POLLIN | POLLOUT;
+    pfd.revents = 0;
+    if( poll(&pfd, 1, -1) < 0 ){
+      if( errno == EINTR ){
+        continue;
+      }
+      perror("ERROR: poll() failed.");
+      return 1;
+    }
+    if( pfd.revents & POLLIN ){
+      if( recv(fd, junk, sizeof(junk), 0) <= 0 ){
+        return 1;
+      }
+    }
+    if( pfd.revents & POLLOUT ){
+      ssize_t ns = send(fd, p, n, 0);
+      if( ns < 0 ){
+        if( errno == EINTR || errno == EAGAIN ){
+          continue;
+        }
+        return 1;
+      }
+      p += ns;
+      n -= (size_t)ns;
+    }
+    if( pfd.revents & (POLLERR | POLLHUP) ){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int wait_until( int fd, const struct timespec* start, uint64_t ns )
+//------------------------------------------------------------------------
+/// @brief Wait until a time after start, throwing away anything the client sends meanwhile.
+/// @param fd Client socket.
+/// @param start When the replay started (CLOCK_MONOTONIC).
+/// @param ns Nanoseconds after start to wait until.
+/// @return 0 if OK, else 1 if the client has gone.
+{
+  unsigned char junk[4096];
+  uint64_t now;
+  struct pollfd pfd;
+
+  while( (now = elapsed_ns(start)) < ns ){
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if( poll(&pfd, 1, (int)((ns - now + 999999) / 1000000)) > 0 ){
+      if( recv(fd, junk, sizeof(junk), 0) <= 0 ){
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void replay( int fd, int fast )
+//------------------------------------
+/// @brief Send the session to one client, then report how long it took.
+/// @param fd Client socket.
+/// @param fast If non-zero, send everything as fast as the client takes it, else at the recorded times.
+{
+  struct timespec start;
+  size_t i;
+  size_t sent = 0;
+  double secs;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if( fast ){
+    if( send_all(fd, data, data_len) == 0 ){
+      sent = data_len;
+    }
+  }
+  else{
+    for( i=0; i<nchunks; i++ ){
+      if( wait_until(fd, &start, chunks[i].ns) != 0 ||
+          send_all(fd, data + chunks[i].offset, chunks[i].len) != 0 ){
+        break;
+      }
+      sent += chunks[i].len;
+    }
+  }
+  secs = (double)elapsed_ns(&start) / 1.0e9;
+  printf("INFO: Sent %zu of %zu bytes in %.3f seconds (%.0f bytes/s).\n",
+         sent, data_len, secs, (secs > 0.0) ? (double)sent / secs : 0.0);
+  fflush(stdout);
+}
+
+static int listen_on( int port )
+//-------------------------------
+/// @brief Listen for IPv6 and IPv4 clients on a port, or IPv4 only if there is no IPv6.
+/// @param port Port number.
+/// @return Listening socket, or -1 with errno set.
+{
+  int on = 1;
+  int off = 0;
+  int lfd;
+  struct sockaddr_in6 addr6;
+  struct sockaddr_in addr;
+
+  // One IPv6 socket takes IPv4 clients too, as IPv4-mapped addresses.
+  lfd = socket(AF_INET6, SOCK_STREAM, 0);
+  if( lfd >= 0 ){
+    memset(&addr6, 0, sizeof(addr6));
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_addr = in6addr_any;
+    addr6.sin6_port = htons(port);
+    if( setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0 &&
+        setsockopt(lfd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) == 0 &&
+        bind(lfd, (struct sockaddr *)&addr6, sizeof(addr6)) == 0 && listen(lfd, 4) == 0 ){
+      return lfd;
+    }
+    close(lfd);
+  }
+  lfd = socket(AF_INET, SOCK_STREAM, 0);
+  if( lfd < 0 ){
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if( setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+      bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 4) < 0 ){
+    int err = errno;
+    close(lfd);
+    errno = err;
+    return -1;
+  }
+  return lfd;
+}
+
+int main(int argc , char *argv[])
+//-------------------------------
+/// @brief Replay a session file to each client that connects, one at a time.
+///
+/// Options: --fast sends as fast as possible rather than at the recorded times,
+/// -s N replays session N rather than the first and --once exits after one client.
+///
+/// @param argc Command line argument count.
+/// @param argv Command line word string argument pointers.
+/// @return 0 if OK, else 1.
+{
+  int fast = 0;
+  int once = 0;
+  int only_session = -1;
+  int ia;
+  int port;
+  int lfd;
+
+  for( ia=1; ia<argc-2; ia++ ){
+    if( !strcmp( argv[ia], "--fast" ) ){
+      fast = 1;
+    }
+    else if( !strcmp( argv[ia], "--once" ) ){
+      once = 1;
+    }
+    else if( !strcmp( argv[ia], "-s" ) && (ia < (argc-3)) ){
+      only_session = atoi(argv[++ia]);
+    }
+    else{
+      fprintf(stderr, "WARNING: Unknown option: %s (ignored)\n", argv[ia]);
+    }
+  }
+  if( argc < 3 ){
+    fprintf(stderr, "ERROR: Usage: %s [--fast --once -s session] trace_file port\n", argv[0]);
+    return 1;
+  }
+  if( load_session(argv[argc-2], only_session) != 0 ){
+    return 1;
+  }
+  port = atoi(argv[argc-1]);
+
+  signal(SIGPIPE, SIG_IGN);
+  lfd = listen_on(port);
+  if( lfd < 0 ){
+    perror("ERROR: Could not listen on port.");
+    return 1;
+  }
+  printf("INFO: Replaying %s on port %d%s.\n", argv[argc-2], port, fast ? " as fast as possible" : "");
+  fflush(stdout);
+
+  do{
+    int fd = accept(lfd, NULL, NULL);
+    if( fd < 0 ){
+      if( errno == EINTR ){
+        continue;
+      }
+      perror("ERROR: accept() failed.");
+      return 1;
+    }
+    replay(fd, fast);
+    close(fd);
+  } while( !once );
+
+  close(lfd);
+  free(data);
+  free(chunks);
+  return 0;
+}
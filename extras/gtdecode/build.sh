@@ -0,0 +1,18 @@
+#!/bin/bash
+echo "Build gtdecode native host output decoder for GTerm"
+#
+# Build for, and install into, the Python that runs GTerm. So activate
+# the GTerm venv first. GTerm works without this, only more slowly.
+#
+PYTHON=${PYTHON:-python3}
+INCLUDES=$($PYTHON -c "import sysconfig; print('-I' + sysconfig.get_paths()['include'])")
+SUFFIX=$($PYTHON -c "import sysconfig; print(sysconfig.get_config_var('EXT_SUFFIX'))")
+DEST=$($PYTHON -c "import sysconfig; print(sysconfig.get_paths()['platlib'])")
+if [[ "$OSTYPE" == "darwin"* ]]; then
+    LINKFLAGS="-bundle -undefined dynamic_lookup"
+else
+    LINKFLAGS="-shared"
+fi
+gcc -O2 -fPIC $INCLUDES gtdecode.c $LINKFLAGS -o gtdecode$SUFFIX
+cp gtdecode$SUFFIX "$DEST"
+echo "Done."
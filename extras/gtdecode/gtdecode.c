@@ -0,0 +1,1074 @@
+// gtdecode - Native host output decoder for GTerm.
+//
+// Does the work of GTermWidget.screenAddString() and the escape sequence
+// processors (cyber_apl_escape, ansi_escape, cyber_apl_graphics_escape) a
+// whole received buffer at a time. The result is a list of records which
+// GTerm applies to its screen and graphics display list in one pass:
+//
+//   (TEXT, [codes])             Characters to add to the current line.
+//   (SKIP,)                     A non-printing character was dropped.
+//   (NEWLINE,) (RETURN,) (BELL,) (BACKSPACE,) (TAB,) (FORMFEED,)
+//   (GRAPHICS, command, entry)  entry is the display list tuple, or None.
+//   (GRAPHICS_ERROR, command, message)
+//   (POLYLINE, command, xs, ys) A polyline (L) command: a move to the first
+//                               point and draws to the rest.
+//
+// The escape state (and the NOS APL "suppress next newline" flag) is kept
+// in the Decoder object between calls, so sequences split across buffers
+// are handled just as the Python code handles them.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Defines
+
+#define ESC_NONE 0      ///< Not an escape sequence start character.
+#define ESC_APL 1       ///< Cyber APL 2 three character $xx sequences.
+#define ESC_ANSI 2      ///< ANSI CSI sequences, ESC[...z for graphics.
+#define ESC_GRAPHICS 3  ///< Cyber APL 2 @[...@ graphics sequences.
+
+#define REC_TEXT 0
+#define REC_SKIP 1
+#define REC_NEWLINE 2
+#define REC_RETURN 3
+#define REC_BELL 4
+#define REC_BACKSPACE 5
+#define REC_TAB 6
+#define REC_FORMFEED 7
+#define REC_GRAPHICS 8
+#define REC_GRAPHICS_ERROR 9
+#define REC_POLYLINE 10
+
+#define MAXFIELD 128    ///< Longest graphics number field that is parsed.
+#define MAXSPLIT 8      ///< Alt mode graphics fields that are kept.
+
+// Polyline delta digits, as polyline_last_digits and polyline_more_digits in gterm.py.
+static const char polyline_last_digits[] = "0123456789LMNOPQRUVWXYabcdegijko";
+static const char polyline_more_digits[] = "!#%&()*+,-./:;<=>?]^_{|}pqrtvwxy";
+
+// Types
+
+typedef struct {
+  PyObject_HEAD
+  int32_t charmap[256];     ///< incharmap for codes 0-255.
+  PyObject* charmap_high;   ///< incharmap entries for codes above 255 (dict or NULL).
+  unsigned char esc_kind[256]; ///< Escape processor for each start character.
+  PyObject* apl_map;        ///< cyber_apl_in_map: "$xx" -> character code.
+  int inescape;             ///< In an escape sequence.
+  int kind;                 ///< Processor for the current escape sequence.
+  uint32_t* seq;            ///< Escape sequence so far (mapped codes).
+  Py_ssize_t seq_len;
+  Py_ssize_t seq_cap;
+  int suppress_newline;     ///< Throw away the next newline.
+  uint32_t* text;           ///< Pending TEXT record.
+  Py_ssize_t text_len;
+  Py_ssize_t text_cap;
+  int last_skip;            ///< Last record added was a SKIP.
+} Decoder;
+
+// Functions
+
+static int grow(uint32_t** buf, Py_ssize_t* cap, Py_ssize_t need)
+//---------------------------------------------------------------
+/// @brief Make sure a code buffer can hold need entries.
+/// @return 0 if OK, else -1 with a Python exception set.
+{
+  Py_ssize_t n = *cap ? *cap : 256;
+  uint32_t* p;
+  if( need <= *cap ){
+    return 0;
+  }
+  while( n < need ){
+    n *= 2;
+  }
+  p = realloc(*buf, n * sizeof(uint32_t));
+  if( p == NULL ){
+    PyErr_NoMemory();
+    return -1;
+  }
+  *buf = p;
+  *cap = n;
+  return 0;
+}
+
+static int add_record(PyObject* out, PyObject* rec)
+//-------------------------------------------------
+/// @brief Append a new reference to the output list, consuming it.
+/// @return 0 if OK, else -1.
+{
+  int status;
+  if( rec == NULL ){
+    return -1;
+  }
+  status = PyList_Append(out, rec);
+  Py_DECREF(rec);
+  return status;
+}
+
+static int text_flush(Decoder* d, PyObject* out)
+//----------------------------------------------
+/// @brief Turn any pending characters into a TEXT record.
+/// @return 0 if OK, else -1.
+{
+  PyObject* codes;
+  Py_ssize_t i;
+  if( d->text_len == 0 ){
+    return 0;
+  }
+  codes = PyList_New(d->text_len);
+  if( codes == NULL ){
+    return -1;
+  }
+  for( i=0; i<d->text_len; i++ ){
+    PyObject* c = PyLong_FromUnsignedLong(d->text[i]);
+    if( c == NULL ){
+      Py_DECREF(codes);
+      return -1;
+    }
+    PyList_SET_ITEM(codes, i, c);
+  }
+  d->text_len = 0;
+  d->last_skip = 0;
+  return add_record(out, Py_BuildValue("(iN)", REC_TEXT, codes));
+}
+
+static int text_add(Decoder* d, const uint32_t* codes, Py_ssize_t n)
+//------------------------------------------------------------------
+/// @brief Add characters to the pending TEXT record.
+/// @return 0 if OK, else -1.
+{
+  if( grow(&d->text, &d->text_cap, d->text_len + n) ){
+    return -1;
+  }
+  memcpy(d->text + d->text_len, codes, n * sizeof(uint32_t));
+  d->text_len += n;
+  d->last_skip = 0;
+  return 0;
+}
+
+static int simple_record(Decoder* d, PyObject* out, int type)
+//-----------------------------------------------------------
+/// @brief Add a record with no data, after any pending text.
+/// @return 0 if OK, else -1.
+{
+  if( text_flush(d, out) ){
+    return -1;
+  }
+  if( type == REC_SKIP ){
+    // Repeated drops do no more than the first.
+    if( d->last_skip ){
+      return 0;
+    }
+    d->last_skip = 1;
+  }
+  else{
+    d->last_skip = 0;
+  }
+  return add_record(out, Py_BuildValue("(i)", type));
+}
+
+static int is_printable(uint32_t c)
+//---------------------------------
+/// @brief Same test as GTermWidget.printableChar(): in string.printable, but not CR.
+{
+  return (c >= 32 && c < 127) || c == '\t' || c == '\n' || c == 0x0b || c == 0x0c;
+}
+
+static int is_space(uint32_t c)
+//-----------------------------
+/// @brief The characters (below 256) that str.split() splits on.
+{
+  return (c >= 9 && c <= 13) || (c >= 28 && c <= 32) || c == 0x85 || c == 0xa0;
+}
+
+static PyObject* field_repr(const uint32_t* codes, Py_ssize_t n)
+//--------------------------------------------------------------
+/// @brief A Python string of a field, for error messages.
+{
+  return PyUnicode_FromKindAndData(PyUnicode_4BYTE_KIND, codes, n);
+}
+
+static int parse_int(const uint32_t* codes, Py_ssize_t n, long* value, PyObject** err)
+//------------------------------------------------------------------------------------
+/// @brief Convert a field as int(str) would (GTermWidget.lint()).
+///
+/// @param codes Field character codes.
+/// @param n Field length.
+/// @param value Result.
+/// @param err Set to an error message string on failure.
+/// @return 0 if OK, else -1.
+{
+  Py_ssize_t i = 0;
+  Py_ssize_t end = n;
+  long v = 0;
+  int neg = 0;
+  int digits = 0;
+  while( i < end && is_space(codes[i]) ){
+    i++;
+  }
+  while( end > i && is_space(codes[end-1]) ){
+    end--;
+  }
+  if( i < end && (codes[i] == '+' || codes[i] == '-') ){
+    neg = (codes[i] == '-');
+    i++;
+  }
+  for( ; i<end; i++ ){
+    if( codes[i] >= '0' && codes[i] <= '9' ){
+      v = v * 10 + (long)(codes[i] - '0');
+      digits++;
+    }
+    else if( codes[i] == '_' && digits > 0 && i+1 < end && codes[i+1] >= '0' && codes[i+1] <= '9' ){
+      continue;
+    }
+    else{
+      break;
+    }
+  }
+  if( digits == 0 || i != end ){
+    PyObject* s = field_repr(codes, n);
+    *err = s ? PyUnicode_FromFormat("invalid literal for int() with base 10: %R", s) : NULL;
+    Py_XDECREF(s);
+    return -1;
+  }
+  *value = neg ? -v : v;
+  return 0;
+}
+
+static int parse_fixed(const uint32_t* seq, Py_ssize_t len, Py_ssize_t from, Py_ssize_t to,
+                       double scale, double* value, PyObject** err)
+//-----------------------------------------------------------------------------------------
+/// @brief Convert the fixed width field seq[from:to] and divide by scale
+///        (GTermWidget.lfcol(), lfwid() and lfpos()).
+/// @return 0 if OK, else -1.
+{
+  long v;
+  if( to > len ){
+    to = len;
+  }
+  if( from > to ){
+    from = to;
+  }
+  if( parse_int(seq + from, to - from, &v, err) ){
+    return -1;
+  }
+  *value = (double)v / scale;
+  return 0;
+}
+
+static int parse_float(const uint32_t* codes, Py_ssize_t n, int alt, double* value, PyObject** err)
+//-------------------------------------------------------------------------------------------------
+/// @brief Convert an alt mode field as float() or, if alt, GTermWidget.alt_float() would.
+///
+/// alt_float() accepts $NG... for a negative number and E$NG for a negative exponent.
+///
+/// @return 0 if OK, else -1.
+{
+  char buf[MAXFIELD+1];
+  Py_ssize_t i = 0;
+  Py_ssize_t j = 0;
+  int neg = 0;
+  char* endp;
+  if( alt && n > 0 && codes[0] == '$' ){
+    neg = 1;
+    i = 3;
+  }
+  for( ; i<n && j<MAXFIELD; i++ ){
+    if( codes[i] > 127 ){
+      break;
+    }
+    if( alt && codes[i] == 'E' && i+3 < n && codes[i+1] == '$' && codes[i+2] == 'N' && codes[i+3] == 'G' ){
+      buf[j++] = 'e';
+      buf[j++] = '-';
+      i += 3;
+    }
+    else{
+      buf[j++] = (char)codes[i];
+    }
+  }
+  buf[j] = 0;
+  if( i == n && j > 0 && j < MAXFIELD && !isspace((unsigned char)buf[0]) ){
+    *value = strtod(buf, &endp);
+    if( *endp == 0 ){
+      if( neg ){
+        *value = -*value;
+      }
+      return 0;
+    }
+  }
+  {
+    PyObject* s = field_repr(codes, n);
+    *err = s ? PyUnicode_FromFormat("could not convert string to float: %R", s) : NULL;
+    Py_XDECREF(s);
+  }
+  return -1;
+}
+
+static int polyline_digit(uint32_t c, int* more)
+//----------------------------------------------
+/// @brief Value of polyline delta digit c, setting *more if more digits follow.
+/// @return 0 to 31, or -1 if c is not a polyline delta digit.
+{
+  const char* p;
+  if( c == 0 || c > 127 ){
+    return -1;
+  }
+  if( (p = strchr(polyline_last_digits, (int)c)) != NULL ){
+    *more = 0;
+    return (int)(p - polyline_last_digits);
+  }
+  if( (p = strchr(polyline_more_digits, (int)c)) != NULL ){
+    *more = 1;
+    return (int)(p - polyline_more_digits);
+  }
+  return -1;
+}
+
+static int polyline_add(PyObject* xs, PyObject* ys, double x, double y)
+//---------------------------------------------------------------------
+/// @brief Append a point to the polyline coordinate lists.
+/// @return 0 if OK, else -1 with a Python exception set.
+{
+  PyObject* fx = PyFloat_FromDouble(x);
+  PyObject* fy = PyFloat_FromDouble(y);
+  int status = -1;
+  if( fx != NULL && fy != NULL && PyList_Append(xs, fx) == 0 && PyList_Append(ys, fy) == 0 ){
+    status = 0;
+  }
+  Py_XDECREF(fx);
+  Py_XDECREF(fy);
+  return status;
+}
+
+static PyObject* polyline_record(Decoder* d, long command, int alt)
+//-----------------------------------------------------------------
+/// @brief Parse a polyline graphics escape sequence in d->seq as GTermWidget.addGraphics() does.
+///
+/// Fixed form: ESC[LXXXXYYYY then deltas in units of 1/9999 in the polyline digit code.
+/// Alt form: @[L x y dx dy dx dy ... @ with alt_float() fields.
+///
+/// @return A POLYLINE or GRAPHICS_ERROR record, or NULL with a Python exception set.
+{
+  const uint32_t* seq = d->seq;
+  Py_ssize_t len = d->seq_len;
+  PyObject* xs = PyList_New(0);
+  PyObject* ys = PyList_New(0);
+  PyObject* err = NULL;
+  Py_ssize_t i;
+  long k = 0;
+
+  if( xs == NULL || ys == NULL ){
+    goto fail;
+  }
+  if( alt ){
+    double x = 0.0;
+    double y = 0.0;
+    double v;
+    Py_ssize_t start;
+    i = 3;
+    while( 1 ){
+      while( i < len-1 && is_space(seq[i]) ){
+        i++;
+      }
+      if( i >= len-1 ){
+        break;
+      }
+      start = i;
+      while( i < len-1 && !is_space(seq[i]) ){
+        i++;
+      }
+      if( parse_float(seq + start, i - start, 1, &v, &err) ){
+        goto bad;
+      }
+      if( k % 2 == 0 ){
+        x += v;
+      }
+      else{
+        y += v;
+        if( polyline_add(xs, ys, x, y) ){
+          goto fail;
+        }
+      }
+      k++;
+    }
+  }
+  else{
+    double x0, y0;
+    int64_t x, y;
+    uint64_t value = 0;
+    int shift = 0;
+    int more = 0;
+    int digit;
+    if( parse_fixed(seq, len, 3, 7, 1.0, &x0, &err) || parse_fixed(seq, len, 7, 11, 1.0, &y0, &err) ){
+      goto bad;
+    }
+    x = (int64_t)x0;
+    y = (int64_t)y0;
+    if( polyline_add(xs, ys, (double)x / 9999.0, (double)y / 9999.0) ){
+      goto fail;
+    }
+    for( i=11; i<len-1; i++ ){
+      digit = polyline_digit(seq[i], &more);
+      if( digit < 0 ){
+        // addGraphics() gets a KeyError for the character code.
+        err = PyUnicode_FromFormat("%ld", (long)seq[i]);
+        goto bad;
+      }
+      if( shift < 64 ){
+        value |= (uint64_t)digit << shift;
+      }
+      if( more ){
+        shift += 5;
+        continue;
+      }
+      // Zigzag decode.
+      if( k % 2 == 0 ){
+        x += (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+      }
+      else{
+        y += (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+        if( polyline_add(xs, ys, (double)x / 9999.0, (double)y / 9999.0) ){
+          goto fail;
+        }
+      }
+      k++;
+      value = 0;
+      shift = 0;
+    }
+  }
+  return Py_BuildValue("(ilNN)", REC_POLYLINE, command, xs, ys);
+
+ bad:
+  Py_XDECREF(xs);
+  Py_XDECREF(ys);
+  if( err == NULL ){
+    return NULL;
+  }
+  return Py_BuildValue("(ilN)", REC_GRAPHICS_ERROR, command, err);
+
+ fail:
+  Py_XDECREF(xs);
+  Py_XDECREF(ys);
+  return NULL;
+}
+
+static PyObject* graphics_record(Decoder* d)
+//------------------------------------------
+/// @brief Parse the graphics escape sequence in d->seq as GTermWidget.addGraphics() does.
+///
+/// Sequences starting with @ are the alternative (Cyber APL) form: white space separated
+/// fields. Seeing one sets the suppress next newline flag, as addGraphics() does.
+///
+/// @return A GRAPHICS or GRAPHICS_ERROR record, or NULL with a Python exception set.
+{
+  const uint32_t* seq = d->seq;
+  Py_ssize_t len = d->seq_len;
+  long command = -1;
+  int alt = 0;
+  Py_ssize_t fstart[MAXSPLIT];
+  Py_ssize_t flen[MAXSPLIT];
+  int nsplit = 0;
+  double v[4];
+  int nneed = 0;
+  int k;
+  PyObject* err = NULL;
+  PyObject* entry = NULL;
+  Py_ssize_t i;
+
+  if( len < 3 ){
+    return Py_BuildValue("(iis)", REC_GRAPHICS_ERROR, -1, "list index out of range");
+  }
+  command = (long)seq[2];
+
+  if( seq[0] == '@' ){
+    alt = 1;
+    d->suppress_newline = 1;
+    i = 0;
+    while( i < len && nsplit < MAXSPLIT ){
+      while( i < len && is_space(seq[i]) ){
+        i++;
+      }
+      if( i >= len ){
+        break;
+      }
+      fstart[nsplit] = i;
+      while( i < len && !is_space(seq[i]) ){
+        i++;
+      }
+      flen[nsplit] = i - fstart[nsplit];
+      nsplit++;
+    }
+  }
+
+  if( command == 'L' ){
+    return polyline_record(d, command, alt);
+  }
+
+  // Number of alt mode fields needed by each command.
+  switch( command ){
+    case '1': nneed = alt ? 3 : 0; break;
+    case '3': case '4': nneed = alt ? 2 : 0; break;
+    case '6': nneed = alt ? 1 : 0; break;
+    case '7': case '8': nneed = alt ? 4 : 0; break;
+    case 'A': case 'B': case 'C': case 'G': nneed = 1; break;
+    case 'D': case 'H': case 'I': nneed = 2; break;
+    case 'F': nneed = 3; break;
+    default: nneed = 0; break;
+  }
+  if( nneed > 0 && !alt ){
+    // addGraphics() has no split fields to use outside alt mode.
+    return Py_BuildValue("(ils)", REC_GRAPHICS_ERROR, command,
+                         "cannot access local variable 'commandsplit' where it is not associated with a value");
+  }
+  for( k=0; k<nneed; k++ ){
+    if( k+1 >= nsplit ){
+      return Py_BuildValue("(ils)", REC_GRAPHICS_ERROR, command, "list index out of range");
+    }
+    // Colour and width fields are plain floats, everything else alt_float().
+    if( parse_float(seq + fstart[k+1], flen[k+1], !(command == '1' || command == '6'), &v[k], &err) ){
+      goto bad;
+    }
+  }
+
+  switch( command ){
+    case '0':
+    case '5':
+      entry = Py_None;
+      Py_INCREF(entry);
+      break;
+    case '1':
+      if( !alt ){
+        if( parse_fixed(seq, len, 3, 6, 999.0, &v[0], &err) ||
+            parse_fixed(seq, len, 6, 9, 999.0, &v[1], &err) ||
+            parse_fixed(seq, len, 9, 12, 999.0, &v[2], &err) ){
+          goto bad;
+        }
+      }
+      entry = Py_BuildValue("(iddd)", 1, v[0], v[1], v[2]);
+      break;
+    case '2':
+      entry = Py_BuildValue("(ii)", 2, 0);
+      break;
+    case '3':
+    case '4':
+      if( !alt ){
+        if( parse_fixed(seq, len, 3, 7, 9999.0, &v[0], &err) ||
+            parse_fixed(seq, len, 7, 11, 9999.0, &v[1], &err) ){
+          goto bad;
+        }
+      }
+      entry = Py_BuildValue("(idd)", (int)(command - '0'), v[0], v[1]);
+      break;
+    case '6':
+      if( !alt ){
+        if( parse_fixed(seq, len, 3, 6, 99.0, &v[0], &err) ){
+          goto bad;
+        }
+      }
+      entry = Py_BuildValue("(id)", 6, v[0]);
+      break;
+    case '7':
+    case '8':
+      if( alt ){
+        entry = Py_BuildValue("(idddd)", (int)(command - '0'), v[0], v[1], v[2], v[3]);
+      }
+      break;
+    case '9':
+    case 'E':
+      if( alt ){
+        PyObject* s = field_repr(seq + 4, len > 5 ? len - 5 : 0);
+        entry = s ? Py_BuildValue("(iN)", command == '9' ? 9 : 14, s) : NULL;
+      }
+      break;
+    case 'A': entry = Py_BuildValue("(id)", 10, v[0]); break;
+    case 'B': entry = Py_BuildValue("(id)", 11, v[0]); break;
+    case 'C': entry = Py_BuildValue("(id)", 12, v[0]); break;
+    case 'D': entry = Py_BuildValue("(idd)", 13, v[0], v[1]); break;
+    case 'F': entry = Py_BuildValue("(iddd)", 15, v[0], v[1], v[2]); break;
+    case 'G': entry = Py_BuildValue("(id)", 16, v[0]); break;
+    case 'H': entry = Py_BuildValue("(idd)", 17, v[0], v[1]); break;
+    case 'I': entry = Py_BuildValue("(idd)", 18, v[0], v[1]); break;
+    default:
+      break;
+  }
+  if( entry == NULL ){
+    if( PyErr_Occurred() ){
+      return NULL;
+    }
+    entry = Py_None;
+    Py_INCREF(entry);
+  }
+  return Py_BuildValue("(ilN)", REC_GRAPHICS, command, entry);
+
+ bad:
+  if( err == NULL ){
+    return NULL;
+  }
+  return Py_BuildValue("(ilN)", REC_GRAPHICS_ERROR, command, err);
+}
+
+static int escape_char(Decoder* d, PyObject* out, uint32_t ch, uint32_t ich)
+//--------------------------------------------------------------------------
+/// @brief Pass one character to the current escape sequence processor.
+///
+/// @param d Decoder.
+/// @param out Output record list.
+/// @param ch Character as received.
+/// @param ich Character after incharmap.
+/// @return 0 if OK, else -1.
+{
+  int done = 0;
+  int show = 0;
+  int graphics = 0;
+
+  if( grow(&d->seq, &d->seq_cap, d->seq_len + 1) ){
+    return -1;
+  }
+  d->seq[d->seq_len++] = ich;
+
+  if( d->kind == ESC_APL ){
+    if( d->seq_len == 3 ){
+      PyObject* key;
+      PyObject* repl = NULL;
+      uint32_t lower[3];
+      int k;
+      done = 1;
+      for( k=0; k<3; k++ ){
+        lower[k] = (d->seq[k] >= 'A' && d->seq[k] <= 'Z') ? d->seq[k] + 32 : d->seq[k];
+      }
+      key = PyUnicode_FromKindAndData(PyUnicode_4BYTE_KIND, lower, 3);
+      if( key == NULL ){
+        return -1;
+      }
+      if( d->apl_map != NULL ){
+        repl = PyDict_GetItemWithError(d->apl_map, key);
+      }
+      Py_DECREF(key);
+      if( repl != NULL && PyLong_Check(repl) ){
+        uint32_t c = (uint32_t)PyLong_AsUnsignedLong(repl);
+        if( text_add(d, &c, 1) ){
+          return -1;
+        }
+      }
+      else if( PyErr_Occurred() ){
+        return -1;
+      }
+      else{
+        show = 1;
+      }
+    }
+  }
+  else if( d->seq_len == 2 ){
+    // ANSI and Cyber APL graphics sequences must both be ESC[ or @[.
+    if( ch != '[' ){
+      done = 1;
+      show = 1;
+    }
+  }
+  else if( d->seq_len > 2 ){
+    if( d->kind == ESC_ANSI ){
+      switch( ch ){
+        case 'z': case 'Z':
+          graphics = 1;
+          /* fall through */
+        case 'A': case 'B': case 'C': case 'D': case 'E': case 'F': case 'G':
+        case 'H': case 'J': case 'K': case 'S': case 'T': case 'f': case 'm':
+        case 'n': case 's': case 'u': case 'l': case 'h':
+          done = 1;
+          break;
+        default:
+          break;
+      }
+    }
+    else if( ch == '@' ){
+      done = 1;
+      graphics = 1;
+    }
+  }
+
+  if( show ){
+    if( text_add(d, d->seq, d->seq_len) ){
+      return -1;
+    }
+  }
+  if( graphics ){
+    if( text_flush(d, out) ){
+      return -1;
+    }
+    d->last_skip = 0;
+    if( add_record(out, graphics_record(d)) ){
+      return -1;
+    }
+  }
+  if( done ){
+    d->inescape = 0;
+    d->kind = ESC_NONE;
+  }
+  return 0;
+}
+
+static PyObject* Decoder_decode(Decoder* d, PyObject* args, PyObject* kwds)
+//-------------------------------------------------------------------------
+/// @brief decode(data, newlinechar=10, retchar=13, noescapes=False, shownonprint=False)
+///
+/// data may be bytes (decoded as ASCII, as _bytestostr() does) or str.
+///
+/// @return List of records.
+{
+  static char* kwlist[] = {"data", "newlinechar", "retchar", "noescapes", "shownonprint", NULL};
+  PyObject* data;
+  long newlinechar = 10;
+  long retchar = 13;
+  int noescapes = 0;
+  int shownonprint = 0;
+  PyObject* out;
+  const unsigned char* bytes = NULL;
+  int ukind = 0;
+  const void* udata = NULL;
+  Py_ssize_t n;
+  Py_ssize_t i;
+  int not_ascii = 0;
+
+  if( !PyArg_ParseTupleAndKeywords(args, kwds, "O|llpp", kwlist,
+                                   &data, &newlinechar, &retchar, &noescapes, &shownonprint) ){
+    return NULL;
+  }
+  if( PyBytes_Check(data) ){
+    bytes = (const unsigned char*)PyBytes_AS_STRING(data);
+    n = PyBytes_GET_SIZE(data);
+    for( i=0; i<n; i++ ){
+      if( bytes[i] > 127 ){
+        not_ascii = 1;
+        break;
+      }
+    }
+    if( not_ascii ){
+      // _bytestostr() turns anything that is not ASCII into a single space.
+      bytes = (const unsigned char*)" ";
+      n = 1;
+    }
+  }
+  else if( PyUnicode_Check(data) ){
+    if( PyUnicode_READY(data) ){
+      return NULL;
+    }
+    ukind = PyUnicode_KIND(data);
+    udata = PyUnicode_DATA(data);
+    n = PyUnicode_GET_LENGTH(data);
+  }
+  else{
+    PyErr_SetString(PyExc_TypeError, "decode() needs bytes or str");
+    return NULL;
+  }
+
+  out = PyList_New(0);
+  if( out == NULL ){
+    return NULL;
+  }
+  d->text_len = 0;
+  d->last_skip = 0;
+
+  for( i=0; i<n; i++ ){
+    uint32_t ch = bytes ? bytes[i] : (uint32_t)PyUnicode_READ(ukind, udata, i);
+    uint32_t ich = ch;
+    int rec = -1;
+
+    if( ch < 256 ){
+      ich = (uint32_t)d->charmap[ch];
+    }
+    else if( d->charmap_high != NULL ){
+      PyObject* key = PyLong_FromUnsignedLong(ch);
+      PyObject* val = key ? PyDict_GetItemWithError(d->charmap_high, key) : NULL;
+      Py_XDECREF(key);
+      if( val != NULL ){
+        ich = (uint32_t)PyLong_AsUnsignedLong(val);
+      }
+      if( PyErr_Occurred() ){
+        goto fail;
+      }
+    }
+
+    if( ich == (uint32_t)newlinechar ){
+      if( d->suppress_newline ){
+        d->suppress_newline = 0;
+        continue;
+      }
+      rec = REC_NEWLINE;
+    }
+    else if( ich == (uint32_t)retchar ){
+      rec = REC_RETURN;
+    }
+    else if( ich == 7 ){
+      rec = REC_BELL;
+    }
+    else if( ich == 8 ){
+      rec = REC_BACKSPACE;
+    }
+    else if( ich == 9 ){
+      rec = REC_TAB;
+    }
+    else if( ich == 12 ){
+      rec = REC_FORMFEED;
+    }
+    if( rec >= 0 ){
+      if( simple_record(d, out, rec) ){
+        goto fail;
+      }
+      continue;
+    }
+
+    if( noescapes ){
+      d->inescape = 0;
+    }
+    else if( !d->inescape && ch < 256 && d->esc_kind[ch] != ESC_NONE ){
+      d->inescape = 1;
+      d->kind = d->esc_kind[ch];
+      d->seq_len = 0;
+    }
+    if( d->inescape ){
+      if( escape_char(d, out, ch, ich) ){
+        goto fail;
+      }
+    }
+    else if( shownonprint || is_printable(ch) ){
+      if( text_add(d, &ich, 1) ){
+        goto fail;
+      }
+    }
+    else{
+      if( simple_record(d, out, REC_SKIP) ){
+        goto fail;
+      }
+    }
+  }
+  if( text_flush(d, out) ){
+    goto fail;
+  }
+  return out;
+
+ fail:
+  Py_DECREF(out);
+  return NULL;
+}
+
+static PyObject* Decoder_set_charmap(Decoder* d, PyObject* arg)
+//-------------------------------------------------------------
+/// @brief set_charmap(dict): Use GTermWidget.incharmap (code -> code). None for no mapping.
+{
+  PyObject* key;
+  PyObject* val;
+  Py_ssize_t pos = 0;
+  int i;
+  for( i=0; i<256; i++ ){
+    d->charmap[i] = i;
+  }
+  Py_CLEAR(d->charmap_high);
+  if( arg == Py_None ){
+    Py_RETURN_NONE;
+  }
+  if( !PyDict_Check(arg) ){
+    PyErr_SetString(PyExc_TypeError, "set_charmap() needs a dict");
+    return NULL;
+  }
+  while( PyDict_Next(arg, &pos, &key, &val) ){
+    long k = PyLong_AsLong(key);
+    long v = PyLong_AsLong(val);
+    if( PyErr_Occurred() ){
+      return NULL;
+    }
+    if( k >= 0 && k < 256 ){
+      d->charmap[k] = (int32_t)v;
+    }
+    else{
+      if( d->charmap_high == NULL && (d->charmap_high = PyDict_New()) == NULL ){
+        return NULL;
+      }
+      if( PyDict_SetItem(d->charmap_high, key, val) ){
+        return NULL;
+      }
+    }
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject* Decoder_set_escapes(Decoder* d, PyObject* arg)
+//-------------------------------------------------------------
+/// @brief set_escapes([(start_char, kind), ...]): Escape sequence processors, in priority order.
+{
+  Py_ssize_t n;
+  Py_ssize_t i;
+  PyObject* seq = PySequence_Fast(arg, "set_escapes() needs a sequence");
+  if( seq == NULL ){
+    return NULL;
+  }
+  memset(d->esc_kind, ESC_NONE, sizeof(d->esc_kind));
+  n = PySequence_Fast_GET_SIZE(seq);
+  for( i=0; i<n; i++ ){
+    PyObject* ec;
+    int kind;
+    if( !PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, i), "Ui", &ec, &kind) ){
+      Py_DECREF(seq);
+      return NULL;
+    }
+    if( PyUnicode_GET_LENGTH(ec) == 1 && PyUnicode_READ_CHAR(ec, 0) < 256 ){
+      Py_UCS4 c = PyUnicode_READ_CHAR(ec, 0);
+      // With two processors for one character, checkEscapeStart() ends up using the last.
+      d->esc_kind[c] = (unsigned char)kind;
+    }
+  }
+  Py_DECREF(seq);
+  d->inescape = 0;
+  d->kind = ESC_NONE;
+  Py_RETURN_NONE;
+}
+
+static PyObject* Decoder_reset(Decoder* d, PyObject* Py_UNUSED(ignored))
+//----------------------------------------------------------------------
+/// @brief reset(): Leave any escape sequence and forget the suppress newline flag.
+{
+  d->inescape = 0;
+  d->kind = ESC_NONE;
+  d->seq_len = 0;
+  d->suppress_newline = 0;
+  Py_RETURN_NONE;
+}
+
+static int Decoder_init(Decoder* d, PyObject* args, PyObject* kwds)
+//-----------------------------------------------------------------
+/// @brief Decoder(apl_map=None): apl_map is cyber_apl_in_map.
+{
+  static char* kwlist[] = {"apl_map", NULL};
+  PyObject* apl_map = Py_None;
+  int i;
+  if( !PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &apl_map) ){
+    return -1;
+  }
+  if( apl_map != Py_None && !PyDict_Check(apl_map) ){
+    PyErr_SetString(PyExc_TypeError, "apl_map must be a dict");
+    return -1;
+  }
+  for( i=0; i<256; i++ ){
+    d->charmap[i] = i;
+  }
+  Py_CLEAR(d->apl_map);
+  if( apl_map != Py_None ){
+    Py_INCREF(apl_map);
+    d->apl_map = apl_map;
+  }
+  return 0;
+}
+
+static void Decoder_dealloc(Decoder* d)
+//-------------------------------------
+/// @brief Free a Decoder.
+{
+  Py_CLEAR(d->charmap_high);
+  Py_CLEAR(d->apl_map);
+  free(d->seq);
+  free(d->text);
+  Py_TYPE(d)->tp_free((PyObject*)d);
+}
+
+static PyObject* Decoder_get_suppress(Decoder* d, void* closure)
+//--------------------------------------------------------------
+/// @brief The suppress next newline flag, shared with GTermWidget.
+{
+  (void)closure;
+  return PyBool_FromLong(d->suppress_newline);
+}
+
+static int Decoder_set_suppress(Decoder* d, PyObject* value, void* closure)
+//-------------------------------------------------------------------------
+/// @brief Set the suppress next newline flag.
+{
+  (void)closure;
+  int yes = value ? PyObject_IsTrue(value) : 0;
+  if( yes < 0 ){
+    return -1;
+  }
+  d->suppress_newline = yes;
+  return 0;
+}
+
+static PyObject* Decoder_get_inescape(Decoder* d, void* closure)
+//--------------------------------------------------------------
+/// @brief True part way through an escape sequence.
+{
+  (void)closure;
+  return PyBool_FromLong(d->inescape);
+}
+
+static PyMethodDef Decoder_methods[] = {
+  {"decode", (PyCFunction)(void(*)(void))Decoder_decode, METH_VARARGS | METH_KEYWORDS,
+   "decode(data, newlinechar=10, retchar=13, noescapes=False, shownonprint=False) -> list of records"},
+  {"set_charmap", (PyCFunction)Decoder_set_charmap, METH_O, "set_charmap(dict or None)"},
+  {"set_escapes", (PyCFunction)Decoder_set_escapes, METH_O, "set_escapes([(start_char, kind), ...])"},
+  {"reset", (PyCFunction)Decoder_reset, METH_NOARGS, "reset()"},
+  {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef Decoder_getset[] = {
+  {"suppress_newline", (getter)Decoder_get_suppress, (setter)Decoder_set_suppress,
+   "Throw away the next newline.", NULL},
+  {"inescape", (getter)Decoder_get_inescape, NULL, "In an escape sequence.", NULL},
+  {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject DecoderType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name = "gtdecode.Decoder",
+  .tp_basicsize = sizeof(Decoder),
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_doc = "GTerm host output decoder.",
+  .tp_new = PyType_GenericNew,
+  .tp_init = (initproc)Decoder_init,
+  .tp_dealloc = (destructor)Decoder_dealloc,
+  .tp_methods = Decoder_methods,
+  .tp_getset = Decoder_getset,
+};
+
+static struct PyModuleDef gtdecode_module = {
+  PyModuleDef_HEAD_INIT,
+  .m_name = "gtdecode",
+  .m_doc = "Native host output decoder for GTerm.",
+  .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_gtdecode(void)
+//----------------------------------
+/// @brief Module initialization.
+{
+  PyObject* m;
+  if( PyType_Ready(&DecoderType) < 0 ){
+    return NULL;
+  }
+  m = PyModule_Create(&gtdecode_module);
+  if( m == NULL ){
+    return NULL;
+  }
+  Py_INCREF(&DecoderType);
+  if( PyModule_AddObject(m, "Decoder", (PyObject*)&DecoderType) < 0 ){
+    Py_DECREF(&DecoderType);
+    Py_DECREF(m);
+    return NULL;
+  }
+  PyModule_AddIntConstant(m, "ESC_APL", ESC_APL);
+  PyModule_AddIntConstant(m, "ESC_ANSI", ESC_ANSI);
+  PyModule_AddIntConstant(m, "ESC_GRAPHICS", ESC_GRAPHICS);
+  PyModule_AddIntConstant(m, "TEXT", REC_TEXT);
+  PyModule_AddIntConstant(m, "SKIP", REC_SKIP);
+  PyModule_AddIntConstant(m, "NEWLINE", REC_NEWLINE);
+  PyModule_AddIntConstant(m, "RETURN", REC_RETURN);
+  PyModule_AddIntConstant(m, "BELL", REC_BELL);
+  PyModule_AddIntConstant(m, "BACKSPACE", REC_BACKSPACE);
+  PyModule_AddIntConstant(m, "TAB", REC_TAB);
+  PyModule_AddIntConstant(m, "FORMFEED", REC_FORMFEED);
+  PyModule_AddIntConstant(m, "GRAPHICS", REC_GRAPHICS);
+  PyModule_AddIntConstant(m, "GRAPHICS_ERROR", REC_GRAPHICS_ERROR);
+  PyModule_AddIntConstant(m, "POLYLINE", REC_POLYLINE);
+  return m;
+}
@@ -35,11 +35,16 @@ import sys
 import platform
 try:
     from OpenGL.GL import GL_ALPHA
+    from OpenGL.GL import GL_ARRAY_BUFFER
     from OpenGL.GL import GL_BGRA
     from OpenGL.GL import GL_BLEND
     from OpenGL.GL import GL_CLAMP
     from OpenGL.GL import GL_COLOR_BUFFER_BIT
+    from OpenGL.GL import GL_DYNAMIC_DRAW
+    from OpenGL.GL import GL_FALSE
     from OpenGL.GL import GL_FLAT
+    from OpenGL.GL import GL_FLOAT
+    from OpenGL.GL import GL_FRAGMENT_SHADER
     from OpenGL.GL import GL_LINEAR
     from OpenGL.GL import GL_LINEAR_MIPMAP_LINEAR
     from OpenGL.GL import GL_LINES
@@ -52,41 +57,69 @@ try:
     from OpenGL.GL import GL_PROJECTION
     from OpenGL.GL import GL_QUADS
     from OpenGL.GL import GL_RGB8
+    from OpenGL.GL import GL_SCISSOR_TEST
     from OpenGL.GL import GL_SRC_ALPHA
     from OpenGL.GL import GL_TEXTURE_2D
+    from OpenGL.GL import GL_TEXTURE_COORD_ARRAY
     from OpenGL.GL import GL_TEXTURE_ENV
     from OpenGL.GL import GL_TEXTURE_ENV_MODE
     from OpenGL.GL import GL_TEXTURE_MAG_FILTER
     from OpenGL.GL import GL_TEXTURE_MIN_FILTER
     from OpenGL.GL import GL_TEXTURE_WRAP_S
     from OpenGL.GL import GL_TEXTURE_WRAP_T
+    from OpenGL.GL import GL_TRIANGLES
     from OpenGL.GL import GL_UNPACK_ALIGNMENT
+    from OpenGL.GL import GL_UNPACK_ROW_LENGTH
+    from OpenGL.GL import GL_UNPACK_SKIP_PIXELS
     from OpenGL.GL import GL_UNSIGNED_BYTE
     from OpenGL.GL import GL_UNSIGNED_INT_8_8_8_8_REV
+    from OpenGL.GL import GL_VERTEX_ARRAY
+    from OpenGL.GL import GL_VERTEX_SHADER
     from OpenGL.GL import glBegin
+    from OpenGL.GL import glBindBuffer
     from OpenGL.GL import glBindTexture
     from OpenGL.GL import glBlendFunc
+    from OpenGL.GL import glBufferData
+    from OpenGL.GL import glBufferSubData
     from OpenGL.GL import glClear
     from OpenGL.GL import glClearColor
     from OpenGL.GL import glColor4f
     from OpenGL.GL import glDisable
+    from OpenGL.GL import glDisableClientState
+    from OpenGL.GL import glDisableVertexAttribArray
+    from OpenGL.GL import glDrawArrays
     from OpenGL.GL import glEnable
+    from OpenGL.GL import glEnableClientState
+    from OpenGL.GL import glEnableVertexAttribArray
     from OpenGL.GL import glEnd
     from OpenGL.GL import glFlush
+    from OpenGL.GL import glGenBuffers
     from OpenGL.GL import glGenTextures
+    from OpenGL.GL import glGetAttribLocation
+    from OpenGL.GL import glGetUniformLocation
     from OpenGL.GL import glLineWidth
     from OpenGL.GL import glLoadIdentity
     from OpenGL.GL import glMatrixMode
     from OpenGL.GL import glOrtho
     from OpenGL.GL import glPixelStorei
     from OpenGL.GL import glRectf
+    from OpenGL.GL import glScissor
     from OpenGL.GL import glShadeModel
     from OpenGL.GL import glTexCoord2f
+    from OpenGL.GL import glTexCoordPointer
     from OpenGL.GL import glTexEnvi
     from OpenGL.GL import glTexImage2D
     from OpenGL.GL import glTexParameterf
+    from OpenGL.GL import glTexSubImage2D
+    from OpenGL.GL import glUniform1f
+    from OpenGL.GL import glUniform2f
+    from OpenGL.GL import glUniform4f
+    from OpenGL.GL import glUseProgram
     from OpenGL.GL import glVertex2f
+    from OpenGL.GL import glVertexAttribPointer
+    from OpenGL.GL import glVertexPointer
     from OpenGL.GL import glViewport
+    from OpenGL.GL import shaders
     
     from OpenGL.GLU import gluBuild2DMipmaps
 except ImportError:
@@ -100,6 +133,7 @@ try:
     from PySide6.QtCore import Qt
     from PySide6.QtCore import Signal
     from PySide6.QtCore import QObject
+    from PySide6.QtCore import QTimer
 
     from PySide6.QtGui import QIcon
 
@@ -156,6 +190,17 @@ import os
 import shutil
 import math
 import contextlib
+import ctypes
+import struct
+import concurrent.futures
+import resource
+import signal
+import mmap
+import marshal
+import bisect
+import array
+import collections
+import errno
 
 try:
     import cairo
@@ -176,6 +221,15 @@ except ImportError:
     print("GTerm needs Clipman.")
     sys.exit(9)
 
+# Optional native host output decoder built from extras/gtdecode.
+# Builds from before the polyline graphics command are not used.
+try:
+    import gtdecode
+    if not hasattr(gtdecode,'POLYLINE'):
+        gtdecode = None
+except ImportError:
+    gtdecode = None
+
 try:
     from githashvalue import _current_git_hash
 except ImportError:
@@ -907,6 +961,72 @@ def _bytestostr_ifnot( ccharpin ):
     else:
         return _bytestostr(ccharpin)            
 
+def connect_host(host, port, timeout=None, delay=0.25):
+    """
+    Connect a TCP socket to a host, trying all of its addresses (IPv6 and IPv4) in parallel,
+    "Happy Eyeballs" style (RFC 8305). The address families take turns, and a connection to
+    the next address is started every delay seconds while none has succeeded, or at once when
+    one fails. The first to connect is returned (blocking) and the others are closed. So an
+    address that does not answer costs delay seconds rather than a TCP timeout.
+    Raises OSError if no address connects within timeout seconds (None for no limit).
+    """
+    infos = socket.getaddrinfo(host, port, socket.AF_UNSPEC, socket.SOCK_STREAM)
+    first = [info for info in infos if info[0] == infos[0][0]]
+    other = [info for info in infos if info[0] != infos[0][0]]
+    order = []
+    for i in range(max(len(first),len(other))):
+        order.extend(first[i:i+1])
+        order.extend(other[i:i+1])
+    deadline = None if timeout == None else time.monotonic() + timeout
+    next_start = time.monotonic()
+    error = None
+    pending = []
+    sel = selectors.DefaultSelector()
+    try:
+        while True:
+            now = time.monotonic()
+            if deadline != None and now >= deadline:
+                raise TimeoutError('Timed out connecting to {0} port {1}.'.format(host,port))
+            # Start the next attempt when it is due, or now if nothing else is in progress.
+            if order and (not pending or now >= next_start):
+                (family, socktype, proto, canonname, addr) = order.pop(0)
+                try:
+                    s = socket.socket(family, socktype, proto)
+                except OSError as e:
+                    error = e
+                    continue
+                s.setblocking(False)
+                err = s.connect_ex(addr)
+                if err in (0, errno.EINPROGRESS):
+                    sel.register(s, selectors.EVENT_WRITE)
+                    pending.append(s)
+                    next_start = now + delay
+                else:
+                    s.close()
+                    error = OSError(err, os.strerror(err))
+                continue
+            if not pending:
+                raise error if error != None else OSError('No addresses for {0}.'.format(host))
+            # Wait for an attempt to finish, the next one to be due or the time to run out.
+            wait = None if deadline == None else deadline - now
+            if order:
+                wait = next_start - now if wait == None else min(wait, next_start - now)
+            for (key, mask) in sel.select(wait):
+                s = key.fileobj
+                err = s.getsockopt(socket.SOL_SOCKET, socket.SO_ERROR)
+                sel.unregister(s)
+                pending.remove(s)
+                if err == 0:
+                    s.setblocking(True)
+                    return s
+                s.close()
+                error = OSError(err, os.strerror(err))
+                next_start = now
+    finally:
+        for s in pending:
+            s.close()
+        sel.close()
+
 #################
 # XTelnet CLASS #
 #################
@@ -921,6 +1041,9 @@ class XTelnet(Telnet,object):
       more useful than line-at-a-time (usually). Most systems (default, anyway)
       echo characters (full duplex) which gives unwanted results with line-at-a-time.
     - interact_ch_input() does blocking reads only from the server.
+    - read_bulk() reads large blocks and only processes Telnet commands byte
+      by byte, rather than every character received.
+    - open() tries all the host's addresses, IPv6 and IPv4, in parallel (see connect_host()).
     """
 
     def __init__(self, host=None, port=0, timeout=socket._GLOBAL_DEFAULT_TIMEOUT):
@@ -929,6 +1052,12 @@ class XTelnet(Telnet,object):
         self.old_settings = None
         self.eof_func = None
         self.received_function = None
+        self.raw_received_function = None
+        self.bulk_size = 65536
+        # Statistics: recv() calls with data, bytes received and Telnet commands.
+        self.stat_recv_calls = 0
+        self.stat_bytes_in = 0
+        self.stat_commands = 0
         self.set_option_negotiation_callback(negot)
 
     def __del__(self):
@@ -942,6 +1071,21 @@ class XTelnet(Telnet,object):
             pass
         self.close()
 
+    def open(self, host, port=0, timeout=socket._GLOBAL_DEFAULT_TIMEOUT):
+        """
+        Connect to a host with connect_host(). The timeout only limits how long connecting
+        may take: reads from the connection wait for as long as they need to.
+        """
+        self.eof = 0
+        if not port:
+            port = TELNET_PORT
+        self.host = host
+        self.port = port
+        self.timeout = timeout
+        if timeout is socket._GLOBAL_DEFAULT_TIMEOUT:
+            timeout = None
+        self.sock = connect_host(host, port, timeout)
+
     def set_eof_func(self,func):
         """
         Set a function to call when the remote server closes the connection.
@@ -1014,11 +1158,71 @@ class XTelnet(Telnet,object):
                 bytestring = getch.encode('ASCII')
                 self.write(bytestring)
 
+    def read_bulk(self):
+        """
+        Read whatever the server has sent with one large recv(), blocking if there is
+        nothing yet, and return it with Telnet commands removed, as read_eager() would.
+        The data as received, Telnet commands included, goes to any function set with
+        set_raw_received_function() first. Raise EOFError when the connection is closed.
+        """
+        buf = self.sock.recv(self.bulk_size)
+        self.msg("recv %r", buf)
+        if not buf:
+            self.eof = 1
+            raise EOFError('telnet connection closed')
+        self.stat_recv_calls += 1
+        self.stat_bytes_in += len(buf)
+        if self.raw_received_function != None:
+            self.raw_received_function(buf)
+        return self.process_bulk(buf)
+
+    def process_bulk(self,buf):
+        """
+        Remove Telnet commands from buf. The runs of data between IAC bytes are found with
+        bytes.find() and passed on whole. Only IAC sequences (rare after connecting) are
+        handed to process_rawq(), one byte at a time, so its state carries over correctly
+        between calls.
+        """
+        out = []
+        pos = 0
+        n = len(buf)
+        while pos < n:
+            if not (self.iacseq or self.sb):
+                i = buf.find(IAC, pos)
+                if i < 0:
+                    out.append(buf[pos:] if pos > 0 else buf)
+                    break
+                if i > pos:
+                    out.append(buf[pos:i])
+                pos = i
+                self.stat_commands += 1
+            self.rawq = buf[pos:pos+1]
+            self.irawq = 0
+            self.process_rawq()
+            pos += 1
+            if self.cookedq:
+                out.append(self.cookedq)
+                self.cookedq = b''
+        if len(out) == 1:
+            data = out[0]
+        else:
+            data = b''.join(out)
+        # process_rawq() drops NUL and XON.
+        if (theNULL in data) or (b"\021" in data):
+            data = data.translate(None, theNULL + b"\021")
+        return data
+
     def set_data_received_function(self,data_received):
         '''
         Set function to call when data is received from the server.
         '''
         self.received_function = data_received
+
+    def set_raw_received_function(self,raw_received):
+        '''
+        Set function to call with data from the server before Telnet commands are removed.
+        '''
+        self.raw_received_function = raw_received
         
     def interact_ch_input(self):
         """
@@ -1033,7 +1237,7 @@ class XTelnet(Telnet,object):
                 return # Something using XTelnet has probably closed the connection. Ugly, but ...
             if self in rfd:
                 try:
-                    text = self.read_eager() #read_eager()
+                    text = self.read_bulk() #read_eager()
                 except EOFError:
                     if self.eof_func != None:
                         self.eof_func()
@@ -1041,6 +1245,8 @@ class XTelnet(Telnet,object):
                 except Exception as e:
                     print('Unexpected exception reading from server (client slept?):',e)
                     print('Abandoning connection.')
+                    if self.eof_func != None:
+                        self.eof_func()
                     break
                 if text:
                     if self.received_function != None:
@@ -1190,6 +1396,112 @@ def get_application_file_name( appname, filename, exttest=None ):
     else:
         return loc
 
+
+#####################
+# Asset Cache CLASS #
+#####################
+
+class AssetCache(object):
+    """
+    A binary cache of what GTerm makes from a character set, virtual keyboard or Unicode
+    map's .jsn and .png files: the dictionaries built from the JSON and the decoded 8 bit
+    images. Parsing those and decoding the PNGs is most of GTerm's start up time on a slow
+    machine. The cache file is memory mapped and the images are used in place.
+    It is kept in ~/.cache/gterm and rebuilt when any source file's size or modification
+    time changes, or the Python version (for marshal) or cache format does.
+    File layout: header, marshalled description, then the image pixels.
+    """
+    file_magic = b'GTERMAC1'
+    file_version = 1
+    file_header = struct.Struct('<8sII')
+    pixel_align = 64
+
+    def __init__(self, name, sources):
+        cachehome = os.environ.get('XDG_CACHE_HOME', os.path.join(os.path.expanduser('~'),'.cache'))
+        self.path = os.path.join(cachehome,'gterm',os.path.basename(name)+'.gtc')
+        self.sources = sources
+        self.data = None
+        self.images = {}
+        self.mm = None
+
+    def stamp(self):
+        """
+        What the cache was made from: the Python version and each source file's name, size and time.
+        """
+        stamp = [tuple(sys.version_info[0:2])]
+        for filename in self.sources:
+            st = os.stat(filename)
+            stamp.append((os.path.abspath(filename), st.st_size, st.st_mtime_ns))
+        return stamp
+
+    def pixelBase(self, metalen):
+        """
+        Where the image pixels start, after a description metalen bytes long.
+        """
+        end = self.file_header.size + metalen
+        return (end + self.pixel_align - 1) // self.pixel_align * self.pixel_align
+
+    def load(self):
+        """
+        Map the cache file. Sets data and images and returns True if it is up to date,
+        else returns False.
+        """
+        try:
+            with open(self.path,'rb') as f:
+                mm = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        except Exception:
+            return False
+        try:
+            (magic,version,metalen) = self.file_header.unpack_from(mm,0)
+            if (magic != self.file_magic) or (version != self.file_version):
+                return False
+            meta = marshal.loads(mm[self.file_header.size:self.file_header.size+metalen])
+            if meta['stamp'] != self.stamp():
+                return False
+            base = self.pixelBase(metalen)
+            images = {}
+            for name in meta['images']:
+                (w,h,offset) = meta['images'][name]
+                pixels = memoryview(mm)[base+offset:base+offset+w*h]
+                images[name] = Image.frombuffer('L',(w,h),pixels,'raw','L',0,1)
+        except Exception as e:
+            print('Ignoring unreadable cache file:',self.path)
+            print('... Reason:',e)
+            return False
+        self.mm = mm
+        self.data = meta['data']
+        self.images = images
+        return True
+
+    def save(self, data, images):
+        """
+        Write a new cache file. data is anything marshal can write, images a dictionary of
+        8 bit ('L') PIL images. Failure is not fatal: GTerm just starts more slowly next time.
+        """
+        try:
+            layout = {}
+            pixels = []
+            offset = 0
+            for name in images:
+                img = images[name].convert('L')
+                layout[name] = (img.size[0],img.size[1],offset)
+                pixels.append(img.tobytes())
+                offset += len(pixels[-1])
+            meta = marshal.dumps({'stamp':self.stamp(), 'data':data, 'images':layout})
+            base = self.pixelBase(len(meta))
+            os.makedirs(os.path.dirname(self.path), exist_ok=True)
+            tmppath = '{0}.{1}'.format(self.path,os.getpid())
+            with open(tmppath,'wb') as f:
+                f.write(self.file_header.pack(self.file_magic,self.file_version,len(meta)))
+                f.write(meta)
+                f.write(bytes(base - self.file_header.size - len(meta)))
+                for p in pixels:
+                    f.write(p)
+            os.replace(tmppath,self.path)
+        except Exception as e:
+            print('Could not write cache file:',self.path)
+            print('... Reason:',e)
+
 #######################################################################
 # Things to get Caps Lock key state at startup and on gaining focus.  #
 # Qt does not even try to do this.                                    #
@@ -1222,6 +1534,779 @@ else:
     sys.exit(33)
 
 
+#########################
+# Scrollback Ring CLASS #
+#########################
+
+class ScrollbackRing(object):
+    """
+    The text scroll buffer. A fixed number of lines held as rows of character codes in
+    one preallocated uint16 array, used as a ring: adding a line when it is full
+    overwrites the oldest one, so nothing is moved or reallocated.
+    Lines longer than a row, or with codes that do not fit in 16 bits, are kept
+    as lists in a dictionary indexed by ring slot instead.
+    Indexing returns line j (0 is the oldest) as a list of character codes.
+    Each line also has a number (added - count + j) that stays the same while it is
+    in the ring. Together with the generation count, which clear() and resize()
+    change, this lets renderers keep what they made from a line.
+    """
+    def __init__(self, capacity=1040, width=160):
+        self.width = width
+        self.generation = 0
+        self.allocate(capacity)
+
+    def allocate(self, capacity):
+        """
+        Make empty storage for capacity lines.
+        """
+        self.capacity = max(1, int(capacity))
+        self.rows = numpy.zeros((self.capacity,self.width), dtype=numpy.uint16)
+        self.lengths = numpy.zeros(self.capacity, dtype=numpy.int32)
+        self.long = {}
+        self.start = 0
+        self.count = 0
+        self.added = 0
+        self.generation += 1
+
+    def __len__(self):
+        """
+        Number of lines.
+        """
+        return self.count
+
+    def __getitem__(self, j):
+        """
+        Line j as a list of character codes.
+        """
+        if j < 0:
+            j += self.count
+        if j < 0 or j >= self.count:
+            raise IndexError('scrollback index out of range')
+        slot = (self.start + j) % self.capacity
+        line = self.long.get(slot)
+        if line is not None:
+            return line
+        return self.rows[slot,0:int(self.lengths[slot])].tolist()
+
+    def append(self, line):
+        """
+        Add line (a list of character codes) as the newest line, losing the oldest if full.
+        """
+        if self.count < self.capacity:
+            slot = (self.start + self.count) % self.capacity
+            self.count += 1
+        else:
+            slot = self.start
+            self.start = (self.start + 1) % self.capacity
+        n = len(line)
+        if (n > self.width) or (n > 0 and max(line) > 0xffff):
+            self.long[slot] = list(line)
+        else:
+            if self.long:
+                self.long.pop(slot, None)
+            if n > 0:
+                self.rows[slot,0:n] = line
+        self.lengths[slot] = n
+        self.added += 1
+
+    def clear(self):
+        """
+        Remove all lines. The storage is kept for re-use.
+        """
+        self.long = {}
+        self.start = 0
+        self.count = 0
+        self.added = 0
+        self.generation += 1
+
+    def resize(self, capacity):
+        """
+        Change the number of lines held, keeping as many of the newest lines as fit.
+        """
+        keep = [self[j] for j in range(max(0, self.count - int(capacity)), self.count)]
+        self.allocate(capacity)
+        for line in keep:
+            self.append(line)
+
+
+##########################
+# Scrollback Index CLASS #
+##########################
+
+class ScrollbackIndex(object):
+    """
+    An n-gram index of the lines in a ScrollbackRing, for finding text in a long scrollback
+    in milliseconds. For each sequence of one to three characters it keeps, in order, the
+    numbers of the blocks of block_lines lines (by line number, see ScrollbackRing) that
+    contain it, as an array of ints. Letters are indexed and matched ignoring case.
+    GTermWidget.indexScrollback() runs on a timer and indexes newly added lines a chunk
+    at a time (update() with a line limit), so indexing stays out of the way of receiving
+    text. find() only has to index whatever the timer has not reached yet. Blocks that
+    have left the ring are skipped, and dropped from the index once a ring full of lines
+    has gone.
+    """
+    block_shift = 4
+    block_lines = 1 << block_shift
+    fold = {c: c - 32 for c in range(ord('a'), ord('z')+1)}
+
+    def __init__(self, ring):
+        self.ring = ring
+        self.reset()
+
+    def reset(self):
+        """
+        Forget everything. The lines in the ring are indexed by the next update().
+        """
+        self.generation = self.ring.generation
+        self.postings = {}
+        self.indexed = self.ring.added - len(self.ring)
+        self.pruned = self.indexed
+
+    def behind(self):
+        """
+        True if there are lines still to be indexed.
+        """
+        return (self.ring.generation != self.generation) or (self.indexed < self.ring.added)
+
+    def foldText(self, codes):
+        """
+        Character codes as a string to match, with letters in upper case.
+        """
+        return ''.join(map(chr, codes)).translate(self.fold)
+
+    def update(self, limit=None):
+        """
+        Index the lines added since the last update (or about limit of them) and drop
+        lines that have gone. Call with the screen lock held.
+        """
+        ring = self.ring
+        if ring.generation != self.generation:
+            self.reset()
+        first = ring.added - len(ring)
+        n = max(self.indexed, first)
+        if limit is not None:
+            end_at = min(ring.added, n + limit)
+        else:
+            end_at = ring.added
+        while n < end_at:
+            # All the n-grams of the rest of this block of lines, then one entry for each.
+            b = n >> self.block_shift
+            end = min(ring.added, (b + 1) << self.block_shift)
+            grams = set()
+            for t in map(self.foldText, (ring[i - first] for i in range(n, end))):
+                grams.update(t)
+                grams.update(map(''.join, zip(t, t[1:])))
+                grams.update(map(''.join, zip(t, t[1:], t[2:])))
+            for g in grams:
+                lst = self.postings.get(g)
+                if lst is None:
+                    self.postings[g] = array.array('I', [b])
+                elif lst[-1] != b:
+                    lst.append(b)
+            n = end
+        self.indexed = n
+        if first - self.pruned > ring.capacity:
+            firstblock = first >> self.block_shift
+            for g in list(self.postings.keys()):
+                lst = self.postings[g]
+                k = bisect.bisect_left(lst, firstblock)
+                if k == len(lst):
+                    del self.postings[g]
+                elif k > 0:
+                    del lst[:k]
+            self.pruned = first
+
+    def find(self, query, before):
+        """
+        Return the number of the newest line before line number before that contains
+        query (a list of character codes), or None.
+        Call with the screen lock held.
+        """
+        self.update()
+        ring = self.ring
+        q = self.foldText(query)
+        first = ring.added - len(ring)
+        last = min(before, ring.added) - 1
+        if (len(q) == 0) or (last < first):
+            return None
+        # Walk back through the blocks holding the rarest n-gram of the query, skipping
+        # any that do not hold all its others, and look at the lines in the rest.
+        lists = []
+        for g in {q[i:i+3] for i in range(max(1, len(q)-2))}:
+            lst = self.postings.get(g)
+            if lst is None:
+                return None
+            lists.append(lst)
+        lists.sort(key=len)
+        rarest = lists[0]
+        firstblock = first >> self.block_shift
+        k = bisect.bisect_right(rarest, last >> self.block_shift) - 1
+        while (k >= 0) and (rarest[k] >= firstblock):
+            b = rarest[k]
+            k -= 1
+            have = True
+            for lst in lists[1:]:
+                i = bisect.bisect_left(lst, b)
+                if (i == len(lst)) or (lst[i] != b):
+                    have = False
+                    break
+            if not have:
+                continue
+            top = min(last, (b << self.block_shift) + self.block_lines - 1)
+            bottom = max(first, b << self.block_shift)
+            for n in range(top, bottom-1, -1):
+                if q in self.foldText(ring[n - first]):
+                    return n
+        return None
+
+
+###############################
+# Graphics Display List CLASS #
+###############################
+
+class GraphicsDisplayList(object):
+    """
+    The graphics command buffer. Held as a struct of arrays: an opcode array and
+    four float32 argument arrays, grown by doubling, so appending a command makes
+    no Python objects and render passes can work on whole runs of commands with numpy.
+    Strings for text commands (9 and 14) are kept in a list, indexed by the first argument.
+    Indexing returns the command as the tuple GTerm used to keep, e.g. (4, x, y).
+    """
+    # Number of arguments for each opcode.
+    nargs = {1:3, 2:1, 3:2, 4:2, 6:1, 7:4, 8:4, 10:1, 11:1, 12:1, 13:2, 15:3, 16:1, 17:2, 18:2}
+    # Display list file header: magic, version, number of commands, number of strings.
+    file_magic = b'GTERMGDL'
+    file_version = 1
+    file_header = struct.Struct('<8sIII')
+    # Runs of draws shorter than this are always drawn in full.
+    lod_min_points = 1024
+
+    def __init__(self, capacity=4096):
+        self.ops = numpy.zeros(capacity, dtype=numpy.uint8)
+        self.args = numpy.zeros((4,capacity), dtype=numpy.float32)
+        self.strings = []
+        self.n = 0
+        self.generation = 0
+        self.lod_levels = {}
+        self.lod_lock = threading.Lock()
+
+    def __len__(self):
+        """
+        Number of commands.
+        """
+        return self.n
+
+    def __getitem__(self, i):
+        """
+        Command i as a tuple.
+        """
+        if i < 0:
+            i += self.n
+        if i < 0 or i >= self.n:
+            raise IndexError('display list index out of range')
+        op = int(self.ops[i])
+        if op == 9 or op == 14:
+            return (op, self.strings[int(self.args[0,i])])
+        if op == 2:
+            return (2, 0)
+        return (op,) + tuple(self.args[0:self.nargs.get(op,0),i].tolist())
+
+    def clear(self):
+        """
+        Remove all commands. The arrays are kept for re-use.
+        The generation count tells renderers that what they drew has gone.
+        """
+        self.n = 0
+        self.strings = []
+        self.lod_levels = {}
+        self.generation += 1
+
+    def grow(self):
+        """
+        Double the capacity.
+        """
+        capacity = 2 * len(self.ops)
+        ops = numpy.zeros(capacity, dtype=numpy.uint8)
+        ops[:self.n] = self.ops[:self.n]
+        args = numpy.zeros((4,capacity), dtype=numpy.float32)
+        args[:,:self.n] = self.args[:,:self.n]
+        self.ops = ops
+        self.args = args
+
+    def append(self, op, a=0.0, b=0.0, c=0.0, d=0.0):
+        """
+        Add command op with up to four numeric arguments.
+        """
+        i = self.n
+        if i == len(self.ops):
+            self.grow()
+        self.ops[i] = op
+        self.args[:,i] = (a, b, c, d)
+        self.n = i + 1
+
+    def append_text(self, op, text):
+        """
+        Add text command op with its string.
+        """
+        self.strings.append(text)
+        self.append(op, len(self.strings) - 1)
+
+    def append_polyline(self, xs, ys):
+        """
+        Add a move to (xs[0],ys[0]) and draws to each of the other points.
+        """
+        k = len(xs)
+        if k == 0:
+            return
+        i = self.n
+        while i + k > len(self.ops):
+            self.grow()
+        self.ops[i] = 3
+        self.ops[i+1:i+k] = 4
+        self.args[0,i:i+k] = xs
+        self.args[1,i:i+k] = ys
+        self.args[2:4,i:i+k] = 0.0
+        self.n = i + k
+
+    def append_tuple(self, cmd):
+        """
+        Add a command given as a tuple, as made by the native decoder.
+        """
+        if cmd[0] == 9 or cmd[0] == 14:
+            self.append_text(cmd[0], cmd[1])
+        else:
+            self.append(*cmd)
+
+    def copy(self):
+        """
+        Return a snapshot of the commands, e.g. for rendering on another thread.
+        """
+        snapshot = GraphicsDisplayList(max(1,self.n))
+        snapshot.ops[:self.n] = self.ops[:self.n]
+        snapshot.args[:,:self.n] = self.args[:,:self.n]
+        snapshot.strings = list(self.strings)
+        snapshot.n = self.n
+        snapshot.generation = self.generation
+        return snapshot
+
+    def save(self, f):
+        """
+        Write the commands to binary file object f: a header, the opcodes (one byte each),
+        the four float32 argument arrays, then each string as a byte count and UTF-8 bytes.
+        All little endian.
+        """
+        n = self.n
+        f.write(self.file_header.pack(self.file_magic, self.file_version, n, len(self.strings)))
+        f.write(self.ops[:n].tobytes())
+        f.write(self.args[:,:n].astype('<f4').tobytes())
+        for text in self.strings:
+            data = text.encode('utf-8')
+            f.write(struct.pack('<I', len(data)))
+            f.write(data)
+
+    def load(self, f):
+        """
+        Replace the commands with those in a file written by save().
+        Raises ValueError if it is not such a file.
+        """
+        header = f.read(self.file_header.size)
+        if len(header) != self.file_header.size:
+            raise ValueError('not a GTerm display list file')
+        (magic, version, n, nstrings) = self.file_header.unpack(header)
+        if magic != self.file_magic or version != self.file_version:
+            raise ValueError('not a GTerm display list file, or written by a different version')
+        ops = numpy.frombuffer(f.read(n), dtype=numpy.uint8)
+        args = numpy.frombuffer(f.read(16*n), dtype='<f4')
+        if len(ops) != n or len(args) != 4*n:
+            raise ValueError('display list file is truncated')
+        strings = []
+        for i in range(nstrings):
+            (count,) = struct.unpack('<I', f.read(4))
+            strings.append(f.read(count).decode('utf-8'))
+        self.clear()
+        while len(self.ops) < n:
+            self.grow()
+        self.ops[:n] = ops
+        self.args[:,:n] = args.reshape(4,n)
+        self.strings = strings
+        self.n = n
+
+    def lod(self, start, end, x_scale, y_scale):
+        """
+        Level of detail for drawing the run of draws (opcode 4 or 18) from start to end
+        at x_scale and y_scale pixels per unit. Returns the offsets into the run of the
+        points that need to be drawn, or None if all of them do.
+        The run is cut into columns no more than half a pixel wide along the axis it is
+        longest on in pixels. For each stretch of consecutive points in one column, only
+        the first, last, lowest and highest are kept, which draws the same pixels.
+        The levels (column widths halve from one to the next) are made when first needed
+        and kept until the display list is cleared. Zooming in picks finer levels, so
+        full detail is still shown. Tiles rendered on several threads share the levels.
+        """
+        n = end - start
+        if n < self.lod_min_points:
+            return None
+        with self.lod_lock:
+            entry = self.lod_levels.get(start)
+            if (entry == None) or (entry['end'] != end):
+                xy = self.lodPoints(start, end)
+                lo = xy.min(axis=1)
+                entry = {'end':end, 'lo':lo, 'span':xy.max(axis=1) - lo, 'levels':{}}
+                self.lod_levels[start] = entry
+            pixels = (float(entry['span'][0]) * abs(x_scale), float(entry['span'][1]) * abs(y_scale))
+            axis = 0 if pixels[0] >= pixels[1] else 1
+            level = int(math.ceil(math.log(max(1.0, 2.0 * pixels[axis]), 2)))
+            if (axis,level) not in entry['levels']:
+                entry['levels'][(axis,level)] = self.lodLevel(start, end, axis, level, entry)
+            return entry['levels'][(axis,level)]
+
+    def lodPoints(self, start, end):
+        """
+        The points of a run of draws, made absolute (to within an offset) if they are relative.
+        """
+        xy = self.args[0:2,start:end].astype(numpy.float64)
+        if self.ops[start] == 18:
+            xy = numpy.cumsum(xy, axis=1)
+        return xy
+
+    def lodLevel(self, start, end, axis, level, entry):
+        """
+        Work out one level for lod(): the points to keep with 2**level columns across the run.
+        """
+        n = end - start
+        xy = self.lodPoints(start, end)
+        p = xy[axis]
+        q = xy[1-axis]
+        column = numpy.floor((p - entry['lo'][axis]) * ((2.0 ** level) / max(1e-30, float(entry['span'][axis]))))
+        starts = numpy.concatenate(([0], numpy.flatnonzero(column[1:] != column[:-1]) + 1))
+        if 4 * len(starts) >= 2 * n:
+            return None
+        group = numpy.zeros(n, dtype=numpy.int64)
+        group[starts[1:]] = 1
+        group = numpy.cumsum(group)
+        index = numpy.arange(n)
+        lowest = numpy.minimum.reduceat(numpy.where(q == numpy.minimum.reduceat(q, starts)[group], index, n), starts)
+        highest = numpy.minimum.reduceat(numpy.where(q == numpy.maximum.reduceat(q, starts)[group], index, n), starts)
+        ends = numpy.concatenate((starts[1:], [n])) - 1
+        keep = numpy.unique(numpy.concatenate((starts, lowest, highest, ends)))
+        if 2 * len(keep) >= n:
+            return None
+        return keep
+
+    def runs(self, first=0):
+        """
+        Return (opcode, start, end) for each run of consecutive commands with the same opcode,
+        from command first on.
+        """
+        n = self.n
+        if n <= first:
+            return []
+        ops = self.ops[first:n]
+        starts = [0] + (numpy.flatnonzero(ops[1:] != ops[:-1]) + 1).tolist()
+        opcodes = ops[starts].tolist()
+        starts = [first + i for i in starts]
+        ends = starts[1:] + [n]
+        return list(zip(opcodes, starts, ends))
+
+
+################################
+# Graphics Vertex Buffer CLASS #
+################################
+
+# Shaders for GraphicsVertexBuffer. GLSL 1.20 so that they work with the
+# OpenGL 2.1 compatibility contexts that macOS provides.
+# The transform to pixels is the one cairoRenderGraphics() uses.
+graphics_vertex_shader = """
+#version 120
+uniform vec2 view;        // Drawing area width and height in pixels.
+uniform vec4 zoom;        // xlo, ylo, xhi, yhi.
+uniform vec4 zoomraw;     // xlo_raw, ylo_raw, xhi_raw, yhi_raw.
+uniform float zoomed;
+uniform float square;
+attribute vec2 pos;
+attribute vec2 other;
+attribute vec2 sidewidth;
+attribute vec3 colour;
+attribute vec4 bounds;
+attribute float hasbounds;
+varying vec3 vcolour;
+
+vec2 topixels(vec2 p)
+{
+    vec2 offset;
+    vec2 scale;
+    if( hasbounds > 0.5 ){
+        vec4 b = bounds;
+        if( zoomed > 0.5 ){
+            b = vec4(bounds.x + zoomraw.x * (bounds.z - bounds.x), bounds.y + zoomraw.y * (bounds.w - bounds.y),
+                     bounds.x + zoomraw.z * (bounds.z - bounds.x), bounds.y + zoomraw.w * (bounds.w - bounds.y));
+        }
+        float ys = view.y / max(1e-6, b.w - b.y);
+        if( square > 0.5 ){
+            offset = b.xy;
+            scale = vec2(ys, ys);
+        }
+        else{
+            offset = vec2(b.x, bounds.y);
+            scale = vec2(view.x / max(1e-6, b.z - b.x), ys);
+        }
+    }
+    else{
+        float ys = view.y / max(1e-6, zoom.w - zoom.y);
+        offset = zoom.xy;
+        if( square > 0.5 ){
+            scale = vec2(ys, ys);
+        }
+        else{
+            scale = vec2(view.x / max(1e-6, zoom.z - zoom.x), ys);
+        }
+    }
+    return (p - offset) * scale;
+}
+
+void main()
+{
+    vec2 a = topixels(pos);
+    vec2 d = topixels(other) - a;
+    float len = length(d);
+    vec2 n = (len > 0.0) ? vec2(-d.y, d.x) / len : vec2(0.0, 1.0);
+    gl_Position = gl_ModelViewProjectionMatrix * vec4(a + n * (0.5 * sidewidth.x * sidewidth.y), 0.0, 1.0);
+    vcolour = colour;
+}
+"""
+
+graphics_fragment_shader = """
+#version 120
+varying vec3 vcolour;
+
+void main()
+{
+    gl_FragColor = vec4(vcolour, 1.0);
+}
+"""
+
+class GraphicsVertexBuffer(object):
+    """
+    Triangles for the lines in a GraphicsDisplayList, for drawing with OpenGL.
+    Each line segment is a quad (two triangles) of six vertices. A vertex holds both ends
+    of its segment in host coordinates, which side of the line it is on, the line width
+    (pixels), colour and the bounds in force, so the vertex shader does the transform to
+    pixels and widens the line. Zooming and resizing are then just uniform changes.
+    Call update() to add the commands appended to the display list since the last call.
+    Display lists using commands that this can not draw (text, graph paper, points,
+    circles and square mode changes) set unsupported; they need Cairo.
+    """
+    # Vertex layout: pos(2) other(2) side(1) width(1) colour(3) bounds(4) hasbounds(1)
+    nfloats = 14
+    attributes = (('pos',0,2), ('other',2,2), ('sidewidth',4,2), ('colour',6,3),
+                  ('bounds',9,4), ('hasbounds',13,1))
+    unsupported_ops = (8, 9, 13, 14, 15, 16)
+
+    def __init__(self, capacity=6*4096):
+        self.vertices = numpy.zeros((capacity,self.nfloats), dtype=numpy.float32)
+        self.reset()
+
+    def reset(self):
+        """
+        Forget everything. The vertex array is kept for re-use.
+        """
+        self.nverts = 0
+        self.generation = -1
+        self.next = 0
+        self.unsupported = False
+        self.background = (0.0, 0.0, 0.0)
+        self.colour = (1.0, 1.0, 1.0)
+        self.width = 1.0
+        self.bounds = (0.0, 0.0, 1.0, 1.0)
+        self.hasbounds = 0.0
+        self.inaline = False
+        self.pending_move = False
+        self.gcp = (0.0, 0.0)
+        # Vertices from this one on have not been given to OpenGL.
+        self.firstnew = 0
+
+    def add_segments(self, gx, gy):
+        """
+        Add the segments joining the points (gx[i],gy[i]) in turn.
+        """
+        n = len(gx) - 1
+        if n <= 0:
+            return
+        need = self.nverts + 6*n
+        if need > len(self.vertices):
+            capacity = len(self.vertices)
+            while capacity < need:
+                capacity *= 2
+            vertices = numpy.zeros((capacity,self.nfloats), dtype=numpy.float32)
+            vertices[:self.nverts] = self.vertices[:self.nverts]
+            self.vertices = vertices
+        quads = numpy.zeros((n,6,self.nfloats), dtype=numpy.float32)
+        a = numpy.stack((gx[:-1],gy[:-1]), axis=1)
+        b = numpy.stack((gx[1:],gy[1:]), axis=1)
+        # Corners: A left, A right, B right, A left, B right, B left.
+        for (k,at_a,side) in ((0,True,1.0),(1,True,-1.0),(2,False,1.0),
+                              (3,True,1.0),(4,False,1.0),(5,False,-1.0)):
+            quads[:,k,0:2] = a if at_a else b
+            quads[:,k,2:4] = b if at_a else a
+            quads[:,k,4] = side
+        quads[:,:,5] = self.width
+        quads[:,:,6:9] = self.colour
+        quads[:,:,9:13] = self.bounds
+        quads[:,:,13] = self.hasbounds
+        self.vertices[self.nverts:need] = quads.reshape((6*n,self.nfloats))
+        self.nverts = need
+
+    def update(self, gcb):
+        """
+        Add vertices for the commands added to display list gcb since the last call.
+        Call with the display list lock held. This follows cairoRenderGraphics().
+        """
+        if gcb.generation != self.generation:
+            self.reset()
+            self.generation = gcb.generation
+        if self.unsupported:
+            return
+        for (op,start,end) in gcb.runs(self.next):
+            if op in self.unsupported_ops:
+                self.unsupported = True
+                return
+            if (op == 4) or (op == 18):
+                if self.pending_move:
+                    self.pending_move = False
+                    self.inaline = True
+                if self.inaline:
+                    gx = gcb.args[0,start:end].astype(numpy.float64)
+                    gy = gcb.args[1,start:end].astype(numpy.float64)
+                    if op == 18:
+                        gx = self.gcp[0] + numpy.cumsum(gx)
+                        gy = self.gcp[1] + numpy.cumsum(gy)
+                    self.add_segments(numpy.concatenate(([self.gcp[0]],gx)),
+                                      numpy.concatenate(([self.gcp[1]],gy)))
+                    self.gcp = (float(gx[-1]), float(gy[-1]))
+                continue
+            # Anything else ends the line.
+            self.inaline = False
+            for i in range(start,end):
+                cmd = gcb[i]
+                if op == 1:
+                    self.colour = cmd[1:4]
+                elif op == 2:
+                    # Fill covers everything drawn so far.
+                    self.background = self.colour
+                    self.nverts = 0
+                    self.firstnew = 0
+                elif op == 3:
+                    self.pending_move = True
+                    self.gcp = (cmd[1], cmd[2])
+                elif op == 6:
+                    self.width = cmd[1]
+                elif op == 7:
+                    self.bounds = cmd[1:5]
+                    self.hasbounds = 1.0
+                elif op == 17:
+                    self.pending_move = True
+                    self.gcp = (self.gcp[0] + cmd[1], self.gcp[1] + cmd[2])
+        self.next = len(gcb)
+
+
+###########################
+# Latency Histogram CLASS #
+###########################
+
+class LatencyHistogram(object):
+    """
+    Counts of how long something took, for the statistics (printStats()). Times go
+    in power of two buckets of microseconds, so adding one is cheap: bucket b counts
+    times of 2**(b-1) to 2**b - 1 microseconds (bucket 0 is under a microsecond).
+    The same buckets as ctelnet's SIGUSR1 statistics.
+    """
+    nbuckets = 32
+
+    def __init__(self):
+        self.buckets = [0] * self.nbuckets
+        self.count = 0
+        self.total = 0.0
+        self.worst = 0.0
+
+    def add(self, seconds):
+        """
+        Count one time, in seconds.
+        """
+        b = min(self.nbuckets - 1, int(seconds * 1e6).bit_length())
+        self.buckets[b] += 1
+        self.count += 1
+        self.total += seconds
+        if seconds > self.worst:
+            self.worst = seconds
+
+    def summary(self):
+        """
+        One line: the count, mean and worst, and the bucket each of the 50th, 90th and
+        99th percentiles is in.
+        """
+        if self.count == 0:
+            return 'none'
+        text = '{0} times, mean {1:.0f} us, max {2:.0f} us'.format(
+            self.count, 1e6 * self.total / self.count, 1e6 * self.worst)
+        seen = 0
+        pcts = [50, 90, 99]
+        for b in range(self.nbuckets):
+            seen += self.buckets[b]
+            while (len(pcts) > 0) and (seen * 100 >= self.count * pcts[0]):
+                text += ', p{0} < {1} us'.format(pcts.pop(0), 1 << b)
+        return text
+
+
+######################
+# Receive Ring CLASS #
+######################
+
+class ReceiveRing(object):
+    """
+    A single producer, single consumer queue of data received from the host.
+    The thread reading from the host only writes a slot and then the tail count,
+    and the main thread only reads a slot and then the head count, so neither ever
+    waits for the other (each count is only changed by one thread, and each change
+    is a single step for the interpreter).
+    The counts only ever increase; the slot is the count modulo the capacity.
+    """
+    def __init__(self, capacity=4096):
+        self.capacity = capacity
+        self.slots = [None] * capacity
+        self.head = 0
+        self.tail = 0
+
+    def __len__(self):
+        """
+        Number of items waiting.
+        """
+        return self.tail - self.head
+
+    def push(self, item):
+        """
+        Producer: add item. Returns False, adding nothing, if the ring is full.
+        """
+        tail = self.tail
+        if tail - self.head >= self.capacity:
+            return False
+        self.slots[tail % self.capacity] = item
+        self.tail = tail + 1
+        return True
+
+    def pop(self):
+        """
+        Consumer: remove and return the oldest item, or None if there are none.
+        """
+        head = self.head
+        if head == self.tail:
+            return None
+        i = head % self.capacity
+        item = self.slots[i]
+        self.slots[i] = None
+        self.head = head + 1
+        return item
+
+
 ############################
 #    GTerm Widget CLASS    #
 #   Glass teletype using   #
@@ -1243,6 +2328,12 @@ class doGrUpdate_signal_class(QObject):
     """
     signal = Signal(int)
 
+class drainReceived_signal_class(QObject):
+    """
+    As above, but for drainReceived() calls.
+    """
+    signal = Signal(int)
+
 class GTermWidget(QOpenGLWidget):
     """
     Implements a simple glass teletype style keyboard and screen using
@@ -1251,6 +2342,9 @@ class GTermWidget(QOpenGLWidget):
     screen whatever is typed on the keyboard. Classes inheriting from this can
     do more useful things - such as telnet and serial connections to other systems.
     """
+    # Font names for Cairo graphics text. These WILL be OS specific.
+    cairo_fontnames = ['Times New Roman','Arial','Courier']
+
     def __init__(self, charsetname='unknown',vkbname='unknown',umapname='unknown',parent = None):
         super(GTermWidget, self).__init__(parent)
         self.save_charsetname = charsetname
@@ -1278,10 +2372,14 @@ class GTermWidget(QOpenGLWidget):
         self.fancykeymap = {}
         # The display screen.
         self.line = []
-        self.screen = []
+        self.maxlines = 1040 # In scroll buffer.
+        self.screen = ScrollbackRing(self.maxlines)
+        # Text search: the index, and the line last found (by generation and line number).
+        self.screen_index = ScrollbackIndex(self.screen)
+        self.find_line = None
+        self.find_generation = 0
         self.xmargin = 20
         self.ymargin = 20
-        self.maxlines = 1040 # In scroll buffer.
         self.width_pixels = 1024 # Initial drawing area size.
         self.height_pixels = 768
         self.aspect = float(self.height_pixels) / float(self.width_pixels)
@@ -1289,8 +2387,15 @@ class GTermWidget(QOpenGLWidget):
         # Mouse position tracking.
         self.oldmouse_x = 0
         self.oldmouse_y = 0
+        # Text quad arrays: glyph texture coordinates by character code, arrays for
+        # each visible screen line by line number and the last frame's arrays.
+        self.text_uv = None
+        self.text_rows = {}
+        self.text_frame = None
         # Read character to texture location data, then read the texture
-        # image containing the character glyphs.
+        # image containing the character glyphs. These (and the virtual keyboard and
+        # Unicode map) come from a cache of the decoded data if it is up to date.
+        self.asset_caches = []
         ourchardata = get_application_file_name( 'gterm', charsetname, exttest='.jsn' )
         self.loadCharDefinitions(ourchardata)
         self.visiblelines = self.height_pixels // self.linespace + 1
@@ -1305,6 +2410,12 @@ class GTermWidget(QOpenGLWidget):
         # Create a lock to serialize access to screen data.
         self.screenlock = threading.Lock()
         self.changed = 0
+        # Text repaint region: everything, or this many lines up from the bottom,
+        # as changed since the last paint and as painted then.
+        self.dirtyall = True
+        self.dirtylines = 0
+        self.paintedall = True
+        self.paintedlines = 0
         # Keep track of the length of the last line.
         self.prevlen = 0
         self.tabpos = 0
@@ -1318,6 +2429,11 @@ class GTermWidget(QOpenGLWidget):
         self.numescape = 0
         self.grafescape = False
         self.do_not_process_escapes = False
+        # Native decoder, if available, and the settings it was last given.
+        self.decoder = None
+        self.decoder_config = None
+        if gtdecode != None:
+            self.decoder = gtdecode.Decoder(cyber_apl_in_map)
         # Widget state.
         self.setMinimumSize(self.width_pixels,self.height_pixels)
         self.setFocusPolicy(Qt.ClickFocus)
@@ -1333,7 +2449,7 @@ class GTermWidget(QOpenGLWidget):
             ourumapname = get_application_file_name( 'gterm', umapname, exttest='.jsn' )
             self.loadUnicodeMap(ourumapname)
         # Graphics commands and state.
-        self.gcb = []
+        self.gcb = GraphicsDisplayList()
         self.drawgraf = False
         self.gcblock = threading.Lock()
         self.gchanged = 0
@@ -1349,6 +2465,27 @@ class GTermWidget(QOpenGLWidget):
         self.zoom_yhi = 0.0
         self.zoom_box = False
         self.zoomed = False
+        # Cached Cairo rendering of the graphics and its texture.
+        self.crgraf_surface = None
+        self.crgraf_context = None
+        self.crgraf_state = None
+        self.crgraf_key = None
+        self.crgraf_texture = None
+        self.crgraf_texsize = None
+        # Full Cairo redraws of big display lists can be split into tiles drawn on a pool of
+        # worker threads. Runs of draws longer than tile_chunk are binned in chunks that long.
+        self.tiled_graphics = False
+        self.tile_workers = min(8, os.cpu_count() or 1)
+        self.tile_pool = None
+        self.tile_min_commands = 10000
+        self.tile_chunk = 64
+        # OpenGL vector graphics, instead of Cairo, if wanted and possible.
+        self.gl_graphics = False
+        self.glgraf_vertices = GraphicsVertexBuffer()
+        self.glgraf_program = None
+        self.glgraf_failed = False
+        self.glgraf_buffer = None
+        self.glgraf_bufsize = 0
         # Bell sound.
         self.bell_wav = get_application_file_name( 'gterm', 'beep-3.wav' )
         # Ensure control key is still control key (not CMD key) on MacOS. (MAY 2019).
@@ -1369,6 +2506,29 @@ class GTermWidget(QOpenGLWidget):
         # can be indirectly "called" from code on the thread reading data from the remote host.
         self.doUpdate_signal_object = doUpdate_signal_class()
         self.doGrUpdate_signal_object = doGrUpdate_signal_class()
+        # Only signal again once the last signal has been handled.
+        self.doUpdate_signalled = False
+        self.doGrUpdate_signalled = False
+        # Repaints for changed text or graphics are made at most max_fps times a second.
+        # The framebuffer is kept between paints so only changed lines need be redrawn.
+        self.max_fps = 60
+        self.last_repaint_time = 0.0
+        self.repaint_timer = QTimer(self)
+        self.repaint_timer.setSingleShot(True)
+        self.repaint_timer.timeout.connect(self.doScheduledRepaint)
+        self.setUpdateBehavior(QOpenGLWidget.PartialUpdate)
+        # Statistics (see statsText()). rx_waiting is when the oldest data received
+        # but not yet on the screen arrived, key_time when the last key was pressed.
+        self.paint_time = LatencyHistogram()
+        self.rx_latency = LatencyHistogram()
+        self.key_latency = LatencyHistogram()
+        self.rx_waiting = None
+        self.key_time = None
+        # The scrollback is indexed for searching in idle time, index_chunk lines at a time.
+        self.index_chunk = 1000
+        self.index_timer = QTimer(self)
+        self.index_timer.timeout.connect(self.indexScrollback)
+        self.index_timer.start(250)
         # Text cut/paste.
         try:
             clipman.init()
@@ -1424,7 +2584,9 @@ class GTermWidget(QOpenGLWidget):
         """
         if self.debuglevel > 1:
             print('Calling doUpdate() from thread:', threading.get_ident())
-        self.doUpdate_signal_object.signal.emit(position)
+        if not self.doUpdate_signalled:
+            self.doUpdate_signalled = True
+            self.doUpdate_signal_object.signal.emit(position)
         
     def trigger_doGrUpdate(self, position):
         """
@@ -1433,7 +2595,68 @@ class GTermWidget(QOpenGLWidget):
         """
         if self.debuglevel > 1:
             print('Calling doGrUpdate() from thread:', threading.get_ident())
-        self.doGrUpdate_signal_object.signal.emit(position)
+        if not self.doGrUpdate_signalled:
+            self.doGrUpdate_signalled = True
+            self.doGrUpdate_signal_object.signal.emit(position)
+
+    def markDirtyLines(self,nlines):
+        """
+        Note that the bottom nlines lines of the text screen (1 is the current line) need repainting.
+        Call with the screen lock held.
+        """
+        self.dirtylines = max( self.dirtylines, nlines )
+
+    def markDirtyAll(self):
+        """
+        Note that the whole text screen needs repainting, e.g. because it has scrolled.
+        Call with the screen lock held.
+        """
+        self.dirtyall = True
+
+    def update(self):
+        """
+        Repaint the whole widget. All direct update() calls are for changes
+        (scrolling, selection, view changes ...) that are not tracked by line.
+        """
+        self.dirtyall = True
+        super(GTermWidget,self).update()
+
+    def scheduleRepaint(self):
+        """
+        Repaint for changed text or graphics, now if a frame interval has
+        passed since the last such repaint, else when it has. Requests made
+        before then are merged into that one repaint.
+        """
+        if self.repaint_timer.isActive():
+            return
+        delay = self.last_repaint_time + 1.0/self.max_fps - time.monotonic()
+        if delay <= 0.0:
+            self.doScheduledRepaint()
+        else:
+            self.repaint_timer.start(int(delay*1000.0)+1)
+
+    def doScheduledRepaint(self):
+        """
+        Make a repaint of the changed lines scheduled by scheduleRepaint(), and
+        schedule another for the next frame while the changed counts ask for it.
+        """
+        self.last_repaint_time = time.monotonic()
+        super(GTermWidget,self).update()
+        #********************************************************
+        self.screenlockacquire()
+        if self.changed > 0:
+            self.changed -= 1
+        again = self.changed > 0
+        self.screenlockrelease()
+        #********************************************************
+        self.gcblockacquire()
+        if self.gchanged > 0:
+            self.gchanged -= 1
+        again = again or (self.gchanged > 0)
+        self.gcblockrelease()
+        #********************************************************
+        if again:
+            self.scheduleRepaint()
                 
     def loadCharData(self,jsonfile):
         """
@@ -1446,14 +2669,27 @@ class GTermWidget(QOpenGLWidget):
             flun = open(jsonfile,'r')
             input_dir = json.load(flun)
             flun.close()
-            self.chardict = {}
+            chardict = {}
             metricdict = {}
             for k in input_dir:
                 try:
                     ikey = int(k)
-                    self.chardict[ikey] = input_dir[k]
+                    chardict[ikey] = input_dir[k]
                 except ValueError:
                     metricdict[k] = input_dir[k]
+            self.setCharData(chardict,metricdict)
+        except Exception as e:
+            print('**** Failed to open or parse font data file! Giving up!')
+            print('... Reason:', e)
+            sys.exit(1)
+
+    def setCharData(self,chardict,metricdict):
+        """
+        Use the character locations and metrics read by loadCharData() (or from the cache).
+        """
+        self.chardict = chardict
+        self.metricdict = metricdict
+        try:
             self.scale = 1
             self.charwidth = metricdict['charwidth']
             self.charheight = metricdict['charheight']
@@ -1462,8 +2698,11 @@ class GTermWidget(QOpenGLWidget):
             self.cellduv = metricdict['cellduv']
             self.dsu = self.cellduv[0]
             self.dsv = self.cellduv[1]
+            self.text_uv = None
+            self.text_rows = {}
+            self.text_frame = None
         except Exception as e:
-            print('**** Failed to open or parse font data file! Giving up!')
+            print('**** Font data file has missing or bad metrics! Giving up!')
             print('... Reason:', e)
             sys.exit(1)
 
@@ -1474,7 +2713,7 @@ class GTermWidget(QOpenGLWidget):
         try:
             img = Image.open(pngfile)
             self.imgl = img.convert('L')
-        except Excpetion as e:
+        except Exception as e:
             print('**** Failed to open font texture image file! Giving up!')
             print('... Reason:', e)
             sys.exit(1)
@@ -1485,8 +2724,17 @@ class GTermWidget(QOpenGLWidget):
         """
         if self.debuglevel > 1:
             print('Loading char data:', charsetname)
-        self.loadCharData(str(charsetname)+'.jsn')
-        self.loadCharImage(str(charsetname)+'.png')
+        sources = [str(charsetname)+'.jsn', str(charsetname)+'.png']
+        cache = AssetCache(charsetname,sources)
+        if cache.load():
+            (chardict,metricdict) = cache.data
+            self.setCharData(chardict,metricdict)
+            self.imgl = cache.images['glyphs']
+        else:
+            self.loadCharData(sources[0])
+            self.loadCharImage(sources[1])
+            cache.save((self.chardict,self.metricdict),{'glyphs':self.imgl})
+        self.asset_caches.append(cache)
 
     def loadVkbData(self,jsonfile):
         """
@@ -1497,19 +2745,16 @@ class GTermWidget(QOpenGLWidget):
             flun = open(jsonfile,'r')
             input_keydata = json.load(flun)
             flun.close()
-            self.vkb_keymap = {}
+            keymap = {}
             inputkeyposmap = input_keydata['keyposmap']
             for k in inputkeyposmap:
                 try:
                     ikey = int(k)
-                    self.vkb_keymap[ikey] = inputkeyposmap[k]
+                    keymap[ikey] = inputkeyposmap[k]
                 except:
                     pass
-            self.vkb_keycols = input_keydata['keycols']
-            self.vkb_keyrows = input_keydata['keyrows']
-            self.vkb_keyxdelta = input_keydata['keyxdelta']
-            self.vkb_keyydelta = input_keydata['keyydelta']
-            self.vkb_have = True
+            self.setVkbData(keymap,input_keydata['keycols'],input_keydata['keyrows'],
+                            input_keydata['keyxdelta'],input_keydata['keyydelta'])
             if self.debuglevel > 1:
                 print(self.vkb_keymap)
         except Exception as e:
@@ -1520,6 +2765,17 @@ class GTermWidget(QOpenGLWidget):
         if self.debuglevel > 1:
             print(self.vkb_keymap)
 
+    def setVkbData(self,keymap,keycols,keyrows,keyxdelta,keyydelta):
+        """
+        Use the virtual keyboard layout read by loadVkbData() (or from the cache).
+        """
+        self.vkb_keymap = keymap
+        self.vkb_keycols = keycols
+        self.vkb_keyrows = keyrows
+        self.vkb_keyxdelta = keyxdelta
+        self.vkb_keyydelta = keyydelta
+        self.vkb_have = True
+
     def loadVkbImage(self,pngfile):
         """
         Open a PNG image file containing a virtual keyboard image.
@@ -1538,14 +2794,28 @@ class GTermWidget(QOpenGLWidget):
         """
         if self.debuglevel > 1:
             print('Loading vkb data:', vkbname)
-        self.loadVkbData(str(vkbname)+'.jsn')
-        self.loadVkbImage(str(vkbname)+'.png')
+        sources = [str(vkbname)+'.jsn', str(vkbname)+'.png']
+        cache = AssetCache(vkbname,sources)
+        if cache.load():
+            self.setVkbData(*cache.data)
+            self.vkb_img = cache.images['keyboard']
+        else:
+            self.loadVkbData(sources[0])
+            self.loadVkbImage(sources[1])
+            cache.save((self.vkb_keymap,self.vkb_keycols,self.vkb_keyrows,self.vkb_keyxdelta,self.vkb_keyydelta),
+                       {'keyboard':self.vkb_img})
+        self.asset_caches.append(cache)
 
     def loadUnicodeMap(self,mapname):
         """
         Load the mapping from our character numbers to Unicode char points.
         """
         mapfilename = str(mapname)+'.jsn'
+        cache = AssetCache(mapname,[mapfilename])
+        self.asset_caches.append(cache)
+        if cache.load():
+            self.unicode_map = cache.data
+            return
         try:
             flun = open(mapfilename,'r')
             input_dir = json.load(flun)
@@ -1557,6 +2827,7 @@ class GTermWidget(QOpenGLWidget):
                     self.unicode_map[ikey] = bytes(input_dir[k],encoding='utf-8').decode('unicode-escape')
                 except:
                     pass
+            cache.save(self.unicode_map,{})
         except Exception as e:
             print('**** Failed to open or parse Unicode map data file! Giving up!')
             print('... Reason:', e)
@@ -1674,6 +2945,92 @@ class GTermWidget(QOpenGLWidget):
         glVertex2f(xpos,ypos-self.charheight)
         glEnd()
 
+    def textUVTable(self):
+        """
+        Return the texture coordinates of every glyph as an array indexed by character code.
+        The last entry is (0,0) and is used for codes with no glyph, as drawTexChar() does.
+        """
+        if self.text_uv is None:
+            uv = numpy.zeros((max(self.chardict.keys())+2,2), dtype=numpy.float32)
+            for charcode in self.chardict:
+                if charcode >= 0:
+                    uv[charcode] = self.chardict[charcode]
+            self.text_uv = uv
+        return self.text_uv
+
+    def textRowArrays(self,codes):
+        """
+        Return vertex and texture coordinate arrays for the quads that draw the
+        character codes in one line of text, with the line at ypos = 0.
+        """
+        uvtab = self.textUVTable()
+        n = len(codes)
+        codes = numpy.minimum(numpy.asarray(codes, dtype=numpy.int64), len(uvtab)-1)
+        uv = uvtab[codes]
+        x = self.xmargin + self.charspace * numpy.arange(n, dtype=numpy.float32)
+        # Corners in the order drawTexChar() uses.
+        pos = numpy.zeros((n,4,2), dtype=numpy.float32)
+        pos[:,0,0] = x
+        pos[:,1,0] = x + self.charwidth
+        pos[:,2,0] = x + self.charwidth
+        pos[:,3,0] = x
+        pos[:,2:4,1] = -self.charheight
+        tex = numpy.empty((n,4,2), dtype=numpy.float32)
+        tex[:,:,:] = uv[:,numpy.newaxis,:]
+        tex[:,1:3,0] += self.dsu
+        tex[:,2:4,1] += self.dsv
+        return (pos.reshape(n*4,2), tex.reshape(n*4,2))
+
+    def textScreenArrays(self,firstvisible,lastvisible):
+        """
+        Return vertex and texture coordinate arrays for screen lines firstvisible
+        to lastvisible-1, placed as paintGL() shows them. The arrays for each line are
+        kept while it stays visible, and if the same lines are visible as last time,
+        the last arrays are returned as they are.
+        Call with the screen lock held.
+        """
+        base = self.screen.added - len(self.screen)
+        key = (self.screen.generation, base+firstvisible, base+lastvisible)
+        if (self.text_frame is not None) and (self.text_frame[0] == key):
+            return self.text_frame[1:]
+        rows = {}
+        poslist = []
+        texlist = []
+        for j in range(firstvisible,lastvisible):
+            rowkey = (self.screen.generation, base+j)
+            arrays = self.text_rows.get(rowkey)
+            if arrays is None:
+                arrays = self.textRowArrays(self.screen[j])
+            rows[rowkey] = arrays
+            if len(arrays[0]) > 0:
+                pos = arrays[0].copy()
+                pos[:,1] += self.linespace*(lastvisible-j)+self.ymargin
+                poslist.append(pos)
+                texlist.append(arrays[1])
+        self.text_rows = rows
+        if len(poslist) > 0:
+            pos = numpy.concatenate(poslist)
+            tex = numpy.concatenate(texlist)
+        else:
+            pos = numpy.zeros((0,2), dtype=numpy.float32)
+            tex = pos
+        self.text_frame = (key, pos, tex)
+        return (pos, tex)
+
+    def drawTextArrays(self,pos,tex):
+        """
+        Draw the character quads in vertex and texture coordinate arrays with one call.
+        """
+        if len(pos) == 0:
+            return
+        glEnableClientState(GL_VERTEX_ARRAY)
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY)
+        glVertexPointer(2, GL_FLOAT, 0, pos)
+        glTexCoordPointer(2, GL_FLOAT, 0, tex)
+        glDrawArrays(GL_QUADS, 0, len(pos))
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY)
+        glDisableClientState(GL_VERTEX_ARRAY)
+
     def draw_string(self,where,string):
         """
         Draw a string at an arbitrary position. Colour is as specified previously.
@@ -1722,6 +3079,7 @@ class GTermWidget(QOpenGLWidget):
         contents of the graphics command buffer.
         CALLED AS A RESULT OF CALLING update().
         """
+        paint_start = time.monotonic()
         # Graphics drawing.
         if self.drawgraf:
             if self.debuglevel > 2:
@@ -1730,6 +3088,8 @@ class GTermWidget(QOpenGLWidget):
             to_y_pixels = self.aspect * to_x_pixels
             if self.debuglevel > 2:
                 print("to_x_pixels=",to_x_pixels," to_y_pixels=",to_y_pixels," aspect=",self.aspect)
+            # The framebuffer is kept between paints, so clear it as Qt would otherwise.
+            glClear(GL_COLOR_BUFFER_BIT)
 
             # If there are no graphics commands, draw info string.
             if self.gcbcmds == 0:
@@ -1739,7 +3099,8 @@ class GTermWidget(QOpenGLWidget):
                                    (self.viewport[1]-self.linespace)//2),nodata)
                 
             # Have some commands in the graphics command buffer ...
-            else:
+            # Draw them with OpenGL if asked to and possible, else with Cairo.
+            elif not self.glRenderGraphics(self.width_pixels,self.height_pixels):
                 self.cairoRenderGraphicsToTexture(self.width_pixels,self.height_pixels)
                 glEnable(GL_TEXTURE_2D)
                 glBindTexture(GL_TEXTURE_2D,self.crgraf_texture)
@@ -1755,23 +3116,44 @@ class GTermWidget(QOpenGLWidget):
                 glVertex2f(0.0,self.height_pixels)
                 glEnd()
                 glDisable(GL_TEXTURE_2D)
-                # Draw a zoom box?
-                if self.zoom_box and (not self.zoomed):
-                    xmult = self.height_pixels if self.make_square else self.width_pixels
-                    glColor4f(0.1,0.9,0.1,1.0)
-                    glBegin(GL_LINE_LOOP)
-                    glVertex2f(self.zoom_xlo*xmult,self.zoom_ylo*self.height_pixels)
-                    glVertex2f(self.zoom_xhi*xmult,self.zoom_ylo*self.height_pixels)
-                    glVertex2f(self.zoom_xhi*xmult,self.zoom_yhi*self.height_pixels)
-                    glVertex2f(self.zoom_xlo*xmult,self.zoom_yhi*self.height_pixels)
-                    glEnd()
+
+            # Draw a zoom box?
+            if (self.gcbcmds != 0) and self.zoom_box and (not self.zoomed):
+                xmult = self.height_pixels if self.make_square else self.width_pixels
+                glColor4f(0.1,0.9,0.1,1.0)
+                glBegin(GL_LINE_LOOP)
+                glVertex2f(self.zoom_xlo*xmult,self.zoom_ylo*self.height_pixels)
+                glVertex2f(self.zoom_xhi*xmult,self.zoom_ylo*self.height_pixels)
+                glVertex2f(self.zoom_xhi*xmult,self.zoom_yhi*self.height_pixels)
+                glVertex2f(self.zoom_xlo*xmult,self.zoom_yhi*self.height_pixels)
+                glEnd()
                     
         # Text drawing.
         else:
+            # Only repaint the bottom lines if nothing else has changed. Include the lines
+            # repainted last time too, so the extra repaint doUpdate() asks for covers them.
+            #********************************************************
+            self.screenlockacquire()
+            paintall = self.dirtyall
+            paintlines = self.dirtylines
+            self.dirtyall = False
+            self.dirtylines = 0
+            self.screenlockrelease()
+            #********************************************************
+            if not (paintall or self.paintedall):
+                nlines = max( paintlines, self.paintedlines )
+                top = self.ymargin + (nlines-1)*self.linespace + 4 if nlines > 0 else 0
+                ratio = self.devicePixelRatioF()
+                glEnable(GL_SCISSOR_TEST)
+                glScissor(0, 0, int(math.ceil(self.viewport[0]*ratio)), int(math.ceil(top*ratio)))
+            self.paintedall = paintall
+            self.paintedlines = paintlines
             # Colour the background
             # We need four background colours: Focus yes/no, Connected yes/no.
             if self.papermode:
                 back_cols = (self.getBackgroundColour(), self.getAltBackgroundColour())
+                glClearColor(back_cols[0][0], back_cols[0][1], back_cols[0][2], back_cols[0][3])
+                glClear(GL_COLOR_BUFFER_BIT)
                 ypos = -13.0
                 for y in range(0,self.visiblelines,2):
                     back_col = back_cols[(self.newlinesin+self.scroll) & 1]
@@ -1819,20 +3201,29 @@ class GTermWidget(QOpenGLWidget):
                 lastvisible = 0
             if self.debuglevel > 2:
                 print("Scrolling visible lines: visible ",self.visiblelines,"first visible",firstvisible)
-            for j in range(firstvisible,lastvisible):
-                xpos = self.xmargin
-                ypos = self.linespace*(lastvisible-j)+self.ymargin
-                for i in range(0,len(self.screen[j])):
-                    self.drawTexChar(self.screen[j][i],xpos,ypos)
-                    xpos += self.charspace
-            # Draw the current line.
+            # Highlight the line found by findText() if it is visible.
+            if (self.find_line != None) and (self.find_generation == self.screen.generation):
+                jfind = self.find_line - (self.screen.added - lines)
+                if (jfind >= firstvisible) and (jfind < lastvisible):
+                    yfind = self.linespace*(lastvisible-jfind)+self.ymargin
+                    back_col = self.getTextSelectColour()
+                    glDisable(GL_TEXTURE_2D)
+                    glColor4f(back_col[0], back_col[1], back_col[2], back_col[3])
+                    glRectf(0.0,yfind-self.charheight-1,self.viewport[0],yfind+1)
+                    glEnable(GL_TEXTURE_2D)
+                    glColor4f(fore_col[0],fore_col[1],fore_col[2],fore_col[3])
+            (pos, tex) = self.textScreenArrays(firstvisible,lastvisible)
+            # Add the current line and draw everything at once.
             xpos = self.xmargin
             ypos = self.ymargin
-            if self.scroll == 0:
-                for i in range(0,len(self.line)):
-                    self.drawTexChar(self.line[i],xpos,ypos)
-                    xpos += self.charspace
-            else:
+            if (self.scroll == 0) and (len(self.line) > 0):
+                (linepos, linetex) = self.textRowArrays(self.line)
+                linepos[:,1] += ypos
+                pos = numpy.concatenate((pos,linepos))
+                tex = numpy.concatenate((tex,linetex))
+                xpos += len(self.line) * self.charspace
+            self.drawTextArrays(pos,tex)
+            if self.scroll != 0:
                 self.draw_tip( (xpos,ypos),"... scrolled {0} ...".format(self.scroll), True)
             self.screenlockrelease()
             #********************************************************
@@ -1892,7 +3283,19 @@ class GTermWidget(QOpenGLWidget):
             if self.gcbcmds > 0:
                 sgi = 'GC:{0}'.format(self.gcbcmds)
                 self.draw_tip((self.viewport[0],self.linespace),sgi)
+            glDisable(GL_SCISSOR_TEST)
         glFlush()
+        self.paintDone(paint_start)
+
+    def paintDone(self,paint_start):
+        """
+        Count a repaint and how long it took. Anything received before it is now on the screen.
+        """
+        now = time.monotonic()
+        self.paint_time.add(now - paint_start)
+        if self.rx_waiting != None:
+            self.rx_latency.add(now - self.rx_waiting)
+            self.rx_waiting = None
 
     def resizeGL(self, w, h):
         """
@@ -1908,6 +3311,7 @@ class GTermWidget(QOpenGLWidget):
         self.aspect = float(self.height_pixels)/float(self.width_pixels)
         self.visiblelines = self.height_pixels // self.linespace + 1
         self.visiblechars = self.width_pixels // self.charspace + 1
+        self.dirtyall = True
 
     def initializeGL(self):
         """
@@ -1952,36 +3356,73 @@ class GTermWidget(QOpenGLWidget):
             glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, self.vkb_img.size[0], self.vkb_img.size[1], \
                              0, GL_LUMINANCE, GL_UNSIGNED_BYTE, vkb_data)
 
-    def screenDoNewLine(self):
+    # The _...Locked() methods change the text screen for one control character or run of
+    # characters. Call them with the screen lock held. They are shared by the Python
+    # character loop (screenAddString()) and the native decoder (screenAddDecoded()).
+
+    def _newLineLocked(self):
         """
-        Screen: Process a newline. I.e. go to a newline.
+        Go to a new line, keeping the character position.
         """
-        if self.debuglevel > 1:
-            print('DoNewLine')
-        #********************************************************
-        self.screenlockacquire()
-        # Pop off lines that have gone off the top of the page.
+        # The ring loses lines that have gone off the top of the page.
         self.screen.append(self.line)
-        if len(self.screen) > (self.maxlines-1):
-            self.screen.pop(0)
         # If there is a log file, write to it.
         if self.flog != None:
             self.writeLogFile(self.line)
-        # Empty the current line.
-        self.line = []
-        if self.debuglevel > 1:
-            print('--> prevlen',self.prevlen)
         # If we were not at the beginning of the line, insert spaces to where we were.
-        if self.prevlen > 0:
-            for ispace in range(0,self.prevlen):
-                self.line.append(32)
+        self.line = [32] * self.prevlen
         self.changed = 2
+        self.markDirtyAll()
         # Do not reset the character position on the line!
-        #self.prevlen = 0
-        #self.tabpos = 0
         self.newlinesin += 1 # Count total newlines for paper mode.
-        self.screenlockrelease()
-        #********************************************************
+
+    def _backspaceLocked(self):
+        """
+        Remove the last character on the current line.
+        """
+        if( len(self.line) > 0 ):
+            self.line.pop()
+        self.prevlen -= 1
+        if self.prevlen < 0:
+            self.prevlen = 0
+        self.changed = 2
+        self.markDirtyLines(1)
+
+    def _tabLocked(self):
+        """
+        Pad the current line with spaces to the next tab stop.
+        """
+        nextpos = (int(self.prevlen/self.tabstop)+1) * self.tabstop
+        self.line.extend([32] * (nextpos - self.prevlen))
+        self.changed = 2
+        self.markDirtyLines(1)
+
+    def _addCharsLocked(self,codes):
+        """
+        Add character codes to the current line. If the character position is at the
+        start of the line, empty it first, even if there are no codes (e.g. a
+        non-printing character that is not shown).
+        """
+        if self.prevlen == 0:
+            self.line = []
+        if len(codes) > 0:
+            self.line.extend(codes)
+            self.prevlen += len(codes)
+            self.changed = 2
+            self.markDirtyLines(1)
+
+    def screenDoNewLine(self):
+        """
+        Screen: Process a newline. I.e. go to a newline.
+        """
+        if self.debuglevel > 1:
+            print('DoNewLine')
+            print('--> prevlen',self.prevlen)
+        #********************************************************
+        self.screenlockacquire()
+        self._newLineLocked()
+        self.screenlockrelease()
+        #********************************************************
         if self.debuglevel > 1:
             print('-- --> prevlen',self.prevlen)
         self.trigger_doUpdate(2)
@@ -2020,12 +3461,7 @@ class GTermWidget(QOpenGLWidget):
             print('DoBackspace')
         #********************************************************
         self.screenlockacquire()
-        if( len(self.line) > 0 ):
-            self.line.pop()
-        self.prevlen -= 1
-        if self.prevlen < 0:
-            self.prevlen = 0
-        self.changed = 2
+        self._backspaceLocked()
         self.screenlockrelease()
         #********************************************************
         if self.debuglevel > 2:
@@ -2040,10 +3476,7 @@ class GTermWidget(QOpenGLWidget):
             print('DoTab')
         #********************************************************
         self.screenlockacquire()
-        nextpos = (int(self.prevlen/self.tabstop)+1) * self.tabstop
-        numspaces = nextpos - self.prevlen
-        for ispace in range(0,numspaces):
-            self.line.append(32)
+        self._tabLocked()
         self.screenlockrelease()
         #********************************************************
         self.trigger_doUpdate(9)
@@ -2059,8 +3492,9 @@ class GTermWidget(QOpenGLWidget):
             #********************************************************
             self.screenlockacquire()
             self.line = []
-            self.screen = []
+            self.screen.clear()
             self.changed = 2
+            self.markDirtyAll()
             self.screenlockrelease()
             #********************************************************
             self.trigger_doUpdate(15)
@@ -2080,6 +3514,7 @@ class GTermWidget(QOpenGLWidget):
         #********************************************************
         self.screenlockacquire()
         self.changed += 1
+        self.markDirtyAll()
         self.screenlockrelease()
         #********************************************************
         self.trigger_doUpdate(27)
@@ -2105,20 +3540,17 @@ class GTermWidget(QOpenGLWidget):
         """
         Screen: Add character charnum to current line.
         """
-        # If the character location is at the start of the line now, empty the line.
-        if self.prevlen == 0:
-            self.line = []
-        # Conditionally add the character.
+        # Conditionally add the character. At the start of the line, empty it regardless.
+        #********************************************************
+        self.screenlockacquire()
         if is_printable or self.shownonprint:
-            #********************************************************
-            self.screenlockacquire()
-            self.line.append(charnum)
-            self.changed = 2
-            self.prevlen += 1
-            self.screenlockrelease()
-            #********************************************************
-            if self.debuglevel > 2:
-                print('--> prevlen',self.prevlen)
+            self._addCharsLocked((charnum,))
+        else:
+            self._addCharsLocked(())
+        self.screenlockrelease()
+        #********************************************************
+        if self.debuglevel > 2:
+            print('--> prevlen',self.prevlen)
         # Conditionally update the display.
         if do_update:
             self.trigger_doUpdate(4)
@@ -2127,6 +3559,14 @@ class GTermWidget(QOpenGLWidget):
         """
         Screen: Add a string of characters to the screen.
         """ 
+        # Use the native decoder for the whole string if we can.
+        if self.decoderReady():
+            self.decoder.suppress_newline = self.suppress_next_newline_display
+            records = self.decoder.decode(string,newlinechar,retchar,
+                                          self.do_not_process_escapes,self.shownonprint)
+            self.suppress_next_newline_display = self.decoder.suppress_newline
+            self.screenAddDecoded(records)
+            return
         # Step over the string characters. We need to know when we are at
         # the last because usually we only update the screen then. So count.
         string = _bytestostr_ifnot(string)
@@ -2185,6 +3625,79 @@ class GTermWidget(QOpenGLWidget):
                 else:
                     self.screenAddCharSimple(ichar,self.printableChar(char),(i==(l-1)))
 
+    def decoderReady(self):
+        """
+        Return True if the native decoder can be used. It only knows the standard
+        escape processors and does none of the debug printing, so otherwise the
+        Python code is used. Pass it any changed mode settings.
+        """
+        if self.decoder == None or self.debuglevel > 1:
+            return False
+        incharmap = self.incharmap if self.incharmap != None else {}
+        config = (tuple(self.escapeProcessFuncList),tuple(incharmap.items()))
+        if config != self.decoder_config:
+            kinds = {cyber_apl_escape:gtdecode.ESC_APL,
+                     ansi_escape:gtdecode.ESC_ANSI,
+                     cyber_apl_graphics_escape:gtdecode.ESC_GRAPHICS}
+            escapes = []
+            for (ec,epf) in self.escapeProcessFuncList:
+                if epf not in kinds:
+                    return False
+                escapes.append((ec,kinds[epf]))
+            self.decoder.set_escapes(escapes)
+            self.decoder.set_charmap(incharmap)
+            self.decoder_config = config
+        return True
+
+    def screenAddDecoded(self,records):
+        """
+        Screen: Apply the records from the native decoder for one received string.
+        Text changes are made with the screen lock held once, not per character,
+        and the screen is updated once at the end.
+        """
+        changed = False
+        #********************************************************
+        self.screenlockacquire()
+        for record in records:
+            rtype = record[0]
+            if rtype == gtdecode.TEXT:
+                self._addCharsLocked(record[1])
+                changed = True
+            elif rtype == gtdecode.NEWLINE:
+                self._newLineLocked()
+                changed = True
+            elif rtype == gtdecode.RETURN:
+                self.prevlen = 0
+                self.tabpos = 0
+            elif rtype == gtdecode.BACKSPACE:
+                self._backspaceLocked()
+                changed = True
+            elif rtype == gtdecode.TAB:
+                self._tabLocked()
+                changed = True
+            elif rtype == gtdecode.SKIP:
+                # A dropped non-printing character still starts a new line.
+                self._addCharsLocked(())
+            else:
+                # The rest take the locks they need themselves.
+                self.screenlockrelease()
+                if rtype == gtdecode.BELL:
+                    self.screenDoBell()
+                elif rtype == gtdecode.FORMFEED:
+                    self.screenDoFormFeed()
+                elif rtype == gtdecode.GRAPHICS:
+                    self.addGraphicsEntry(record[1],record[2])
+                elif rtype == gtdecode.POLYLINE:
+                    self.addGraphicsPolyline(record[2],record[3])
+                elif rtype == gtdecode.GRAPHICS_ERROR:
+                    print('add_graphics(): Exception, command code:',record[1])
+                    print(record[2])
+                self.screenlockacquire()
+        self.screenlockrelease()
+        #********************************************************
+        if changed:
+            self.trigger_doUpdate(4)
+
     def screenAddCodesArray(self, array):
         """
         Screen: Write characters given as character codes to the current line 
@@ -2248,18 +3761,16 @@ class GTermWidget(QOpenGLWidget):
         Re-paint the screen.
         """
         # If the screen data has actually changed, repaint. Otherwise, do nothing.
-        # Many unnecessary repaint events may be queued, so this greatly improves performance.
+        # Repaints are merged by scheduleRepaint(), so bursts of host output
+        # make at most one repaint per frame interval.
         # However, there is a nasty kludge which seems to be required to make this work
         # reliably ... repaint one more time than seems to be strictly necessary!
+        # (doScheduledRepaint() repeats while changed is not zero.)
         if self.debuglevel > 1:
             print('Running doUpdate() in thread:', threading.get_ident())
+        self.doUpdate_signalled = False
         if self.changed > 0:
-            self.update()
-            #********************************************************
-            self.screenlockacquire()
-            self.changed -= 1
-            self.screenlockrelease()
-            #********************************************************
+            self.scheduleRepaint()
         if self.debuglevel > 1:
             print('Update. From:',location,' Changed:',self.changed)
 
@@ -2285,6 +3796,7 @@ class GTermWidget(QOpenGLWidget):
         """
         Handle the keyboard - key presses.
         """
+        self.key_time = time.monotonic()
         keynum = event.key()
         if self.debuglevel > 0:
             print('KeyPress',keynum,event.text())
@@ -2377,7 +3889,7 @@ class GTermWidget(QOpenGLWidget):
             #********************************************************
             self.gcblockacquire()
             self.gcbcmds = 0
-            self.gcb = []
+            self.gcb.clear()
             self.gchanged = 2
             self.gcblockrelease()
             #********************************************************
@@ -2386,8 +3898,9 @@ class GTermWidget(QOpenGLWidget):
             #********************************************************
             self.screenlockacquire()
             self.line = []
-            self.screen = []
+            self.screen.clear()
             self.changed = 2
+            self.markDirtyAll()
             self.screenlockrelease()
             #********************************************************
             self.trigger_doUpdate(5)
@@ -2411,6 +3924,7 @@ class GTermWidget(QOpenGLWidget):
         #********************************************************
         self.screenlockacquire()
         self.changed = 2
+        self.markDirtyAll()
         self.screenlockrelease()
         #********************************************************
         self.trigger_doUpdate(6)
@@ -2425,6 +3939,7 @@ class GTermWidget(QOpenGLWidget):
         #********************************************************
         self.screenlockacquire()
         self.changed = 2
+        self.markDirtyAll()
         self.screenlockrelease()
         #********************************************************
         self.trigger_doUpdate(7)
@@ -2712,6 +4227,24 @@ class GTermWidget(QOpenGLWidget):
             hs += chr(e)
         return int(hs)
 
+    def ldeltas(self,charlist):
+        """
+        Graphics: Convert a polyline command delta char list to a list of integers.
+        """
+        deltas = []
+        value = 0
+        shift = 0
+        for e in charlist:
+            (digit,more) = polyline_digit_values[e]
+            value |= digit << shift
+            if more:
+                shift += 5
+            else:
+                deltas.append((value >> 1) ^ -(value & 1))
+                value = 0
+                shift = 0
+        return deltas
+
     def lfcol(self,charlist):
         """
         Graphics: Convert a colour integer char list to a floating point normalized colour.
@@ -2762,6 +4295,8 @@ class GTermWidget(QOpenGLWidget):
         
         # Trap errors to prevent aborts with experimental drivers.
         command = -1
+        ncmd0 = self.gcbcmds
+        ncmds = 1
         try:
             # Get the command as a character code.
             command = commandlist[2]
@@ -2780,7 +4315,7 @@ class GTermWidget(QOpenGLWidget):
             if command == 48:
                 # 0: clear gcb list.
                 self.gcbcmds = 0
-                self.gcb = []
+                self.gcb.clear()
                 isaflush = True
                 if self.debuglevel > 2:
                     print("CLEAR")
@@ -2795,13 +4330,13 @@ class GTermWidget(QOpenGLWidget):
                     cred = self.lfcol(commandlist[3:6])
                     cgrn = self.lfcol(commandlist[6:9])
                     cblu = self.lfcol(commandlist[9:12])
-                self.gcb.append((1,cred,cgrn,cblu))
+                self.gcb.append(1,cred,cgrn,cblu)
                 if self.debuglevel > 2:
                     print("COLOUR", self.gcb[-1])
                     
             elif command == 50:
                 # 2: fill/erase.
-                self.gcb.append((2,0))
+                self.gcb.append(2,0)
                 if self.debuglevel > 2:
                     print("FILL")
                     
@@ -2813,7 +4348,7 @@ class GTermWidget(QOpenGLWidget):
                 else:
                     x = self.lfpos(commandlist[3:7])
                     y = self.lfpos(commandlist[7:11])
-                self.gcb.append((3,x,y))
+                self.gcb.append(3,x,y)
                 if self.debuglevel > 2:
                     print("MOVE", self.gcb[-1])
                     
@@ -2825,7 +4360,7 @@ class GTermWidget(QOpenGLWidget):
                 else:
                     x = self.lfpos(commandlist[3:7])
                     y = self.lfpos(commandlist[7:11])
-                self.gcb.append((4,x,y))
+                self.gcb.append(4,x,y)
                 if self.debuglevel > 2:
                     print("DRAW", self.gcb[-1])
                     
@@ -2841,7 +4376,7 @@ class GTermWidget(QOpenGLWidget):
                     width = float(commandsplit[1])
                 else:
                     width = self.lfwid(commandlist[3:6])
-                self.gcb.append((6,width))
+                self.gcb.append(6,width)
                 if self.debuglevel > 2:
                     print("WIDTH", self.gcb[-1])
                     
@@ -2852,7 +4387,7 @@ class GTermWidget(QOpenGLWidget):
                     ylo = self.alt_float(commandsplit[2])
                     xhi = self.alt_float(commandsplit[3])
                     yhi = self.alt_float(commandsplit[4])
-                    self.gcb.append((7,xlo,ylo,xhi,yhi))
+                    self.gcb.append(7,xlo,ylo,xhi,yhi)
                     if self.debuglevel > 2:
                         print("BOUNDS", self.gcb[-1])
 
@@ -2863,7 +4398,7 @@ class GTermWidget(QOpenGLWidget):
                     ylo = self.alt_float(commandsplit[2])
                     xhi = self.alt_float(commandsplit[3])
                     yhi = self.alt_float(commandsplit[4])
-                    self.gcb.append((8,xlo,ylo,xhi,yhi))
+                    self.gcb.append(8,xlo,ylo,xhi,yhi)
                     if self.debuglevel > 2:
                         print("GRAPH BOUNDS", self.gcb[-1])
 
@@ -2878,7 +4413,7 @@ class GTermWidget(QOpenGLWidget):
                         recovered_string += chr(commandlist[i])
                     #print ' ... recovered string:'recovered_string
                     icmd = 9 if (command == 57) else 14
-                    self.gcb.append((icmd,recovered_string))
+                    self.gcb.append_text(icmd,recovered_string)
                     if self.debuglevel > 2:
                         if command == 57:
                             print("TEXT", self.gcb[-1])
@@ -2888,21 +4423,21 @@ class GTermWidget(QOpenGLWidget):
             elif command == 65:
                 # A: font size. ONLY in alt_escmode.
                 fs = self.alt_float(commandsplit[1])
-                self.gcb.append((10,fs))
+                self.gcb.append(10,fs)
                 if self.debuglevel > 2:
                     print("FONT SIZE", self.gcb[-1])                
 
             elif command == 66:
                 # B: text align. ONLY in alt_escmode.
                 fs = self.alt_float(commandsplit[1])
-                self.gcb.append((11,fs))
+                self.gcb.append(11,fs)
                 if self.debuglevel > 2:
                     print("TEXT ALIGN", self.gcb[-1])                
 
             elif command == 67:
                 # C: font index. ONLY in alt_escmode.
                 fs = self.alt_float(commandsplit[1])
-                self.gcb.append((12,fs))
+                self.gcb.append(12,fs)
                 if self.debuglevel > 2:
                     print("FONT INDEX", self.gcb[-1])                
 
@@ -2910,7 +4445,7 @@ class GTermWidget(QOpenGLWidget):
                 # D: draw point marker. ONLY in alt_escmode.
                 x = self.alt_float(commandsplit[1])
                 y = self.alt_float(commandsplit[2])
-                self.gcb.append((13,x,y))
+                self.gcb.append(13,x,y)
                 if self.debuglevel > 2:
                     print("POINT", self.gcb[-1])
 
@@ -2919,14 +4454,14 @@ class GTermWidget(QOpenGLWidget):
                 x = self.alt_float(commandsplit[1])
                 y = self.alt_float(commandsplit[2])
                 r = self.alt_float(commandsplit[3])
-                self.gcb.append((15,x,y,r))
+                self.gcb.append(15,x,y,r)
                 if self.debuglevel > 2:
                     print("CIRCLE", self.gcb[-1])
 
             elif command == 71:
                 # G: set/clear square mode. ONLY in alt_escmode.
                 is_square = self.alt_float(commandsplit[1])
-                self.gcb.append((16,is_square))
+                self.gcb.append(16,is_square)
                 if self.debuglevel > 2:
                     print("SET_SQUARE", self.gcb[-1])
                     
@@ -2934,7 +4469,7 @@ class GTermWidget(QOpenGLWidget):
                 # H: relative move. ONLY in alt_escmode.
                 x = self.alt_float(commandsplit[1])
                 y = self.alt_float(commandsplit[2])
-                self.gcb.append((17,x,y))
+                self.gcb.append(17,x,y)
                 if self.debuglevel > 2:
                     print("RELMOVE", self.gcb[-1])
                     
@@ -2942,20 +4477,39 @@ class GTermWidget(QOpenGLWidget):
                 # I: relative draw. ONLY in alt_escmode.
                 x = self.alt_float(commandsplit[1])
                 y = self.alt_float(commandsplit[2])
-                self.gcb.append((18,x,y))
+                self.gcb.append(18,x,y)
                 if self.debuglevel > 2:
                     print("RELDRAW", self.gcb[-1])                    
 
+            elif command == 76:
+                # L: polyline. A move then draws, with the points after the first as deltas
+                # from the one before. Fixed form: XXXXYYYY then encoded deltas (see ldeltas()).
+                # Alt form: x y dx dy dx dy ...
+                if alt_escmode:
+                    values = [self.alt_float(v) for v in commandstring[3:-1].split()]
+                    xs = numpy.cumsum(values[0::2]).tolist()
+                    ys = numpy.cumsum(values[1::2]).tolist()
+                else:
+                    deltas = [self.lint(commandlist[3:7]), self.lint(commandlist[7:11])]
+                    deltas += self.ldeltas(commandlist[11:-1])
+                    xs = (numpy.cumsum(deltas[0::2]) / 9999.0).tolist()
+                    ys = (numpy.cumsum(deltas[1::2]) / 9999.0).tolist()
+                npoints = min(len(xs),len(ys))
+                self.gcb.append_polyline(xs[0:npoints],ys[0:npoints])
+                ncmds = npoints
+                if self.debuglevel > 2:
+                    print("POLYLINE", npoints, "points")
+
             # If command wasn't clear display list, bump display list command count.
             if command != 48:
-                self.gcbcmds += 1;
+                self.gcbcmds += ncmds;
 
             # Release the display list lock.
             self.gcblockrelease()
             #********************************************************
 
             # If we have received a lot of commands, or a flush command, update the screen.
-            if isaflush or ( ( ( (self.gcbcmds+1) % 1000 ) ) == 0 ):
+            if isaflush or ( (self.gcbcmds+1) // 1000 != (ncmd0+1) // 1000 ):
                 self.gchanged = 2
                 self.trigger_doGrUpdate(1)
 
@@ -2966,6 +4520,48 @@ class GTermWidget(QOpenGLWidget):
             self.gcblockrelease()
             #******************************************************** ???
 
+    def addGraphicsEntry(self,command,entry):
+        """
+        Graphics: Add a command already parsed by the native decoder to the graphics
+        command buffer. entry is the command tuple, or None if there is nothing to add.
+        Otherwise as addGraphics().
+        """
+        #********************************************************
+        self.gcblockacquire()
+        isaflush = False
+        ncmd0 = self.gcbcmds
+        if command == 48:
+            self.gcbcmds = 0
+            self.gcb.clear()
+            isaflush = True
+        else:
+            if command == 53:
+                isaflush = True
+            if entry != None:
+                self.gcb.append_tuple(entry)
+            self.gcbcmds += 1
+        self.gcblockrelease()
+        #********************************************************
+        if isaflush or ( (self.gcbcmds+1) // 1000 != (ncmd0+1) // 1000 ):
+            self.gchanged = 2
+            self.trigger_doGrUpdate(1)
+
+    def addGraphicsPolyline(self,xs,ys):
+        """
+        Graphics: Add a polyline command already parsed by the native decoder to the
+        graphics command buffer. Otherwise as addGraphics().
+        """
+        #********************************************************
+        self.gcblockacquire()
+        ncmd0 = self.gcbcmds
+        self.gcb.append_polyline(xs,ys)
+        self.gcbcmds += len(xs)
+        self.gcblockrelease()
+        #********************************************************
+        if (self.gcbcmds+1) // 1000 != (ncmd0+1) // 1000:
+            self.gchanged = 2
+            self.trigger_doGrUpdate(1)
+
     def viewGraphics(self):
         """
         View the graphics screen.
@@ -2992,16 +4588,18 @@ class GTermWidget(QOpenGLWidget):
         Re-paint the graphics screen.
         """
         # If the graphics screen data has actually changed, repaint. Otherwise, do nothing.
-        # Logic identical to doUpdate.
+        # Logic identical to doUpdate. In text view only the graphics command count
+        # tip, in the bottom two lines, changes.
         if self.debuglevel > 1:
             print('Running doGrUpdate() in thread:', threading.get_ident())
+        self.doGrUpdate_signalled = False
         if self.gchanged > 0:
-            self.update()
             #********************************************************
-            self.gcblockacquire()
-            self.gchanged -= 1
-            self.gcblockrelease()
+            self.screenlockacquire()
+            self.markDirtyLines(2)
+            self.screenlockrelease()
             #********************************************************
+            self.scheduleRepaint()
         if self.debuglevel > 1:
             print('GrUpdate. From:',location,' Changed:',self.gchanged)
 
@@ -3065,16 +4663,12 @@ class GTermWidget(QOpenGLWidget):
                 labels.append( trail_0_suppress('{0:.2f}'.format( tick_val )) )
         return (labels, scale_label)
 
-    def cairoRenderGraphics(self,c,to_x_pixels,to_y_pixels):
+    def cairoStartGraphics(self,c,to_x_pixels,to_y_pixels,fontnames):
         """
-        Render the graphics command buffer contents to Cairo context c.
+        Set up Cairo context c to render the graphics command buffer from the start.
+        Returns the initial renderer state for cairoRenderGraphics().
+        Call with the display list lock held.
         """
-        # Available font names. These WILL be OS specific.
-        fontnames = ['Times New Roman','Arial','Courier']
-        
-        # Acquire the display list lock.
-        #********************************************************
-        self.gcblockacquire()
         inaline = False
         
         # Record MOVE commands, but do not actually move until the first
@@ -3116,289 +4710,645 @@ class GTermWidget(QOpenGLWidget):
         # Set the initial state variables into Cairo.
         self.cairoSetLineWidth(c,width)
         c.set_source_rgb(gcolour[0], gcolour[1], gcolour[2])
+
+        return {'vars':(inaline, pending_move, pmx, pmy, gcp, x_offset, x_scale, y_offset, y_scale,
+                        width, gcolour, fontsize, fontindex, textalign)}
+
+    def cairoRenderGraphics(self,c,to_x_pixels,to_y_pixels,state=None,snapshot=None,lod=True,tile=None):
+        """
+        Render the graphics command buffer contents to Cairo context c.
+        If state is given, it was returned by an earlier call for the same context, and only
+        the commands added since then are drawn. Returns the state to carry on from. This also
+        holds the box that was drawn in ('dirty', in pixels), or None if it is not known.
+        If snapshot is given, render that copy of the display list instead, without taking
+        the display list lock.
+        If lod is True, long runs of draws are thinned to what shows at this size (see
+        GraphicsDisplayList.lod()). Use False for output that may be viewed larger.
+        If tile (x0, y0, x1, y1 in pixels) is given, only that part of the image is wanted, so
+        long runs of draws that are all outside it are left out. Square mode changes are then
+        only returned in the state, not set, as other tiles may be rendering at the same time.
+        """
+        fontnames = self.cairo_fontnames
+        make_square = self.make_square
         
-        # Draw all the commands in the graphics command buffer.
-        for cmd in self.gcb:
+        # Acquire the display list lock.
+        #********************************************************
+        if snapshot != None:
+            gcb = snapshot
+        else:
+            self.gcblockacquire()
+            gcb = self.gcb
+
+        # If the display list has been cleared since state was made, start again.
+        if (state != None) and (state['generation'] != gcb.generation):
+            state = None
+
+        # Carry on from an earlier call. Cairo drawing state is still set in c.
+        if state != None:
+            first = state['next']
+            dirty = [float(to_x_pixels), float(to_y_pixels), 0.0, 0.0]
+            (inaline, pending_move, pmx, pmy, gcp, x_offset, x_scale, y_offset, y_scale,
+             width, gcolour, fontsize, fontindex, textalign) = state['vars']
+            if inaline:
+                c.move_to(state['lastx'],state['lasty'])
+        else:
+            first = 0
+            dirty = None
+            state = self.cairoStartGraphics(c,to_x_pixels,to_y_pixels,fontnames)
+            (inaline, pending_move, pmx, pmy, gcp, x_offset, x_scale, y_offset, y_scale,
+             width, gcolour, fontsize, fontindex, textalign) = state['vars']
+
+        # Draw all the commands in the graphics command buffer, a run of commands
+        # with the same opcode at a time.
+        for (op,start,end) in gcb.runs(first):
             if self.debuglevel > 2:
-                print('cairoRenderGraphics(): cmd =',cmd)
-                
-            # If cmd is not draw or reldraw, if in a line, end the line.
-            if (cmd[0] != 4) and (cmd[0] != 18):
+                print('cairoRenderGraphics(): run =',op,start,end)
+
+            # If not draw or reldraw, if in a line, end the line.
+            if (op != 4) and (op != 18):
                 if inaline:
                     c.stroke()
                     inaline = False
-                    
-            # Execute each command
-            if cmd[0] == 1: # Set colour
-                gcolour = cmd[1:]
-                c.set_source_rgb(gcolour[0], gcolour[1], gcolour[2])
-                
-            elif cmd[0] == 2: # Fill/erase
-                c.paint()
-                
-            elif cmd[0] == 3: # Move. Should be followed by one or more draws.
-                gpos = cmd[1:]
-                pending_move = True
-                pmx = (gpos[0] - x_offset) * x_scale
-                pmy = (gpos[1] - y_offset) * y_scale
-                gcp = numpy.asarray(gpos)
-                if self.debuglevel > 2:
-                    print('move:', gcp)
-                
-            elif cmd[0] == 4: # Draw. Add line segment to line.
+
+            # Draw and relative draw. Add line segments to the line. The
+            # coordinates of the whole run are transformed together.
+            if (op == 4) or (op == 18):
                 if pending_move:
                     c.move_to(pmx,to_y_pixels-pmy)
                     pending_move = False
                     inaline = True
                 if inaline:
+                    gx = gcb.args[0,start:end].astype(numpy.float64)
+                    gy = gcb.args[1,start:end].astype(numpy.float64)
+                    if op == 18:
+                        gx = gcp[0] + numpy.cumsum(gx)
+                        gy = gcp[1] + numpy.cumsum(gy)
+                    gcp = numpy.array([gx[-1],gy[-1]])
+                    keep = gcb.lod(start,end,x_scale,y_scale) if lod else None
+                    if keep is not None:
+                        gx = gx[keep]
+                        gy = gy[keep]
+                    xl = ((gx - x_offset) * x_scale).tolist()
+                    yl = (to_y_pixels - (gy - y_offset) * y_scale).tolist()
+                    if dirty != None:
+                        (cx,cy) = c.get_current_point()
+                        pad = width + 2.0
+                        dirty = [min(dirty[0],cx,min(xl))-pad, min(dirty[1],cy,min(yl))-pad,
+                                 max(dirty[2],cx,max(xl))+pad, max(dirty[3],cy,max(yl))+pad]
+                    if (tile != None) and (len(xl) > self.tile_chunk):
+                        self.cairoLineToInTile(c,xl,yl,tile,width)
+                    else:
+                        for (x,y) in zip(xl,yl):
+                            c.line_to(x,y)
+                    if self.debuglevel > 2:
+                        print('draw:', gcp)
+                continue
+
+            # Only draws are tracked in the dirty box. Anything else that draws
+            # could change pixels anywhere.
+            if op not in (1,3,6,10,11,12,16,17):
+                dirty = None
+
+            # Execute each other command
+            for i in range(start,end):
+                cmd = gcb[i]
+                if cmd[0] == 1: # Set colour
+                    gcolour = cmd[1:]
+                    c.set_source_rgb(gcolour[0], gcolour[1], gcolour[2])
+                
+                elif cmd[0] == 2: # Fill/erase
+                    c.paint()
+                
+                elif cmd[0] == 3: # Move. Should be followed by one or more draws.
                     gpos = cmd[1:]
-                    x = (gpos[0] - x_offset) * x_scale
-                    y = (gpos[1] - y_offset) * y_scale
-                    c.line_to(x,to_y_pixels-y)
+                    pending_move = True
+                    pmx = (gpos[0] - x_offset) * x_scale
+                    pmy = (gpos[1] - y_offset) * y_scale
                     gcp = numpy.asarray(gpos)
                     if self.debuglevel > 2:
-                        print('draw:', gcp)
-                    
-            elif cmd[0] == 6: # Width.
-                width = cmd[1]
-                self.cairoSetLineWidth(c,width)
+                        print('move:', gcp)
                 
-            elif cmd[0] == 7: # Bounds. xlo, ylo, xhi, yhi
-                # Adjust the supplied bounds for any active zoom.
-                if self.zoomed:
-                    xblo = cmd[1] + self.xlo_raw * (cmd[3] - cmd[1])
-                    xbhi = cmd[1] + self.xhi_raw * (cmd[3] - cmd[1])
-                    yblo = cmd[2] + self.ylo_raw * (cmd[4] - cmd[2])
-                    ybhi = cmd[2] + self.yhi_raw * (cmd[4] - cmd[2])
-                else:
-                    xblo = cmd[1]
-                    xbhi = cmd[3]
-                    yblo = cmd[2]
-                    ybhi = cmd[4]
-                # Find scales and offsets.
-                if self.make_square:
-                    y_offset = yblo
-                    y_scale = to_y_pixels / max(1e-6, ybhi - yblo)
-                    x_offset = xblo
-                    x_scale = y_scale
-                    pass
-                else:
-                    x_offset = xblo
-                    x_scale = to_x_pixels / max(1e-6, xbhi - xblo)
-                    y_offset = cmd[2]
-                    y_scale = to_y_pixels / max(1e-6, ybhi - yblo)
-
-            elif cmd[0] == 8: # Graph bounds. xlo, ylo, xhi, yhi
-                # Adjust the supplied bounds for any active zoom.
-                if self.zoomed:
-                    xblo = self.gxl + self.xlo_raw * (self.gxh - self.gxl)
-                    xbhi = self.gxl + self.xhi_raw * (self.gxh - self.gxl)
-                    yblo = self.gyl + self.ylo_raw * (self.gyh - self.gyl)
-                    ybhi = self.gyl + self.yhi_raw * (self.gyh - self.gyl)
-                else:
-                    xblo = cmd[1]
-                    xbhi = cmd[3]
-                    yblo = cmd[2]
-                    ybhi = cmd[4]
-                # Find tick values for each axis.
-                if self.make_square:
-                    xmid = 0.5 * ( xblo + xbhi )
-                    xdelta = 0.5 * ((float(to_x_pixels) / float(to_y_pixels)) * (ybhi - yblo))
-                    graph_tick_values_x = self.tick_values( xmid-xdelta, xmid+xdelta, 15 )
-                else:
-                    graph_tick_values_x = self.tick_values( xblo, xbhi, 15 )
-                graph_tick_values_y = self.tick_values( yblo, ybhi, 10 )
-                # Set the drawing bounds to the smallest and largest tick values on each axis.
-                xlo = graph_tick_values_x[0]
-                xhi = graph_tick_values_x[-1]
-                ylo = graph_tick_values_y[0]
-                yhi = graph_tick_values_y[-1]
-                if not self.zoomed:
-                    self.gxl = xlo
-                    self.gxh = xhi
-                    self.gyl = ylo
-                    self.gyh = yhi
-                # Find scales and offsets.
-                if self.make_square:
-                    y_offset = ylo
-                    y_scale = to_y_pixels / max(1e-6, yhi - ylo)
-                    x_offset = xlo
-                    x_scale = y_scale
-                else:
-                    x_offset = xlo
-                    x_scale = to_x_pixels / max(1e-6, xhi - xlo)
-                    y_offset = ylo
-                    y_scale = to_y_pixels / max(1e-6, yhi - ylo)
-                # Now draw the graph paper ...
-                # First, make label strings for the tick values (already set).
-                x_labels,x_scale_string = self.tick_labels( graph_tick_values_x )
-                n_x_labels = len(x_labels)
-                y_labels,y_scale_string = self.tick_labels( graph_tick_values_y )
-                n_y_labels = len(y_labels)
-                # Set drawing state for the graph paper.
-                c.set_font_size(14)
-                self.cairoSetLineWidth(c,0.5)
-                c.set_source_rgb(0.0,0.0,0.0)
-                # Draw the vertical lines for the horizontal axis.
-                for xc in graph_tick_values_x:
-                    c.move_to((xc-x_offset)*x_scale,to_y_pixels-(ylo-y_offset)*y_scale)
-                    c.line_to((xc-x_offset)*x_scale,to_y_pixels-(yhi-y_offset)*y_scale)
-                    c.stroke()
-                # Draw horizontal lines for the vertical axis.
-                for yc in graph_tick_values_y:
-                    c.move_to((xlo-x_offset)*x_scale,to_y_pixels-(yc-y_offset)*y_scale)
-                    c.line_to((xhi-x_offset)*x_scale,to_y_pixels-(yc-y_offset)*y_scale)
+                elif cmd[0] == 6: # Width.
+                    width = cmd[1]
+                    self.cairoSetLineWidth(c,width)
+                
+                elif cmd[0] == 7: # Bounds. xlo, ylo, xhi, yhi
+                    # Adjust the supplied bounds for any active zoom.
+                    if self.zoomed:
+                        xblo = cmd[1] + self.xlo_raw * (cmd[3] - cmd[1])
+                        xbhi = cmd[1] + self.xhi_raw * (cmd[3] - cmd[1])
+                        yblo = cmd[2] + self.ylo_raw * (cmd[4] - cmd[2])
+                        ybhi = cmd[2] + self.yhi_raw * (cmd[4] - cmd[2])
+                    else:
+                        xblo = cmd[1]
+                        xbhi = cmd[3]
+                        yblo = cmd[2]
+                        ybhi = cmd[4]
+                    # Find scales and offsets.
+                    if make_square:
+                        y_offset = yblo
+                        y_scale = to_y_pixels / max(1e-6, ybhi - yblo)
+                        x_offset = xblo
+                        x_scale = y_scale
+                        pass
+                    else:
+                        x_offset = xblo
+                        x_scale = to_x_pixels / max(1e-6, xbhi - xblo)
+                        y_offset = cmd[2]
+                        y_scale = to_y_pixels / max(1e-6, ybhi - yblo)
+
+                elif cmd[0] == 8: # Graph bounds. xlo, ylo, xhi, yhi
+                    # Adjust the supplied bounds for any active zoom.
+                    if self.zoomed:
+                        xblo = self.gxl + self.xlo_raw * (self.gxh - self.gxl)
+                        xbhi = self.gxl + self.xhi_raw * (self.gxh - self.gxl)
+                        yblo = self.gyl + self.ylo_raw * (self.gyh - self.gyl)
+                        ybhi = self.gyl + self.yhi_raw * (self.gyh - self.gyl)
+                    else:
+                        xblo = cmd[1]
+                        xbhi = cmd[3]
+                        yblo = cmd[2]
+                        ybhi = cmd[4]
+                    # Find tick values for each axis.
+                    if make_square:
+                        xmid = 0.5 * ( xblo + xbhi )
+                        xdelta = 0.5 * ((float(to_x_pixels) / float(to_y_pixels)) * (ybhi - yblo))
+                        graph_tick_values_x = self.tick_values( xmid-xdelta, xmid+xdelta, 15 )
+                    else:
+                        graph_tick_values_x = self.tick_values( xblo, xbhi, 15 )
+                    graph_tick_values_y = self.tick_values( yblo, ybhi, 10 )
+                    # Set the drawing bounds to the smallest and largest tick values on each axis.
+                    xlo = graph_tick_values_x[0]
+                    xhi = graph_tick_values_x[-1]
+                    ylo = graph_tick_values_y[0]
+                    yhi = graph_tick_values_y[-1]
+                    if not self.zoomed:
+                        self.gxl = xlo
+                        self.gxh = xhi
+                        self.gyl = ylo
+                        self.gyh = yhi
+                    # Find scales and offsets.
+                    if make_square:
+                        y_offset = ylo
+                        y_scale = to_y_pixels / max(1e-6, yhi - ylo)
+                        x_offset = xlo
+                        x_scale = y_scale
+                    else:
+                        x_offset = xlo
+                        x_scale = to_x_pixels / max(1e-6, xhi - xlo)
+                        y_offset = ylo
+                        y_scale = to_y_pixels / max(1e-6, yhi - ylo)
+                    # Now draw the graph paper ...
+                    # First, make label strings for the tick values (already set).
+                    x_labels,x_scale_string = self.tick_labels( graph_tick_values_x )
+                    n_x_labels = len(x_labels)
+                    y_labels,y_scale_string = self.tick_labels( graph_tick_values_y )
+                    n_y_labels = len(y_labels)
+                    # Set drawing state for the graph paper.
+                    c.set_font_size(14)
+                    self.cairoSetLineWidth(c,0.5)
+                    c.set_source_rgb(0.0,0.0,0.0)
+                    # Draw the vertical lines for the horizontal axis.
+                    for xc in graph_tick_values_x:
+                        c.move_to((xc-x_offset)*x_scale,to_y_pixels-(ylo-y_offset)*y_scale)
+                        c.line_to((xc-x_offset)*x_scale,to_y_pixels-(yhi-y_offset)*y_scale)
+                        c.stroke()
+                    # Draw horizontal lines for the vertical axis.
+                    for yc in graph_tick_values_y:
+                        c.move_to((xlo-x_offset)*x_scale,to_y_pixels-(yc-y_offset)*y_scale)
+                        c.line_to((xhi-x_offset)*x_scale,to_y_pixels-(yc-y_offset)*y_scale)
+                        c.stroke()
+                    # Horizontal axis labels.
+                    yc = (graph_tick_values_y[1] - y_offset) * y_scale
+                    for i in range(0,n_x_labels):
+                        xc = (graph_tick_values_x[i] - x_offset) * x_scale
+                        c.move_to(xc+0.5*self.charspace,to_y_pixels-(yc-0.7*self.linespace))
+                        c.show_text(x_labels[i])
+                    if len(x_scale_string) > 0:
+                        xc = (graph_tick_values_x[-2] - x_offset) * x_scale
+                        yc = (graph_tick_values_y[1] - y_offset ) * y_scale
+                        c.move_to(xc+0.5*self.charspace,to_y_pixels-(yc-2.2*self.linespace))
+                        c.show_text(x_scale_string)
+                    # Vertical axis labels.
+                    xc = (graph_tick_values_x[1] - x_offset) * x_scale
+                    for i in range(0,n_y_labels):
+                        yc = (graph_tick_values_y[i] - y_offset) * y_scale
+                        c.move_to(xc+0.5*self.charspace,to_y_pixels-(yc+0.2*self.linespace))
+                        c.show_text(y_labels[i])
+                    if len(y_scale_string) > 0:
+                        yc = (graph_tick_values_y[-2] - y_offset) * y_scale
+                        xc = (graph_tick_values_x[1] - x_offset ) * x_scale
+                        c.move_to(xc+0.5*self.charspace,to_y_pixels-(yc+1.7*self.linespace))
+                        c.show_text(y_scale_string)
+                    # Restore previous drawing state.
+                    c.set_source_rgb(gcolour[0], gcolour[1], gcolour[2])
+                    self.cairoSetLineWidth(c,width)
+                    c.set_font_size(fontsize)
+
+                elif cmd[0] == 9: # Graphics text: draw string at last move_to position.
+                    if textalign == 0: # Start at pos.
+                        c.move_to(pmx,to_y_pixels-pmy)
+                    else:
+                        txb, tyb, tw, th, tdx, tdy = c.text_extents(cmd[1])
+                        if textalign == 1: # Horizontal center on pos.
+                            c.move_to(pmx-tw//2,to_y_pixels-pmy)
+                        elif textalign == 2: # End at pos.
+                            c.move_to(pmx-tw,to_y_pixels-pmy)
+                        elif textalign == 3: # Center horizontally in the display.
+                            c.move_to((to_x_pixels-tw)//2,to_y_pixels-pmy)
+                    c.show_text(cmd[1])
+
+                elif cmd[0] == 10: # Font size.
+                    fontsize = int( cmd[1] )
+                    c.set_font_size(fontsize)
+
+                elif cmd[0] == 11: # Text alignment.
+                    textalign = int( cmd[1] )
+
+                elif cmd[0] == 12: # Font index.
+                    fontindex = max(0, min( len(fontnames)-1, int( cmd[1] ) ) )
+                    c.select_font_face( fontnames[fontindex], cairo.FONT_SLANT_NORMAL, cairo.FONT_WEIGHT_NORMAL )
+
+                elif cmd[0] == 13: # Draw a point marker.
+                    delta = int( 0.005 * to_x_pixels ) + 1
+                    gpos = cmd[1:]
+                    pmx = (gpos[0] - x_offset) * x_scale
+                    pmy = (gpos[1] - y_offset) * y_scale
+                    c.move_to( pmx-delta, to_y_pixels-pmy )
+                    c.line_to( pmx+delta, to_y_pixels-pmy )
+                    c.move_to( pmx, to_y_pixels-pmy-delta )
+                    c.line_to( pmx, to_y_pixels-pmy+delta )
                     c.stroke()
-                # Horizontal axis labels.
-                yc = (graph_tick_values_y[1] - y_offset) * y_scale
-                for i in range(0,n_x_labels):
-                    xc = (graph_tick_values_x[i] - x_offset) * x_scale
-                    c.move_to(xc+0.5*self.charspace,to_y_pixels-(yc-0.7*self.linespace))
-                    c.show_text(x_labels[i])
-                if len(x_scale_string) > 0:
-                    xc = (graph_tick_values_x[-2] - x_offset) * x_scale
-                    yc = (graph_tick_values_y[1] - y_offset ) * y_scale
-                    c.move_to(xc+0.5*self.charspace,to_y_pixels-(yc-2.2*self.linespace))
-                    c.show_text(x_scale_string)
-                # Vertical axis labels.
-                xc = (graph_tick_values_x[1] - x_offset) * x_scale
-                for i in range(0,n_y_labels):
-                    yc = (graph_tick_values_y[i] - y_offset) * y_scale
-                    c.move_to(xc+0.5*self.charspace,to_y_pixels-(yc+0.2*self.linespace))
-                    c.show_text(y_labels[i])
-                if len(y_scale_string) > 0:
-                    yc = (graph_tick_values_y[-2] - y_offset) * y_scale
-                    xc = (graph_tick_values_x[1] - x_offset ) * x_scale
-                    c.move_to(xc+0.5*self.charspace,to_y_pixels-(yc+1.7*self.linespace))
-                    c.show_text(y_scale_string)
-                # Restore previous drawing state.
-                c.set_source_rgb(gcolour[0], gcolour[1], gcolour[2])
-                self.cairoSetLineWidth(c,width)
-                c.set_font_size(fontsize)
-
-            elif cmd[0] == 9: # Graphics text: draw string at last move_to position.
-                if textalign == 0: # Start at pos.
-                    c.move_to(pmx,to_y_pixels-pmy)
-                else:
+                    gcp = numpy.asarray(gpos)
+                    if self.debuglevel > 2:
+                        print('point:', gcp)
+
+                elif cmd[0] == 14: # Draw a graph title.
+                    c.select_font_face( fontnames[1], cairo.FONT_SLANT_NORMAL, cairo.FONT_WEIGHT_NORMAL )
+                    c.set_font_size( 40 )
                     txb, tyb, tw, th, tdx, tdy = c.text_extents(cmd[1])
-                    if textalign == 1: # Horizontal center on pos.
-                        c.move_to(pmx-tw//2,to_y_pixels-pmy)
-                    elif textalign == 2: # End at pos.
-                        c.move_to(pmx-tw,to_y_pixels-pmy)
-                    elif textalign == 3: # Center horizontally in the display.
-                        c.move_to((to_x_pixels-tw)//2,to_y_pixels-pmy)
-                c.show_text(cmd[1])
-
-            elif cmd[0] == 10: # Font size.
-                fontsize = int( cmd[1] )
-                c.set_font_size(fontsize)
-
-            elif cmd[0] == 11: # Text alignment.
-                textalign = int( cmd[1] )
-
-            elif cmd[0] == 12: # Font index.
-                fontindex = max(0, min( len(fontnames)-1, int( cmd[1] ) ) )
-                c.select_font_face( fontnames[fontindex], cairo.FONT_SLANT_NORMAL, cairo.FONT_WEIGHT_NORMAL )
-
-            elif cmd[0] == 13: # Draw a point marker.
-                delta = int( 0.005 * to_x_pixels ) + 1
-                gpos = cmd[1:]
-                pmx = (gpos[0] - x_offset) * x_scale
-                pmy = (gpos[1] - y_offset) * y_scale
-                c.move_to( pmx-delta, to_y_pixels-pmy )
-                c.line_to( pmx+delta, to_y_pixels-pmy )
-                c.move_to( pmx, to_y_pixels-pmy-delta )
-                c.line_to( pmx, to_y_pixels-pmy+delta )
-                c.stroke()
-                gcp = numpy.asarray(gpos)
-                if self.debuglevel > 2:
-                    print('point:', gcp)
-
-            elif cmd[0] == 14: # Draw a graph title.
-                c.select_font_face( fontnames[1], cairo.FONT_SLANT_NORMAL, cairo.FONT_WEIGHT_NORMAL )
-                c.set_font_size( 40 )
-                txb, tyb, tw, th, tdx, tdy = c.text_extents(cmd[1])
-                c.move_to( (to_x_pixels-tw)//2,2.5*th)
-                c.show_text(cmd[1])
-                c.select_font_face( fontnames[fontindex], cairo.FONT_SLANT_NORMAL, cairo.FONT_WEIGHT_NORMAL )
-                c.set_font_size(fontsize)
-
-            elif cmd[0] == 15: # Draw a circle.
-                pmx = (cmd[1] - x_offset) * x_scale
-                pmy = (cmd[2] - y_offset) * y_scale
-                prd = cmd[3] * x_scale
-                c.arc( pmx, pmy, prd, 0, 2*math.pi )
-                c.stroke()
-                gcp = numpy.asarray([cmd[1], cmd[2]])
-                if self.debuglevel > 2:
-                    print('circle:', gcp)
+                    c.move_to( (to_x_pixels-tw)//2,2.5*th)
+                    c.show_text(cmd[1])
+                    c.select_font_face( fontnames[fontindex], cairo.FONT_SLANT_NORMAL, cairo.FONT_WEIGHT_NORMAL )
+                    c.set_font_size(fontsize)
+
+                elif cmd[0] == 15: # Draw a circle.
+                    pmx = (cmd[1] - x_offset) * x_scale
+                    pmy = (cmd[2] - y_offset) * y_scale
+                    prd = cmd[3] * x_scale
+                    c.arc( pmx, pmy, prd, 0, 2*math.pi )
+                    c.stroke()
+                    gcp = numpy.asarray([cmd[1], cmd[2]])
+                    if self.debuglevel > 2:
+                        print('circle:', gcp)
 
-            elif cmd[0] == 16: # Set/clear square mode.
-                self.make_square = ( cmd[1] > 0.0 )
+                elif cmd[0] == 16: # Set/clear square mode.
+                    make_square = ( cmd[1] > 0.0 )
 
-            elif cmd[0] == 17: # Relative Move.
-                gpos = cmd[1:]
-                pending_move = True
-                gcp += numpy.asarray(gpos)
-                pmx = (gcp[0] - x_offset) * x_scale
-                pmy = (gcp[1] - y_offset) * y_scale
-                if self.debuglevel > 2:
-                    print('relmove:', gcp)
-                
-            elif cmd[0] == 18: # Relative Draw. Add line segment to line.
-                if pending_move:
-                    c.move_to(pmx,to_y_pixels-pmy)
-                    pending_move = False
-                    inaline = True
-                if inaline:
+                elif cmd[0] == 17: # Relative Move.
                     gpos = cmd[1:]
+                    pending_move = True
                     gcp += numpy.asarray(gpos)
-                    x = (gcp[0] - x_offset) * x_scale
-                    y = (gcp[1] - y_offset) * y_scale
-                    c.line_to(x,to_y_pixels-y)
+                    pmx = (gcp[0] - x_offset) * x_scale
+                    pmy = (gcp[1] - y_offset) * y_scale
                     if self.debuglevel > 2:
-                        print('reldraw:', gcp)
+                        print('relmove:', gcp)
 
-        # If in a line after the last command, end the line.
+        # If in a line after the last command, end the line. Remember where it
+        # got to, so that a later call can carry on with it.
+        lastx = 0.0
+        lasty = 0.0
         if inaline:
+            (lastx,lasty) = c.get_current_point()
             c.stroke()
+        if tile == None:
+            self.make_square = make_square
+        state = {'generation':gcb.generation, 'next':len(gcb), 'dirty':dirty,
+                 'lastx':lastx, 'lasty':lasty, 'make_square':make_square,
+                 'vars':(inaline, pending_move, pmx, pmy, gcp, x_offset, x_scale, y_offset, y_scale,
+                         width, gcolour, fontsize, fontindex, textalign)}
 
         # Release the display list lock.
-        self.gcblockrelease()
+        if snapshot == None:
+            self.gcblockrelease()
         #********************************************************
+        return state
+
+    def cairoLineToInTile(self,c,xl,yl,tile,width):
+        """
+        Add line segments through the points xl,yl to the Cairo path, from the current point,
+        leaving out chunks of them that can not show in tile (x0, y0, x1, y1 in pixels).
+        A chunk is left out if its bounding box, padded for the line width and mitres, misses
+        the tile. The path carries on from the point before the next chunk that is drawn.
+        """
+        n = len(xl)
+        chunk = self.tile_chunk
+        px = numpy.asarray(xl)
+        py = numpy.asarray(yl)
+        starts = numpy.arange(0, n, chunk)
+        # The segments of a chunk start from the point before it.
+        before = numpy.maximum(starts - 1, 0)
+        xmin = numpy.minimum(numpy.minimum.reduceat(px, starts), px[before])
+        xmax = numpy.maximum(numpy.maximum.reduceat(px, starts), px[before])
+        ymin = numpy.minimum(numpy.minimum.reduceat(py, starts), py[before])
+        ymax = numpy.maximum(numpy.maximum.reduceat(py, starts), py[before])
+        (cx,cy) = c.get_current_point()
+        xmin[0] = min(xmin[0], cx)
+        xmax[0] = max(xmax[0], cx)
+        ymin[0] = min(ymin[0], cy)
+        ymax[0] = max(ymax[0], cy)
+        pad = 5.0 * width + 2.0
+        show = ((xmax >= tile[0] - pad) & (xmin <= tile[2] + pad) &
+                (ymax >= tile[1] - pad) & (ymin <= tile[3] + pad)).tolist()
+        for j in range(len(show)):
+            if show[j]:
+                s0 = j * chunk
+                if (j > 0) and (not show[j-1]):
+                    c.move_to(xl[s0-1],yl[s0-1])
+                for i in range(s0,min(n,s0+chunk)):
+                    c.line_to(xl[i],yl[i])
+        if not show[-1]:
+            c.move_to(xl[-1],yl[-1])
 
     def saveGraphics(self,filename):
         """
-        Save the graphics data to an SVG file using Cairo.
+        Save the graphics data to a PDF file if filename ends in .pdf, to a GTerm
+        display list file if it ends in .gdl, else to an SVG file.
+        A snapshot of the display list is taken and the file is written from it
+        on a separate thread, so that big plots do not hold up the GUI or the host.
         """
         if self.gcbcmds > 0:
             (root,ext) = os.path.splitext(filename)
-            outfilename = root + '.svg'
-            s = cairo.SVGSurface(outfilename,self.width_pixels,self.height_pixels) # watch out
-            c = cairo.Context(s)
-            self.cairoRenderGraphics(c,self.width_pixels,self.height_pixels) # watch out
-            s.finish()
+            ext = ext.lower()
+            if ext not in ('.pdf','.gdl'):
+                ext = '.svg'
+            #********************************************************
+            self.gcblockacquire()
+            snapshot = self.gcb.copy()
+            self.gcblockrelease()
+            #********************************************************
+            save_thread = threading.Thread(target=self.saveGraphicsSnapshot, \
+                                           args=(snapshot,root+ext,ext,self.width_pixels,self.height_pixels))
+            save_thread.start()
+
+    def saveGraphicsSnapshot(self,snapshot,outfilename,ext,imwidth,imheight):
+        """
+        Write display list snapshot to outfilename in the format given by ext.
+        Cairo writes the SVG or PDF to the file as it is produced.
+        NOTE WELL: This runs in its own thread.
+        """
+        try:
+            with open(outfilename,'wb') as f:
+                if ext == '.gdl':
+                    snapshot.save(f)
+                else:
+                    if ext == '.pdf':
+                        s = cairo.PDFSurface(f,imwidth,imheight) # watch out
+                    else:
+                        s = cairo.SVGSurface(f,imwidth,imheight) # watch out
+                    c = cairo.Context(s)
+                    self.cairoRenderGraphics(c,imwidth,imheight,snapshot=snapshot,lod=False) # watch out
+                    s.finish()
+            if self.debuglevel > 0:
+                print('Saved',len(snapshot),'graphics commands to',outfilename)
+        except Exception as e:
+            print('saveGraphics(): Failed to write:',outfilename)
+            print('... Reason:',e)
+
+    def loadGraphics(self,filename):
+        """
+        Replace the graphics data with that in a display list file written by saveGraphics().
+        """
+        try:
+            loaded = GraphicsDisplayList()
+            with open(filename,'rb') as f:
+                loaded.load(f)
+        except Exception as e:
+            print('loadGraphics(): Failed to read:',filename)
+            print('... Reason:',e)
+            return
+        #********************************************************
+        self.gcblockacquire()
+        # A new generation, so that renderers start again.
+        loaded.generation = self.gcb.generation + 1
+        self.gcb = loaded
+        self.gcbcmds = len(loaded)
+        self.gchanged = 2
+        self.gcblockrelease()
+        #********************************************************
+        self.trigger_doGrUpdate(30)
+
+    def cairoGraphicsKey(self,imwidth,imheight):
+        """
+        Everything other than the display list that the cached graphics image depends on.
+        """
+        if self.zoomed:
+            zoom = (self.xlo,self.ylo,self.xhi,self.yhi,self.xlo_raw,self.ylo_raw,self.xhi_raw,self.yhi_raw)
+        else:
+            zoom = None
+        return (imwidth,imheight,zoom,self.make_square)
 
     def cairoRenderGraphicsToTexture(self,imwidth,imheight):
         """
         Use Cairo to generate a higher quality screen image than OpenGL can manage.
         This renders to a texture then a rectangle with that texture is drawn to cover
         the graphics viewport (in paintGL()).
+        The image and texture are kept. Unless the size, zoom or square mode change, or
+        the display list is cleared, only commands added since the last call are drawn
+        and only the part of the image they drew in is copied to the texture.
         """
         if self.gcbcmds > 0:
-            s = cairo.ImageSurface(cairo.FORMAT_ARGB32, imwidth, imheight )
-            c = cairo.Context(s)
-            self.cairoRenderGraphics(c,imwidth,imheight)
-            self.crgraf_texture = glGenTextures(1)
-            glBindTexture(GL_TEXTURE_2D,self.crgraf_texture)
+            state = self.crgraf_state
+            if (self.crgraf_context == None) or (self.cairoGraphicsKey(imwidth,imheight) != self.crgraf_key):
+                # Render everything again.
+                state = None
+                if (self.crgraf_surface == None) or (self.crgraf_surface.get_width() != imwidth) or \
+                   (self.crgraf_surface.get_height() != imheight):
+                    self.crgraf_surface = cairo.ImageSurface(cairo.FORMAT_ARGB32, imwidth, imheight )
+                self.crgraf_context = cairo.Context(self.crgraf_surface)
+            elif (state['generation'] == self.gcb.generation) and (state['next'] == len(self.gcb)):
+                # Nothing new to draw.
+                return
+            if (state == None) and self.tiled_graphics and (self.tile_workers > 1) and \
+               (len(self.gcb) >= self.tile_min_commands):
+                state = self.cairoRenderGraphicsTiled(imwidth,imheight)
+            else:
+                state = self.cairoRenderGraphics(self.crgraf_context,imwidth,imheight,state)
+            self.crgraf_state = state
+            self.crgraf_key = self.cairoGraphicsKey(imwidth,imheight)
+            s = self.crgraf_surface
+            s.flush()
             s_data = s.get_data()
+            stride = s.get_stride()
+            if self.crgraf_texture == None:
+                self.crgraf_texture = glGenTextures(1)
+            glBindTexture(GL_TEXTURE_2D,self.crgraf_texture)
             glPixelStorei(GL_UNPACK_ALIGNMENT,1)
-            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP )
-            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP )
-            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST )
-            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST )
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, imwidth, imheight, 0, GL_BGRA, \
-                             GL_UNSIGNED_INT_8_8_8_8_REV, s_data)
+            glPixelStorei(GL_UNPACK_ROW_LENGTH,stride//4)
+            dirty = state['dirty']
+            if (self.crgraf_texsize != (imwidth,imheight)) or (dirty == None):
+                glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP )
+                glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP )
+                glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST )
+                glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST )
+                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, imwidth, imheight, 0, GL_BGRA, \
+                                 GL_UNSIGNED_INT_8_8_8_8_REV, s_data)
+                self.crgraf_texsize = (imwidth,imheight)
+            else:
+                # Copy just the box that was drawn in.
+                x0 = max(0, int(dirty[0]))
+                y0 = max(0, int(dirty[1]))
+                x1 = min(imwidth, int(math.ceil(dirty[2]))+1)
+                y1 = min(imheight, int(math.ceil(dirty[3]))+1)
+                if (x1 > x0) and (y1 > y0):
+                    glPixelStorei(GL_UNPACK_SKIP_PIXELS,x0)
+                    glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, x1-x0, y1-y0, GL_BGRA, \
+                                        GL_UNSIGNED_INT_8_8_8_8_REV, s_data[y0*stride:y1*stride])
+                    glPixelStorei(GL_UNPACK_SKIP_PIXELS,0)
+            glPixelStorei(GL_UNPACK_ROW_LENGTH,0)
+
+    def cairoRenderGraphicsTiled(self,imwidth,imheight):
+        """
+        Render the whole graphics command buffer into self.crgraf_surface as one band of
+        rows per worker thread. Each band is drawn into its own image surface by
+        cairoRenderTile() and they are then copied into place. The bands all go through
+        the whole display list, but leave out long runs of draws that miss them. Pycairo
+        lets other threads run while Cairo strokes, fills and draws text, so rasterising
+        is spread over the cores. Returns the state to carry on from, as
+        cairoRenderGraphics() does, with a fresh context on the surface set up to match.
+        """
+        if self.tile_pool == None:
+            self.tile_pool = concurrent.futures.ThreadPoolExecutor(max_workers=self.tile_workers)
+        rows = (imheight + self.tile_workers - 1) // self.tile_workers
+        tiles = [(0, y0, imwidth, min(imheight, y0 + rows)) for y0 in range(0, imheight, rows)]
+
+        # The workers read the display list while this thread holds its lock.
+        #********************************************************
+        self.gcblockacquire()
+        try:
+            futures = [self.tile_pool.submit(self.cairoRenderTile,tile,imwidth,imheight) for tile in tiles]
+            results = [future.result() for future in futures]
+        finally:
+            self.gcblockrelease()
+        #********************************************************
+
+        # Copy the tiles into the surface.
+        s = self.crgraf_surface
+        s.flush()
+        image = numpy.ndarray((imheight, s.get_stride()), dtype=numpy.uint8, buffer=s.get_data())
+        for (tile, (surface, state)) in zip(tiles, results):
+            surface.flush()
+            part = numpy.ndarray((surface.get_height(), surface.get_stride()), dtype=numpy.uint8,
+                                 buffer=surface.get_data())
+            image[tile[1]:tile[3], 4*tile[0]:4*tile[2]] = part[:, 0:4*(tile[2]-tile[0])]
+        s.mark_dirty()
+
+        # Set up the drawing state that later calls carry on with.
+        (inaline, pending_move, pmx, pmy, gcp, x_offset, x_scale, y_offset, y_scale,
+         width, gcolour, fontsize, fontindex, textalign) = state['vars']
+        c = cairo.Context(s)
+        c.select_font_face( self.cairo_fontnames[fontindex], cairo.FONT_SLANT_NORMAL, cairo.FONT_WEIGHT_NORMAL )
+        c.set_font_size( fontsize )
+        self.cairoSetLineWidth(c,width)
+        c.set_source_rgb(gcolour[0], gcolour[1], gcolour[2])
+        self.crgraf_context = c
+        self.make_square = state['make_square']
+        state['dirty'] = None
+        return state
+
+    def cairoRenderTile(self,tile,imwidth,imheight):
+        """
+        Render the part of the graphics image in tile (x0, y0, x1, y1 in pixels) into a new
+        image surface. Returns the surface and the renderer state.
+        NOTE WELL: This runs on a worker thread while the display list lock is held for it.
+        """
+        surface = cairo.ImageSurface(cairo.FORMAT_ARGB32, tile[2]-tile[0], tile[3]-tile[1])
+        c = cairo.Context(surface)
+        c.translate(-tile[0],-tile[1])
+        state = self.cairoRenderGraphics(c,imwidth,imheight,snapshot=self.gcb,tile=tile)
+        return (surface, state)
+
+    def setTiledGraphics(self,yes):
+        """
+        Split full Cairo redraws of big display lists into tiles drawn on worker threads.
+        """
+        self.tiled_graphics = yes
+        self.update()
+
+    def setGLGraphics(self,yes):
+        """
+        Draw graphics with OpenGL vertex buffers instead of Cairo, when possible.
+        """
+        self.gl_graphics = yes
+        self.update()
+
+    def glRenderGraphics(self,imwidth,imheight):
+        """
+        Draw the graphics command buffer with OpenGL. The display list is turned into
+        triangles once, as commands arrive (GraphicsVertexBuffer), and kept in a vertex
+        buffer. Zoom, square mode and size changes only change shader uniforms.
+        Returns False if OpenGL drawing is not wanted or can not draw this display list.
+        """
+        if (not self.gl_graphics) or self.glgraf_failed:
+            return False
+        # Compile the shaders the first time through.
+        if self.glgraf_program == None:
+            try:
+                self.glgraf_program = shaders.compileProgram(
+                    shaders.compileShader(graphics_vertex_shader, GL_VERTEX_SHADER),
+                    shaders.compileShader(graphics_fragment_shader, GL_FRAGMENT_SHADER))
+                self.glgraf_buffer = glGenBuffers(1)
+                self.glgraf_locations = {}
+                for (name,offset,size) in GraphicsVertexBuffer.attributes:
+                    self.glgraf_locations[name] = glGetAttribLocation(self.glgraf_program, name)
+                for name in ('view','zoom','zoomraw','zoomed','square'):
+                    self.glgraf_locations[name] = glGetUniformLocation(self.glgraf_program, name)
+            except Exception as e:
+                print('OpenGL graphics not available, using Cairo. Reason:', e)
+                self.glgraf_failed = True
+                return False
+        # Add triangles for new commands.
+        vb = self.glgraf_vertices
+        #********************************************************
+        self.gcblockacquire()
+        vb.update(self.gcb)
+        self.gcblockrelease()
+        #********************************************************
+        if vb.unsupported:
+            return False
+        # Give OpenGL the new vertices. Everything again if the buffer must grow.
+        glBindBuffer(GL_ARRAY_BUFFER, self.glgraf_buffer)
+        vsize = vb.vertices.itemsize * vb.nfloats
+        if len(vb.vertices) * vsize > self.glgraf_bufsize:
+            self.glgraf_bufsize = len(vb.vertices) * vsize
+            glBufferData(GL_ARRAY_BUFFER, self.glgraf_bufsize, None, GL_DYNAMIC_DRAW)
+            vb.firstnew = 0
+        if vb.nverts > vb.firstnew:
+            glBufferSubData(GL_ARRAY_BUFFER, vb.firstnew * vsize, (vb.nverts - vb.firstnew) * vsize,
+                            vb.vertices[vb.firstnew:vb.nverts])
+            vb.firstnew = vb.nverts
+        # Draw.
+        glClearColor(vb.background[0], vb.background[1], vb.background[2], 1.0)
+        glClear(GL_COLOR_BUFFER_BIT)
+        glDisable(GL_TEXTURE_2D)
+        glUseProgram(self.glgraf_program)
+        loc = self.glgraf_locations
+        glUniform2f(loc['view'], imwidth, imheight)
+        glUniform4f(loc['zoom'], self.xlo, self.ylo, self.xhi, self.yhi)
+        if self.zoomed:
+            glUniform4f(loc['zoomraw'], self.xlo_raw, self.ylo_raw, self.xhi_raw, self.yhi_raw)
+        glUniform1f(loc['zoomed'], 1.0 if self.zoomed else 0.0)
+        glUniform1f(loc['square'], 1.0 if self.make_square else 0.0)
+        for (name,offset,size) in GraphicsVertexBuffer.attributes:
+            glEnableVertexAttribArray(loc[name])
+            glVertexAttribPointer(loc[name], size, GL_FLOAT, GL_FALSE, vsize,
+                                  ctypes.c_void_p(offset * vb.vertices.itemsize))
+        glDrawArrays(GL_TRIANGLES, 0, vb.nverts)
+        for (name,offset,size) in GraphicsVertexBuffer.attributes:
+            glDisableVertexAttribArray(loc[name])
+        glUseProgram(0)
+        glBindBuffer(GL_ARRAY_BUFFER, 0)
+        return True
 
     def setScroll(self,scrollvalue):
         """
@@ -3407,6 +5357,64 @@ class GTermWidget(QOpenGLWidget):
         self.scroll = min( self.maxlines, max( 0, scrollvalue ) )
         self.update()
 
+    def findText(self,text,older=False):
+        """
+        Search the scroll buffer for text, ignoring case, and scroll to and highlight the
+        line found. Searches back from the line last found: with older False (more of the
+        text has been typed) that line can be found again, else the search starts above it.
+        Empty text removes the highlight. Returns False if text is not found.
+        """
+        codes = [ord(c) for c in text]
+        found = None
+        #********************************************************
+        self.screenlockacquire()
+        if len(codes) == 0:
+            self.find_line = None
+        else:
+            if (self.find_line == None) or (self.find_generation != self.screen.generation):
+                before = self.screen.added
+            elif older:
+                before = self.find_line
+            else:
+                before = self.find_line + 1
+            found = self.screen_index.find(codes,before)
+            if found != None:
+                self.find_line = found
+                self.find_generation = self.screen.generation
+                j = found - (self.screen.added - len(self.screen))
+                self.scroll = min( self.maxlines, max( 0, len(self.screen) - j - self.visiblelines // 2 ) )
+        self.screenlockrelease()
+        #********************************************************
+        self.update()
+        return (found != None) or (len(codes) == 0)
+
+    def indexScrollback(self):
+        """
+        Timer: index some of any lines added to the scroll buffer, so that findText()
+        seldom has many to index first.
+        """
+        if self.screen_index.behind():
+            #********************************************************
+            self.screenlockacquire()
+            self.screen_index.update(self.index_chunk)
+            self.screenlockrelease()
+            #********************************************************
+
+    def setHistoryLines(self,nlines):
+        """
+        Set the number of lines kept in the scroll buffer.
+        """
+        #********************************************************
+        self.screenlockacquire()
+        self.maxlines = max( 100, int(nlines) )
+        self.screen.resize(self.maxlines)
+        self.scroll = min( self.maxlines, self.scroll )
+        self.changed = 2
+        self.markDirtyAll()
+        self.screenlockrelease()
+        #********************************************************
+        self.update()
+
     def deltaScroll(self,deltascrollvalue):
         """
         Add deltascrollvalue to the text scroll value.
@@ -3454,17 +5462,46 @@ class GTermTelnetWidget(GTermWidget):
     """
     Implement a glass teletype connected to a remote host via telnet.
     """
+    # Session record files are ctelnet --trace files (see ctelnet_trace.h), so that
+    # ctdecode and ctreplay work with them. Native byte order, like ctelnet writes.
+    record_header = struct.Struct('=8sIIqq')
+    record_entry = struct.Struct('=QIHBB')
+
     def __init__(self, charsetname='unknown',vkbname='unknown',umapname='unknown',parent=None):
         super(GTermTelnetWidget, self).__init__(charsetname,vkbname,umapname,parent)
         self.telnet = None
         self.scr_thread = None
+        # Data received is queued by the reading thread and applied on the main thread.
+        self.received = ReceiveRing()
+        self.drainReceived_signal_object = drainReceived_signal_class()
+        self.drainReceived_signalled = False
+        self.drain_timer = QTimer(self)
+        self.drain_timer.setSingleShot(True)
+        self.drain_timer.timeout.connect(lambda: self.drainReceived(1))
+        self.frecord = None
+        self.record_start = 0
+        self.recordlock = threading.Lock()
+        self.stat_send_calls = 0
+        self.stat_bytes_out = 0
         self.localecho = False
         self.haveconnection = False
+        # Connecting: seconds allowed, and reconnecting when the host closes the connection.
+        self.connect_timeout = 5.0
+        self.reconnect = False
+        self.reconnect_host = None
+        self.reconnect_port = 0
+        self.reconnect_min = 0.25
+        self.reconnect_max = 4.0
+        # Held while a connection is made and started, by Connect or a reconnect thread.
+        self.connect_lock = threading.Lock()
+        # Set to stop the reconnect thread, if there is one, from trying again.
+        self.reconnect_stop = threading.Event()
         self.char_to_string_map = None
         self.terminate_char = 3 # Ctrl-C default interrupt character.
         self.history_line = []
-        self.history_buffer = []
         self.history_max = 512
+        self.history_buffer = collections.deque(maxlen=self.history_max)
+        self.history_prefix = []
         self.history_level = -1
         self.local_recall = False
         self.edit_offset = 0
@@ -3475,32 +5512,102 @@ class GTermTelnetWidget(GTermWidget):
         """
         Open a connection to a remote host.
         Host is a string, port is an integer.
+        Any reconnect still trying is stopped first. If it has just connected, that
+        connection is kept and no other is made.
         """
-        try:
-            self.telnet = XTelnet(host,port)
-            self.telnet.set_data_received_function(self.data_received)
-            self.telnet.set_eof_func(self.telnet_eof_func)
-            if debuglevel > 0:
-                self.telnet.set_debuglevel(debuglevel)
-            #self.telnet.set_debuglevel(10)
-            # Reading data from the remote host needs to be done on a separate thread.
-            self.scr_thread = threading.Thread(target=readserver_thread, args=(self.telnet,0))
-            self.scr_thread.start()
-            self.haveconnection = True
-            self.connect_time = time.strftime("%a %d %b %Y %X", time.localtime())
-        except:
-            self.telnet = None
-            self.haveconnection = False
-            self.connect_time = 'Zero'
-            errstring = 'Cannot connect to: {0} at port: {1}.'.format(host,port)
-            self.screenAddString(errstring)
+        self.cancel_reconnect()
+        #********************************************************
+        with self.connect_lock:
+            if self.haveconnection:
+                return
+            try:
+                telnet = XTelnet(host,port,self.connect_timeout)
+                if debuglevel > 0:
+                    telnet.set_debuglevel(debuglevel)
+                #telnet.set_debuglevel(10)
+                self.startTelnet(telnet)
+                # Reading data from the remote host needs to be done on a separate thread.
+                self.scr_thread = threading.Thread(target=readserver_thread, args=(self.telnet,0))
+                self.scr_thread.start()
+                self.reconnect_host = host
+                self.reconnect_port = port
+            except:
+                self.telnet = None
+                self.haveconnection = False
+                self.connect_time = 'Zero'
+                errstring = 'Cannot connect to: {0} at port: {1}.'.format(host,port)
+                self.screenAddString(errstring)
+        #********************************************************
+
+    def startTelnet(self,telnet):
+        """
+        Start using a newly connected XTelnet. Call with connect_lock held.
+        """
+        telnet.set_data_received_function(self.data_received)
+        telnet.set_raw_received_function(self.raw_received)
+        telnet.set_eof_func(self.telnet_eof_func)
+        self.telnet = telnet
+        self.haveconnection = True
+        self.connect_time = time.strftime("%a %d %b %Y %X", time.localtime())
 
     def telnet_eof_func(self):
         """
         Function called when the Telnet connection closes.
         """
-        self.screenAddString('\r\nTelnet connection closed by remote host.')
         self.haveconnection = False
+        if self.reconnect and self.reconnect_host != None:
+            self.queueReceived('\r\nTelnet connection closed by remote host. Reconnecting ...')
+            self.reconnect_stop = threading.Event()
+            self.scr_thread = threading.Thread(target=self.reconnectHost, args=(self.reconnect_stop,), daemon=True)
+            self.scr_thread.start()
+        else:
+            self.queueReceived('\r\nTelnet connection closed by remote host.')
+
+    def reconnectHost(self,stop):
+        """
+        Connect to the host again after it closed the connection, e.g. because DtCyber
+        was restarted. Runs on its own thread, which then reads from the new connection.
+        Each failed try doubles the wait before the next, from reconnect_min up to
+        reconnect_max seconds. A host that is up but not yet listening refuses at once,
+        so the session is back within reconnect_max seconds of the host being ready.
+        stop is set by cancel_reconnect() (Connect, or Reconnect turned off). The new
+        connection is only used if it has not been set, and nothing else has connected.
+        """
+        delay = self.reconnect_min
+        while self.reconnect and not self.haveconnection:
+            if stop.wait(delay):
+                return
+            try:
+                telnet = XTelnet(self.reconnect_host,self.reconnect_port,self.connect_timeout)
+            except Exception:
+                delay = min(2.0*delay,self.reconnect_max)
+                continue
+            #********************************************************
+            with self.connect_lock:
+                if stop.is_set() or self.haveconnection:
+                    telnet.close()
+                    return
+                self.startTelnet(telnet)
+            #********************************************************
+            self.queueReceived('\r\nReconnected.\r\n')
+            readserver_thread(telnet,0)
+            return
+        if not self.haveconnection:
+            self.queueReceived('\r\nNot reconnecting.')
+
+    def cancel_reconnect(self):
+        """
+        Stop the reconnect thread, if there is one, from trying again.
+        """
+        self.reconnect_stop.set()
+
+    def set_reconnect(self,yes):
+        """
+        Turn reconnecting when the host closes the connection on or off.
+        """
+        self.reconnect = yes
+        if not yes:
+            self.cancel_reconnect()
 
     def data_received(self,recvstr):
         """
@@ -3511,7 +5618,87 @@ class GTermTelnetWidget(GTermWidget):
             print('>>>>',recvstr)
         if self.debuglevel > 2:
             dumpData(recvstr)
-        self.screenAddString(recvstr)
+        self.queueReceived(recvstr)
+
+    def raw_received(self,buf):
+        """
+        Record data from the remote host as received, Telnet commands included, as
+        ctelnet --trace does. Runs on the reading thread.
+        """
+        self.recordData('I',buf)
+
+    def openRecordFile(self,filename):
+        """
+        Start recording the session to filename: each string received from or sent to
+        the host, with when it was. Returns False if the file could not be created.
+        """
+        try:
+            frecord = open(filename,'wb')
+            wall = time.time_ns()
+            frecord.write(self.record_header.pack(b'CTTRACE1', 0x01020304, 1, wall // 1000000000, wall % 1000000000))
+        except Exception as e:
+            print('Could not create session record file:',filename)
+            print('... Reason:',e)
+            return False
+        self.closeRecordFile()
+        with self.recordlock:
+            self.record_start = time.monotonic_ns()
+            self.frecord = frecord
+        return True
+
+    def recordData(self,direction,data):
+        """
+        Add data sent ('O') or received ('I') to the session record file, if one is open.
+        NOTE WELL: This is called on the reading thread as well as the main thread.
+        """
+        if self.frecord != None:
+            with self.recordlock:
+                if self.frecord != None:
+                    ns = time.monotonic_ns() - self.record_start
+                    self.frecord.write(self.record_entry.pack(ns, len(data), 0, ord(direction), 0))
+                    self.frecord.write(data)
+
+    def closeRecordFile(self):
+        """
+        Stop recording the session.
+        """
+        with self.recordlock:
+            if self.frecord != None:
+                self.frecord.close()
+                self.frecord = None
+
+    def queueReceived(self,recvstr):
+        """
+        Queue a string for drainReceived() to add to the screen on the main thread.
+        This does not touch the screen or graphics state, so the reading thread
+        never waits for painting. If the queue is full, wait for the main thread
+        to catch up rather than lose data.
+        """
+        item = (time.monotonic(),recvstr)
+        while not self.received.push(item):
+            time.sleep(0.001)
+        if not self.drainReceived_signalled:
+            self.drainReceived_signalled = True
+            self.drainReceived_signal_object.signal.emit(0)
+
+    def drainReceived(self,location):
+        """
+        Add everything queued by queueReceived() to the screen. Runs on the main thread.
+        If this takes longer than a frame interval, carry on later so the screen can be repainted.
+        """
+        self.drainReceived_signalled = False
+        deadline = time.monotonic() + 1.0/self.max_fps
+        while True:
+            item = self.received.pop()
+            if item is None:
+                break
+            (when,recvstr) = item
+            if self.rx_waiting == None:
+                self.rx_waiting = when
+            self.screenAddString(recvstr)
+            if time.monotonic() > deadline:
+                self.drain_timer.start(0)
+                break
 
     def set_local_echo(self,yes):
         """
@@ -3540,7 +5727,40 @@ class GTermTelnetWidget(GTermWidget):
 
     def telnet_write(self,charstring):
         bytestring = charstring.encode('ASCII')
+        self.recordData('O',bytestring)
         self.telnet.write(bytestring)
+        self.stat_send_calls += 1
+        self.stat_bytes_out += len(bytestring)
+        if self.key_time != None:
+            self.key_latency.add(time.monotonic() - self.key_time)
+            self.key_time = None
+
+    def statsText(self):
+        """
+        Return the statistics as a list of lines of text.
+        """
+        lines = []
+        if self.telnet != None:
+            lines.append('Received: {0} bytes in {1} reads, {2} Telnet commands.'\
+                         .format(self.telnet.stat_bytes_in,self.telnet.stat_recv_calls,self.telnet.stat_commands))
+        lines.append('Sent: {0} bytes in {1} writes.'.format(self.stat_bytes_out,self.stat_send_calls))
+        lines.append('Key press to sent: ' + self.key_latency.summary())
+        lines.append('Received to on screen: ' + self.rx_latency.summary())
+        lines.append('Repaints: ' + self.paint_time.summary())
+        lines.append('Receive queue: {0} waiting.'.format(len(self.received)))
+        lines.append('Display list: {0} entries, {1} KB, from {2} graphics commands.'\
+                     .format(len(self.gcb),(self.gcb.ops.nbytes + self.gcb.args.nbytes) // 1024,self.gcbcmds))
+        lines.append('Scrollback: {0} lines.'.format(len(self.screen)))
+        return lines
+
+    def printStats(self):
+        """
+        Print the statistics on stdout (on SIGUSR1).
+        """
+        print('GTerm statistics at', time.strftime("%X"))
+        for line in self.statsText():
+            print('   ',line)
+        sys.stdout.flush()
 
     def send_char(self,char):
         """
@@ -3583,8 +5803,6 @@ class GTermTelnetWidget(GTermWidget):
         """
         if self.local_recall:
             self.history_buffer.append(self.history_line)
-            if len(self.history_buffer) > self.history_max:
-                self.history_buffer.pop(0)
             self.history_line = []
             if self.debuglevel > 2:
                 for ihist in range(len(self.history_buffer)-1,-1,-1):
@@ -3608,10 +5826,17 @@ class GTermTelnetWidget(GTermWidget):
             self.edit_offset = 0
             self.set_cursor_char_offset(self.edit_offset)
             self.screenClearLine()
-            for c in self.history_buffer[len(self.history_buffer)-self.history_level-1]:
+            # Anything typed before searching the history for it has already been sent.
+            sendline = self.history_buffer[len(self.history_buffer)-self.history_level-1]
+            nprefix = len(self.history_prefix)
+            if (nprefix > 0) and (list(sendline[0:nprefix]) == self.history_prefix):
+                sendline = sendline[nprefix:]
+            for c in sendline:
                 self.sendCharacterStringMapped(c)
             self.send_char(13)
             self.history_level = -1
+            self.history_line = []
+            self.history_prefix = []
         # No selected history line. Send the current (newly entered) line.
         # If doing local recall processing, add that line to the history buffer.
         else:
@@ -3724,23 +5949,43 @@ class GTermTelnetWidget(GTermWidget):
         else:
             self.send_char(charnum)
 
+    def historyFind(self, prefix, level, step):
+        """
+        Return the history level of the next history line that starts with prefix,
+        stepping from level to older (step 1) or newer (step -1) lines. If there is
+        none, stay at level going older, or leave history recall (-1) going newer.
+        """
+        lh = len(self.history_buffer)
+        nprefix = len(prefix)
+        ilevel = level + step
+        while (ilevel >= 0) and (ilevel < lh):
+            hline = self.history_buffer[lh-ilevel-1]
+            if (len(hline) >= nprefix) and (list(hline[0:nprefix]) == prefix):
+                return ilevel
+            ilevel += step
+        if step > 0:
+            return level
+        return -1
+
     def specialUnfancyKey(self, charnum):
         """
         Field special keys not mapped by fancykeymap.
         This is used for the arrow keys for local history management.
+        If something has been typed before the first up arrow, only history lines
+        starting with it are recalled.
         """
         if self.local_recall:
             lh = len(self.history_buffer)
             phl = self.history_level
             # Handle moving to new history lines.
             if charnum == Qt.Key_Up:
-                # Move to one earlier history line.
-                self.history_level += 1
-                self.history_level = min( self.history_level, lh-1 )
+                # Move to an earlier history line.
+                if phl == -1:
+                    self.history_prefix = list(self.history_line)
+                self.history_level = self.historyFind(self.history_prefix, self.history_level, 1)
             elif charnum == Qt.Key_Down:
-                # Move to one later history line (exit history recall if history level reaches -1).
-                self.history_level -= 1
-                self.history_level = max( self.history_level, -1 )
+                # Move to a later history line (exit history recall if history level reaches -1).
+                self.history_level = self.historyFind(self.history_prefix, self.history_level, -1)
             # If moved to a new history line, set cursor to the end of that line.
             if (charnum == Qt.Key_Up) or (charnum == Qt.Key_Down):
                 self.edit_offset = 0
@@ -3764,10 +6009,11 @@ class GTermTelnetWidget(GTermWidget):
                 # Display the selected history line.
                 self.screenClearLine()
                 self.screenAddCodesArray(viewing_line)
-            # No longer in history recall. If previouly in it, clear the current line display.
+            # No longer in history recall. If previouly in it, show what was typed before it (if anything).
             else:
                 if phl > -1:
                     self.screenClearLine(True)
+                    self.screenAddCodesArray(self.history_prefix)
             
     def event(self,event):
         """
@@ -3788,7 +6034,8 @@ class GTermTelnetWidget(GTermWidget):
                      Qt.Key_Home:6,
                      Qt.Key_A:7,
                      Qt.Key_S:8,
-                     Qt.Key_V:9}
+                     Qt.Key_V:9,
+                     Qt.Key_F:10}
         spckeymap = {Qt.Key_PageUp:4,
                      Qt.Key_PageDown:5,
                      Qt.Key_Home:6}
@@ -3962,6 +6209,17 @@ def yns(logical):
     else:
         return "Off"
 
+# Digits for the deltas in ESC[L...z polyline graphics commands. Each delta is zigzag
+# encoded (0,-1,1,-2,... to 0,1,2,3,...) then sent 5 bits at a time, least significant
+# first, with a polyline_more_digits character for each 5 bits but the last, which is
+# a polyline_last_digits character. None of these characters ends an ANSI sequence.
+polyline_last_digits = '0123456789LMNOPQRUVWXYabcdegijko'
+polyline_more_digits = '!#%&()*+,-./:;<=>?]^_{|}pqrtvwxy'
+polyline_digit_values = {}
+for i in range(0,32):
+    polyline_digit_values[ord(polyline_last_digits[i])] = (i,False)
+    polyline_digit_values[ord(polyline_more_digits[i])] = (i,True)
+
 # Cyber APL 2 batch codes to extended character number map.
 cyber_apl_in_map = \
     {'$ml':200,'$dv':146,'$mx':198,'$mn':197,'$lg':254,
@@ -4115,6 +6373,10 @@ class TerminalDialog(QDialog):
         self.ffClearsCheckBox = QCheckBox("FF clears")
         self.onPaperCheckBox = QCheckBox("On paper")
         self.noEscapeCheckBox = QCheckBox("No escape")
+        self.glGraphicsCheckBox = QCheckBox("GL graphics")
+        self.tiledGraphicsCheckBox = QCheckBox("Tiled")
+        self.recordCheckBox = QCheckBox("Record")
+        self.reconnectCheckBox = QCheckBox("Reconnect")
         checkboxLayout = QHBoxLayout()
         checkboxLayout.addWidget(self.modeComboBox)
         checkboxLayout.addWidget(self.showVkbCheckBox)
@@ -4124,6 +6386,10 @@ class TerminalDialog(QDialog):
         checkboxLayout.addWidget(self.ffClearsCheckBox)
         checkboxLayout.addWidget(self.onPaperCheckBox)
         checkboxLayout.addWidget(self.noEscapeCheckBox)
+        checkboxLayout.addWidget(self.glGraphicsCheckBox)
+        checkboxLayout.addWidget(self.tiledGraphicsCheckBox)
+        checkboxLayout.addWidget(self.recordCheckBox)
+        checkboxLayout.addWidget(self.reconnectCheckBox)
         checkboxLayout.addWidget(self.viewComboBox)
         # Second horizontal group of PyQt widgets.
         # Set default host to be localhost, port 23, unix mode.
@@ -4135,6 +6401,7 @@ class TerminalDialog(QDialog):
         self.clearPushButton = QPushButton("Clear")
         self.logRenameButton = QPushButton("Save log")
         self.saveGrafButton = QPushButton("Save graphics")
+        self.loadGrafButton = QPushButton("Load graphics")
         self.hostsComboBox = QComboBox()
         for hostrecord in self.hostinfo:
             self.hostsComboBox.addItem(hostrecord[0])
@@ -4142,6 +6409,14 @@ class TerminalDialog(QDialog):
         self.guideComboBox = QComboBox()
         self.guideComboBox.addItems(["No guide","Fortran"])
         self.statusButton = QPushButton("Status")
+        labelfind = QLabel("Find:")
+        self.findEdit = QLineEdit()
+        labelhistory = QLabel("History:")
+        self.historySpinbox = QSpinBox()
+        self.historySpinbox.setRange(100,1000000)
+        self.historySpinbox.setSingleStep(1000)
+        self.historySpinbox.setValue(self.screen.maxlines)
+        self.historySpinbox.setKeyboardTracking(False)
         buttonLayout = QHBoxLayout()
         buttonLayout.addWidget(self.hostAddressEdit)
         buttonLayout.addWidget(self.portNumberSpinbox)
@@ -4151,7 +6426,12 @@ class TerminalDialog(QDialog):
         buttonLayout.addWidget(self.clearPushButton)
         buttonLayout.addWidget(self.logRenameButton)
         buttonLayout.addWidget(self.saveGrafButton)
+        buttonLayout.addWidget(self.loadGrafButton)
         buttonLayout.addWidget(self.guideComboBox)
+        buttonLayout.addWidget(labelhistory)
+        buttonLayout.addWidget(self.historySpinbox)
+        buttonLayout.addWidget(labelfind)
+        buttonLayout.addWidget(self.findEdit)
         buttonLayout.addWidget(self.statusButton)
         # Assemble the groups vertically
         layout = QVBoxLayout()
@@ -4169,15 +6449,24 @@ class TerminalDialog(QDialog):
         self.viewComboBox.currentIndexChanged.connect(self.view)
         self.logRenameButton.clicked.connect(self.renamelog)
         self.saveGrafButton.clicked.connect(self.savegraf)
+        self.loadGrafButton.clicked.connect(self.loadgraf)
         self.ffClearsCheckBox.stateChanged.connect(self.ffmode)
         self.onPaperCheckBox.stateChanged.connect(self.onpaper)
+        self.historySpinbox.valueChanged.connect(self.historylines)
+        self.findEdit.textEdited.connect(self.findtext)
+        self.findEdit.returnPressed.connect(self.findolder)
         self.hostsComboBox.currentIndexChanged.connect(self.selectknownhost)
         self.statusButton.clicked.connect(self.showstatus)
         self.guideComboBox.currentIndexChanged.connect(self.guide)
         self.noEscapeCheckBox.stateChanged.connect(self.noescapemode)
+        self.glGraphicsCheckBox.stateChanged.connect(self.glgraphics)
+        self.tiledGraphicsCheckBox.stateChanged.connect(self.tiledgraphics)
+        self.recordCheckBox.stateChanged.connect(self.record)
+        self.reconnectCheckBox.stateChanged.connect(self.reconnect)
         # Connect signals for cross-thread calls to update display.
         self.screen.doUpdate_signal_object.signal.connect(self.screen.doUpdate)
         self.screen.doGrUpdate_signal_object.signal.connect(self.screen.doGrUpdate)
+        self.screen.drainReceived_signal_object.signal.connect(self.screen.drainReceived)
 
     def alt_key_handler(self,kcode):
         """
@@ -4200,6 +6489,9 @@ class TerminalDialog(QDialog):
             self.screen.toggleSquare()
         elif kcode == 9 :# v: paste one line of any clipboard contents to current line.
             self.screen.paste_from_clipboard()
+        elif kcode == 10: # f: find text in the scroll buffer.
+            self.findEdit.setFocus()
+            self.findEdit.selectAll()
 
     def read_host_data(self):
         """
@@ -4243,6 +6535,7 @@ class TerminalDialog(QDialog):
         Connect to host - but only if not already connected.
         """
         self.logfilename()
+        self.screen.cancel_reconnect()
         if not self.screen.haveconnection:
             self.screen.clearScreen()
             self.screen.open_conn(str(self.hostAddressEdit.text()), self.portNumberSpinbox.value())
@@ -4293,17 +6586,38 @@ class TerminalDialog(QDialog):
 
     def savegraf(self):
         """
-        Save graphics to SVG format file.
+        Save graphics to SVG, PDF or GTerm display list format file.
         """
-        fname = QFileDialog.getSaveFileName(self,'Save graphics',os.getenv('HOME'))
+        fname = QFileDialog.getSaveFileName(self,'Save graphics',os.getenv('HOME'), \
+                                            'SVG (*.svg);;PDF (*.pdf);;GTerm display list (*.gdl)')
         try:
-            fname = fname[0]
+            (fname,ftype) = fname
             if len(fname) > 0:
+                # Use the type chosen if the name does not say.
+                if os.path.splitext(fname)[1].lower() not in ('.svg','.pdf','.gdl'):
+                    if '.pdf' in ftype:
+                        fname += '.pdf'
+                    elif '.gdl' in ftype:
+                        fname += '.gdl'
                 self.screen.saveGraphics(str(fname))
         except Exception as e:
             print('savegraf(): Do not understand:',str(fname))
             print('... Reason:',e)
 
+    def loadgraf(self):
+        """
+        Load graphics from a GTerm display list file.
+        """
+        fname = QFileDialog.getOpenFileName(self,'Load graphics',os.getenv('HOME'), \
+                                            'GTerm display list (*.gdl)')
+        try:
+            fname = fname[0]
+            if len(fname) > 0:
+                self.screen.loadGraphics(str(fname))
+        except Exception as e:
+            print('loadgraf(): Do not understand:',str(fname))
+            print('... Reason:',e)
+
     def showvkb(self):
         """
         Show the virtual keyboard.
@@ -4322,6 +6636,12 @@ class TerminalDialog(QDialog):
         """
         self.screen.set_local_echo(self.localEchoCheckBox.isChecked())
 
+    def reconnect(self):
+        """
+        Reconnect automatically when the host closes the connection.
+        """
+        self.screen.set_reconnect(self.reconnectCheckBox.isChecked())
+
     def debugon(self):
         """
         Turn debug output on or off.
@@ -4343,6 +6663,56 @@ class TerminalDialog(QDialog):
         """
         self.screen.setOnPaper(self.onPaperCheckBox.isChecked())
 
+    def historylines(self):
+        """
+        Set the number of lines kept for scrolling back.
+        """
+        self.screen.setHistoryLines(self.historySpinbox.value())
+
+    def findtext(self):
+        """
+        Find the text typed so far in the scroll buffer. Shown in red if it is not there.
+        """
+        found = self.screen.findText(self.findEdit.text())
+        self.findEdit.setStyleSheet('' if found else 'background-color: #f0b0b0')
+
+    def findolder(self):
+        """
+        Find the next older line with the text in the scroll buffer (Return in the Find box).
+        """
+        found = self.screen.findText(self.findEdit.text(),True)
+        self.findEdit.setStyleSheet('' if found else 'background-color: #f0b0b0')
+
+    def glgraphics(self):
+        """
+        Draw graphics with OpenGL, not Cairo, where possible.
+        """
+        self.screen.setGLGraphics(self.glGraphicsCheckBox.isChecked())
+
+    def tiledgraphics(self):
+        """
+        Draw big Cairo graphics redraws in tiles on several threads.
+        """
+        self.screen.setTiledGraphics(self.tiledGraphicsCheckBox.isChecked())
+
+    def record(self):
+        """
+        Start or stop recording the session to a file in the log directory.
+        ctreplay can serve it back later, e.g. for benchmarking.
+        """
+        if self.recordCheckBox.isChecked():
+            localtime = time.localtime(time.time())
+            tstring = 'gterm_session_{0:04d}_{1:02d}_{2:02d}_{3:02d}_{4:02d}_{5:02d}.bin'.\
+                format(localtime.tm_year,localtime.tm_mon,localtime.tm_mday,\
+                           localtime.tm_hour,localtime.tm_min,localtime.tm_sec)
+            rfname = os.path.abspath(os.path.join(self.logdir,tstring))
+            if self.screen.openRecordFile(rfname):
+                print('Recording session to:',rfname)
+            else:
+                self.recordCheckBox.setChecked(False)
+        else:
+            self.screen.closeRecordFile()
+
     def noescapemode(self):
         """
         Turn off escape processing to allow esacpe character to be typed in.
@@ -4547,6 +6917,9 @@ class TerminalDialog(QDialog):
         smsg += "{0}Visible region scroll = {1} lines<br>".format(sp6,self.screen.scroll)
         smsg += "{0}<b>Graphics plane state:</b><br>".format(sp3)
         smsg += "{0}Commands in graphics buffer = {1}<br>".format(sp6,self.screen.gcbcmds)
+        smsg += "{0}<b>Performance:</b><br>".format(sp3)
+        for line in self.screen.statsText():
+            smsg += "{0}{1}<br>".format(sp6,line)
         smsg += "{0}<b>Paste buffer contents:</b><br>".format(sp3)
         smsg += "<pre>"
         smsg += self.screen.paste_buffer
@@ -4581,15 +6954,154 @@ class TerminalDialog(QDialog):
         else:
             event.ignore()
 
+def readSessionFile(filename):
+    """
+    Read what the host sent in the first session of a session record file (as written by
+    GTerm's Record option or ctelnet --trace). Returns a list of (nanoseconds, bytes).
+    """
+    header = GTermTelnetWidget.record_header
+    entry = GTermTelnetWidget.record_entry
+    received = []
+    with open(filename,'rb') as f:
+        (magic, order, version, sec, nsec) = header.unpack(f.read(header.size))
+        if (magic != b'CTTRACE1') or (order != 0x01020304) or (version != 1):
+            raise ValueError('not a session record file, or written by a different version or machine type')
+        session = None
+        while True:
+            rec = f.read(entry.size)
+            if len(rec) < entry.size:
+                break
+            (ns, count, rsession, direction, pad) = entry.unpack(rec)
+            data = f.read(count)
+            if (direction == ord('I')) and (count > 0) and (session in (None, rsession)):
+                session = rsession
+                received.append((ns, data))
+    return received
+
+class benchSink(object):
+    """
+    Stands in for the socket when benchmark() removes telnet commands: replies go nowhere.
+    """
+    def sendall(self,data):
+        pass
+
+def percentiles(times):
+    """
+    A one line summary of a list of times in seconds: 50th, 90th and 99th percentile and worst.
+    """
+    if len(times) == 0:
+        return 'no frames'
+    ms = sorted([1000.0 * t for t in times])
+    n = len(ms)
+    return 'p50 {0:.2f} ms, p90 {1:.2f} ms, p99 {2:.2f} ms, max {3:.2f} ms'.format(
+        ms[n // 2], ms[(n * 9) // 10], ms[(n * 99) // 100], ms[-1])
+
+def benchmark(args):
+    """
+    Push a recorded session through the receive and render code with no window shown, and
+    report what it cost. Run as: python -m gterm --bench session_file [options].
+    The host data goes through telnet command removal (XTelnet.process_bulk()) and
+    screenAddString() (which runs addGraphics()), then the graphics are drawn repeatedly
+    with cairoRenderGraphics() and the screen with paintGL(), each timed.
+    """
+    usage = "python -m gterm --bench session_file [--mode N --frames N --size WxH --tiled]"
+    parser = optparse.OptionParser(usage=usage)
+    parser.add_option("-m", "--mode", dest="mode", type="int", default=3,
+                      help="Mode menu entry, 0 for Cyber/APL to 6 for Unix/Local. Default 3 (Unix).")
+    parser.add_option("-f", "--frames", dest="frames", type="int", default=20)
+    parser.add_option("-s", "--size", dest="size", default="1920x1080")
+    parser.add_option("-t", "--tiled", dest="tiled", action="store_true", default=False)
+    (options,files) = parser.parse_args(args)
+    if len(files) != 1:
+        parser.error('one session file is needed')
+    (imwidth,imheight) = [int(v) for v in options.size.lower().split('x')]
+
+    try:
+        received = readSessionFile(files[0])
+    except Exception as e:
+        print('Could not read session file:',files[0])
+        print('... Reason:',e)
+        return
+    nbytes = sum([len(data) for (ns,data) in received])
+    print('Session: {0}: {1} bytes in {2} records.'.format(files[0],nbytes,len(received)))
+
+    # No window is shown, so no display is needed.
+    os.environ.setdefault('QT_QPA_PLATFORM','offscreen')
+    app = QApplication(["GTerm benchmark"])
+    dialog = TerminalDialog()
+    dialog.mode(options.mode)
+    dialog.resize(imwidth,imheight)
+    screen = dialog.screen
+    screen.setTiledGraphics(options.tiled)
+    telnet = XTelnet()
+    telnet.sock = benchSink()
+
+    # Receive: telnet, text and escape sequence decoding and the graphics display list.
+    ncommands = 0
+    start = time.perf_counter()
+    for (ns,data) in received:
+        generation = screen.gcb.generation
+        before = len(screen.gcb)
+        screen.screenAddString(telnet.process_bulk(data))
+        ncommands += len(screen.gcb) - (before if screen.gcb.generation == generation else 0)
+    elapsed = max(1e-9, time.perf_counter() - start)
+    print('Receive: {0:.3f} s, {1:.0f} bytes/s, {2} graphics commands, {3:.0f} commands/s.'.format(
+        elapsed, nbytes / elapsed, ncommands, ncommands / elapsed))
+
+    # Full Cairo redraws of the graphics, as after a resize or zoom.
+    if len(screen.gcb) > 0:
+        times = []
+        for i in range(options.frames):
+            screen.crgraf_surface = cairo.ImageSurface(cairo.FORMAT_ARGB32, imwidth, imheight)
+            start = time.perf_counter()
+            if options.tiled:
+                screen.cairoRenderGraphicsTiled(imwidth,imheight)
+            else:
+                screen.cairoRenderGraphics(cairo.Context(screen.crgraf_surface),imwidth,imheight)
+            times.append(time.perf_counter() - start)
+        print('cairoRenderGraphics() {0}x{1}{2}: {3}.'.format(imwidth,imheight,
+              ', tiled' if options.tiled else '',percentiles(times)))
+
+    # Whole screen repaints of the text and graphics views.
+    for (name,graphics) in (('text',False),('graphics',True)):
+        times = []
+        try:
+            screen.drawgraf = graphics
+            for i in range(options.frames):
+                # Make the graphics view draw everything again each frame.
+                screen.crgraf_context = None
+                screen.markDirtyAll()
+                start = time.perf_counter()
+                screen.grabFramebuffer()
+                times.append(time.perf_counter() - start)
+            print('paintGL() {0} view: {1}.'.format(name,percentiles(times)))
+        except Exception as e:
+            print('paintGL() {0} view: could not be run here.'.format(name))
+            print('... Reason:',e)
+
+    peak = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    if platform.system() == 'Darwin':
+        peak = peak // 1024
+    print('Peak memory: {0} KB.'.format(peak))
+
 def main():
     """
-    Main line
+    Main line. With --bench session_file, run benchmark() instead.
     """
+    if (len(sys.argv) > 1) and (sys.argv[1] == '--bench'):
+        benchmark(sys.argv[2:])
+        return
     #print('Main thread id = ', threading.get_ident())
     app = QApplication(["GTerm: Glass Teletype with Graphics!"])
     dialog = TerminalDialog()
     dialog.setlogdir("/tmp") #os.path.join(os.getcwd(),"LogFiles"))
     dialog.show()
+    # kill -USR1 prints statistics, like ctelnet. Python only runs signal handlers
+    # between bytecodes, so a timer makes sure it gets the chance while Qt waits.
+    signal.signal(signal.SIGUSR1, lambda signum, frame: dialog.screen.printStats())
+    signal_timer = QTimer()
+    signal_timer.timeout.connect(lambda: None)
+    signal_timer.start(500)
     app.exec()
 
 if __name__ == "__main__":
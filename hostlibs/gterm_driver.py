@@ -1,6 +1,7 @@
 #!/usr/bin/env python
 import sys
 import random
+import atexit
 
 class GtermGraphics(object):
     """
@@ -9,9 +10,50 @@ class GtermGraphics(object):
     a very simple standalone graphics library rather than a totally dumb device.
     """
 
-    def __init__(self,lun=sys.stdout,fixedmode=False):
+    # Digits for polyline deltas. Each delta is zigzag encoded and sent 5 bits at a
+    # time, least significant first. All but the last use a more_digits character.
+    polyline_last_digits = '0123456789LMNOPQRUVWXYabcdegijko'
+    polyline_more_digits = '!#%&()*+,-./:;<=>?]^_{|}pqrtvwxy'
+    polyline_max_points = 100
+
+    def __init__(self,lun=sys.stdout,fixedmode=False,polylines=False):
+        """
+        If polylines is True, consecutive move() and draw() calls are collected and sent
+        as polyline commands. Only recent GTerm versions understand those. Collected
+        points are sent by the next other command, flush() or finish(), and by
+        finish() at exit if nothing else has sent them.
+        """
         self.lun = lun
         self.fixedmode = fixedmode
+        self.polylines = polylines
+        self.pending_xs = []
+        self.pending_ys = []
+        self.pen_x = None
+        self.pen_y = None
+        if polylines:
+            atexit.register(self.finish)
+
+    def write(self,s):
+        """
+        Send a command, after any polyline still being collected.
+        """
+        self.endpolyline()
+        self.lun.write(s)
+
+    def finish(self):
+        """
+        Send any move() and draw() calls still being collected and flush the output
+        stream. Call this when the picture is complete.
+        """
+        self.endpolyline()
+        self.lun.flush()
+
+    def forgetpen(self):
+        """
+        The pen position is no longer known, e.g. after text or a new coordinate system.
+        """
+        self.pen_x = None
+        self.pen_y = None
 
     def unavailable(self, msg):
         print('Function: {0}() is unavailable in fixed mode.'.format(msg))
@@ -23,10 +65,11 @@ class GtermGraphics(object):
         """
         Empty the graphics display list. Clear the screen, in effect.
         """
+        self.forgetpen()
         if self.fixedmode:
-            self.lun.write('\033[0z')
+            self.write('\033[0z')
         else:
-            self.lun.write('@[0@')
+            self.write('@[0@')
 
     def colour(self,r,g,b):
         """
@@ -42,18 +85,53 @@ class GtermGraphics(object):
             ig = self.clamp(g,0.0,1.0)
             ib = self.clamp(b,0.0,1.0)
             s = '@[1 {0:.3f} {1:.3f} {2:.3f} @'.format(ir,ig,ib)
-        self.lun.write(s)
+        self.write(s)
 
     def erase(self):
         """
         Fill the display with the drawing colour.
         """
         if self.fixedmode:
-            self.lun.write('\033[2z')
+            self.write('\033[2z')
         else:
-            self.lun.write('@[2@')
+            self.write('@[2@')
 
     def pen(self,x,y,z,rel=False):
+        if rel:
+            if self.pen_x is not None:
+                self.pen_x += x
+                self.pen_y += y
+        else:
+            px = self.pen_x
+            py = self.pen_y
+            self.pen_x = x
+            self.pen_y = y
+        if self.polylines and not rel:
+            if z > 0 and len(self.pending_xs) == 0 and px is not None:
+                # A draw after some other command starts a batch from where the pen is.
+                self.pending_xs = [px]
+                self.pending_ys = [py]
+            if z > 0 and len(self.pending_xs) > 0:
+                self.pending_xs.append(x)
+                self.pending_ys.append(y)
+                if len(self.pending_xs) >= self.polyline_max_points:
+                    self.endpolyline()
+                    self.pending_xs = [x]
+                    self.pending_ys = [y]
+                return
+            elif z <= 0:
+                self.endpolyline()
+                self.pending_xs = [x]
+                self.pending_ys = [y]
+                return
+        s = self.pencommand(x,y,z,rel)
+        if s is not None:
+            self.write(s)
+
+    def pencommand(self,x,y,z,rel=False):
+        """
+        Make the command string for a pen() move or draw.
+        """
         if z > 0:
             c = 'I' if rel else 4
         else:
@@ -61,15 +139,80 @@ class GtermGraphics(object):
         if self.fixedmode:
             if rel:
                 self.unavailable('relative move or draw')
-                return
+                return None
             else:
                 ix = self.clamp(int(9999.9*x),0,9999)
                 iy = self.clamp(int(9999.9*y),0,9999)
-                s = '\033[{0:1d}{1:04d}{2:04d}z'.format(c,ix,iy)
+                return '\033[{0:1d}{1:04d}{2:04d}z'.format(c,ix,iy)
+        else:
+            return '@[{0} {1} {2} @'.format(c,x,y)
+
+    def encode_delta(self,d):
+        """
+        Encode one integer polyline delta in fixed mode.
+        """
+        v = (d << 1) if d >= 0 else ((-d) << 1) - 1
+        s = ''
+        while v >= 32:
+            s += self.polyline_more_digits[v & 31]
+            v >>= 5
+        return s + self.polyline_last_digits[v]
+
+    def sendpolyline(self,xs,ys):
+        """
+        Send one polyline command: a move to the first point and draws to the others.
+        """
+        if self.fixedmode:
+            ixs = [self.clamp(int(9999.9*x),0,9999) for x in xs]
+            iys = [self.clamp(int(9999.9*y),0,9999) for y in ys]
+            s = '\033[L{0:04d}{1:04d}'.format(ixs[0],iys[0])
+            for i in range(1,len(ixs)):
+                s += self.encode_delta(ixs[i]-ixs[i-1]) + self.encode_delta(iys[i]-iys[i-1])
+            s += 'z'
         else:
-            s = '@[{0} {1} {2} @'.format(c,x,y)
+            # GTerm adds the deltas up, so each is taken from where the rounded values
+            # sent so far put the pen. That stops rounding errors from building up.
+            s = '@[L {0} {1}'.format(xs[0],ys[0])
+            xsent = float(xs[0])
+            ysent = float(ys[0])
+            for i in range(1,len(xs)):
+                dx = '{0:.6g}'.format(xs[i]-xsent)
+                dy = '{0:.6g}'.format(ys[i]-ysent)
+                xsent += float(dx)
+                ysent += float(dy)
+                s += ' ' + dx + ' ' + dy
+            s += ' @'
         self.lun.write(s)
 
+    def endpolyline(self):
+        """
+        Send any move() and draw() calls collected when polylines is True.
+        """
+        xs = self.pending_xs
+        ys = self.pending_ys
+        self.pending_xs = []
+        self.pending_ys = []
+        if len(xs) == 1:
+            self.lun.write(self.pencommand(xs[0],ys[0],0))
+        elif len(xs) > 1:
+            self.sendpolyline(xs,ys)
+
+    def polyline(self,xs,ys):
+        """
+        Move to (xs[0],ys[0]) then draw through the other points, using polyline
+        commands. Only recent GTerm versions understand those.
+        """
+        self.endpolyline()
+        n = min(len(xs),len(ys))
+        if n > 0:
+            self.pen_x = xs[n-1]
+            self.pen_y = ys[n-1]
+        i = 0
+        while i < n - 1:
+            j = min(i + self.polyline_max_points, n)
+            self.sendpolyline(xs[i:j],ys[i:j])
+            i = j - 1
+
     def move(self,x,y):
         """
         Move to user coordinates (x,y). In fixed mode, the user coordinates
@@ -104,12 +247,13 @@ class GtermGraphics(object):
         
     def flush(self):
         """
-        Ensure the contents of the display list are drawn.
+        Ensure the contents of the display list are drawn, including any move() and
+        draw() calls still being collected.
         """
         if self.fixedmode:
-            self.lun.write('\033[5z')
+            self.write('\033[5z')
         else:
-            self.lun.write('@[5@')        
+            self.write('@[5@')        
 
     def width(self,w):
         """
@@ -121,7 +265,7 @@ class GtermGraphics(object):
         else:
             iw = self.clamp(w,0.0,9.0)
             s = '@[6 {0} @'.format(iw)
-        self.lun.write(s)
+        self.write(s)
 
     def bounds(self,xlo,ylo,xhi,yhi):
         """
@@ -130,11 +274,12 @@ class GtermGraphics(object):
         *X* bounds will be adjusted so that something that is sqaure in user coords appears
         square in the display.
         """
+        self.forgetpen()
         if self.fixedmode:
             self.unavailable('bounds')
         else:
             s = '@[7 {0} {1} {2} {3} @'.format(xlo,ylo,xhi,yhi)
-            self.lun.write(s)
+            self.write(s)
 
     def gbounds(self,xlo,ylo,xhi,yhi):
         """
@@ -143,21 +288,23 @@ class GtermGraphics(object):
         has previously been used, the *X* range is adjusted so that the tick intervals are the same on both
         axes and the X range is *centered on* the supplied X range.
         """
+        self.forgetpen()
         if self.fixedmode:
             self.unavailable('gbounds')
         else:
             s = '@[8 {0} {1} {2} {3} @'.format(xlo,ylo,xhi,yhi)
-            self.lun.write(s)
+            self.write(s)
 
     def text(self,string):
         """
         Output text at the last move() location.
         """
+        self.forgetpen()
         if self.fixedmode:
             self.unavailable('text')
         else:
             s = '@[9 {0} @'.format(string)
-            self.lun.write(s)
+            self.write(s)
 
     def textsize(self,size):
         """
@@ -168,7 +315,7 @@ class GtermGraphics(object):
         else:
             size = max(3,size)
             s = '@[A {0} @'.format(size)
-            self.lun.write(s)
+            self.write(s)
         
     def textalign(self,alignment):
         """
@@ -186,7 +333,7 @@ class GtermGraphics(object):
                 print('Unknown alignment name:',alignment)
                 return
             s = '@[B {0} @'.format(alcode)
-            self.lun.write(s)
+            self.write(s)
 
     def textfont(self,fontname):
         """
@@ -203,50 +350,54 @@ class GtermGraphics(object):
                 print('Unknown font name:',fontname)
                 return
             s = '@[C {0} @'.format(fncode)
-            self.lun.write(s)
+            self.write(s)
 
     def point(self,x,y):
         """
         Draw a point at user coordinates (x,y).
         """
+        self.forgetpen()
         if self.fixedmode:
             self.unavailable('point')
         else:         
             s = '@[D {0} {1} @'.format(x,y)
-            self.lun.write(s)       
+            self.write(s)       
 
     def title(self,string):
         """
         Draw a graph title in a fixed size and font centered on the display.
         """
+        self.forgetpen()
         if self.fixedmode:
             self.unavailable('title')
         else:     
             s = '@[E {0} @'.format(string)
-            self.lun.write(s)
+            self.write(s)
 
     def circle(self,x,y,r):
         """
         Draw a circle, center user coords (x,y), radius user X units r. This is always a circle, regardless of
         the bounds set.
         """
+        self.forgetpen()
         if self.fixedmode:
             self.unavailable('circle')
         else:         
             s = '@[F {0} {1} {2}  @'.format(x,y,r)
-            self.lun.write(s)
+            self.write(s)
 
     def square_bounds(self,yes):
         """
         Modify subsequent bounds() and gbounds() calls so that if a square is drawn in user coordinates
         it appears square on the display.
         """
+        self.forgetpen()
         if self.fixedmode:
             self.unavailable('square_bounds')
         else:        
             iyes = 1 if yes else 0
             s = '@[G {0} @'.format(iyes)
-            self.lun.write(s)
+            self.write(s)
 
 if __name__ == "__main__":
 